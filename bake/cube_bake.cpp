@@ -0,0 +1,978 @@
+// Offline baker, writes a model as the baked scene GltfScene loads directly.
+// Triangle lists are rebuilt on the way: shared vertices merged, indices put
+// in vertex cache then overdraw order and 16 bit where they fit, vertices
+// renumbered in fetch order and their attributes quantized. Textures are
+// decoded and their mip chains built.
+//
+// cube_bake <model.gltf|model.glb> <model.bake>
+
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <tiny_gltf.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "MipKernels.h"
+#include "SceneBake.h"
+
+#define BAKE_CACHE_SIZE 32		// post-transform cache the index order is tuned for
+#define BAKE_CLUSTER_TRIANGLES 64	// triangles kept together when sorting for overdraw
+#define BAKE_EMPTY 0xffffffffu
+
+// One attribute of a primitive, widened to floats
+struct BakeStream
+{
+	std::string semantic;
+	int type;
+	int components;
+	std::vector<float> values;
+};
+
+struct BakeStats
+{
+	size_t primitives;
+	size_t verticesIn;
+	size_t verticesOut;
+	size_t indexBytesIn;
+	size_t indexBytesOut;
+	size_t vertexBytesIn;
+	size_t vertexBytesOut;
+};
+
+static bool StartsWith(const std::string& text, const char* pPrefix)
+{
+	return text.compare(0, strlen(pPrefix), pPrefix) == 0;
+}
+
+// Start of an accessor's elements and the distance between them, null if
+// they run past the end of the buffer
+static const unsigned char* AccessorData(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t* pStride)
+{
+	const tinygltf::BufferView* bufferView = &model.bufferViews[accessor.bufferView];
+	const tinygltf::Buffer* buffer = &model.buffers[bufferView->buffer];
+	size_t element = tinygltf::GetComponentSizeInBytes(accessor.componentType)
+		* tinygltf::GetTypeSizeInBytes(accessor.type);
+
+	*pStride = (bufferView->byteStride != 0) ? bufferView->byteStride : element;
+
+	size_t start = bufferView->byteOffset + accessor.byteOffset;
+	if (accessor.count > 0 &&
+	    start + (accessor.count - 1) * *pStride + element > buffer->data.size())
+		return nullptr;
+
+	return buffer->data.data() + start;
+}
+
+static GLResult ReadStream(const tinygltf::Model& model, const std::string& semantic, int index, BakeStream* pStream)
+{
+	const tinygltf::Accessor* accessor = &model.accessors[index];
+
+	pStream->semantic = semantic;
+	pStream->type = accessor->type;
+	pStream->components = tinygltf::GetTypeSizeInBytes(accessor->type);
+	pStream->values.assign(accessor->count * pStream->components, 0.0f);
+
+	// no bufferView is all zeros
+	if (accessor->bufferView < 0)
+		return GLResult::Success;
+
+	size_t stride;
+	const unsigned char* pData = AccessorData(model, *accessor, &stride);
+	if (pData == nullptr)
+	{
+		fprintf(stderr, "[ERROR] %s accessor %d runs past its buffer\n", semantic.c_str(), index);
+		return GLResult::Failed;
+	}
+
+	int size = tinygltf::GetComponentSizeInBytes(accessor->componentType);
+
+	for (size_t i = 0; i < accessor->count; ++i)
+	{
+		for (int c = 0; c < pStream->components; ++c)
+		{
+			pStream->values[i * pStream->components + c] =
+				ReadComponent(pData + i * stride + c * size, accessor->componentType, accessor->normalized);
+		}
+	}
+
+	return GLResult::Success;
+}
+
+static GLResult ReadIndices(const tinygltf::Model& model, int index, size_t vertexCount, std::vector<uint32_t>* pIndices)
+{
+	const tinygltf::Accessor* accessor = &model.accessors[index];
+	size_t stride;
+	const unsigned char* pData = AccessorData(model, *accessor, &stride);
+
+	if (pData == nullptr)
+	{
+		fprintf(stderr, "[ERROR] index accessor %d runs past its buffer\n", index);
+		return GLResult::Failed;
+	}
+
+	pIndices->resize(accessor->count);
+	for (size_t i = 0; i < accessor->count; ++i)
+	{
+		uint32_t value = static_cast<uint32_t>(ReadComponent(pData + i * stride, accessor->componentType, false));
+		if (value >= vertexCount)
+		{
+			fprintf(stderr, "[ERROR] index accessor %d refers to vertex %u of %zu\n", index, value, vertexCount);
+			return GLResult::Failed;
+		}
+
+		(*pIndices)[i] = value;
+	}
+
+	return GLResult::Success;
+}
+
+static bool SameVertex(const std::vector<BakeStream>& streams, uint32_t a, uint32_t b)
+{
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		int components = streams[i].components;
+		if (memcmp(&streams[i].values[a * components],
+			   &streams[i].values[b * components],
+			   components * sizeof(float)) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+// Point every index at the first vertex with identical attributes
+static void DedupeVertices(const std::vector<BakeStream>& streams, size_t vertexCount, std::vector<uint32_t>* pIndices)
+{
+	size_t buckets = 1;
+	while (buckets < vertexCount * 2)
+		buckets *= 2;
+
+	std::vector<uint32_t> table(buckets, BAKE_EMPTY);
+	std::vector<uint32_t> remap(vertexCount);
+
+	for (uint32_t v = 0; v < vertexCount; ++v)
+	{
+		uint64_t hash = 0;
+		for (size_t i = 0; i < streams.size(); ++i)
+		{
+			int components = streams[i].components;
+			hash = hash * 31 + HashBytes(reinterpret_cast<const unsigned char*>(&streams[i].values[v * components]),
+						     components * sizeof(float));
+		}
+
+		size_t slot = hash & (buckets - 1);
+		while (table[slot] != BAKE_EMPTY && SameVertex(streams, table[slot], v) == false)
+		{
+			slot = (slot + 1) & (buckets - 1);
+		}
+
+		if (table[slot] == BAKE_EMPTY)
+			table[slot] = v;
+
+		remap[v] = table[slot];
+	}
+
+	for (size_t i = 0; i < pIndices->size(); ++i)
+	{
+		(*pIndices)[i] = remap[(*pIndices)[i]];
+	}
+}
+
+// Forsyth's linear speed vertex cache ordering: recently used vertices and
+// ones with few triangles left score highest, and the best scoring triangle
+// touching the cache goes next
+static float VertexScore(int cachePosition, uint32_t remaining)
+{
+	if (remaining == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 3)
+		score = powf(1.0f - (cachePosition - 3) / static_cast<float>(BAKE_CACHE_SIZE - 3), 1.5f);
+	else if (cachePosition >= 0)
+		score = 0.75f;
+
+	return score + 2.0f / sqrtf(static_cast<float>(remaining));
+}
+
+static void OptimizeVertexCache(std::vector<uint32_t>* pIndices, size_t vertexCount)
+{
+	const std::vector<uint32_t>& indices = *pIndices;
+	size_t triangles = indices.size() / 3;
+
+	// triangles using each vertex, the ones still to be emitted first
+	std::vector<uint32_t> first(vertexCount + 1, 0);
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		++first[indices[i] + 1];
+	}
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		first[v + 1] += first[v];
+	}
+
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	std::vector<uint32_t> adjacency(indices.size());
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		uint32_t v = indices[i];
+		adjacency[first[v] + remaining[v]++] = i / 3;
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		vertexScore[v] = VertexScore(-1, remaining[v]);
+	}
+
+	std::vector<float> triangleScore(triangles);
+	std::vector<bool> emitted(triangles, false);
+	for (size_t t = 0; t < triangles; ++t)
+	{
+		triangleScore[t] = vertexScore[indices[t * 3]] +
+			vertexScore[indices[t * 3 + 1]] +
+			vertexScore[indices[t * 3 + 2]];
+	}
+
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> nextCache;
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	size_t cursor = 0;
+	int64_t best = -1;
+
+	for (size_t n = 0; n < triangles; ++n)
+	{
+		// nothing in the cache has triangles left, restart in input order
+		if (best < 0)
+		{
+			while (emitted[cursor])
+				++cursor;
+			best = cursor;
+		}
+
+		const uint32_t* triangle = &indices[best * 3];
+		emitted[best] = true;
+		output.insert(output.end(), triangle, triangle + 3);
+
+		nextCache.assign(triangle, triangle + 3);
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				nextCache.push_back(cache[i]);
+		}
+
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t v = triangle[k];
+			uint32_t* pList = &adjacency[first[v]];
+
+			for (uint32_t i = 0; i < remaining[v]; ++i)
+			{
+				if (pList[i] == best)
+				{
+					std::swap(pList[i], pList[remaining[v] - 1]);
+					--remaining[v];
+					break;
+				}
+			}
+		}
+
+		// vertices pushed past the end are rescored as evicted
+		for (size_t i = 0; i < nextCache.size(); ++i)
+		{
+			uint32_t v = nextCache[i];
+			cachePosition[v] = (i < BAKE_CACHE_SIZE) ? static_cast<int>(i) : -1;
+
+			float score = VertexScore(cachePosition[v], remaining[v]);
+			float delta = score - vertexScore[v];
+			vertexScore[v] = score;
+
+			for (uint32_t j = 0; j < remaining[v]; ++j)
+			{
+				triangleScore[adjacency[first[v] + j]] += delta;
+			}
+		}
+
+		if (nextCache.size() > BAKE_CACHE_SIZE)
+			nextCache.resize(BAKE_CACHE_SIZE);
+		cache.swap(nextCache);
+
+		best = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			uint32_t v = cache[i];
+			for (uint32_t j = 0; j < remaining[v]; ++j)
+			{
+				uint32_t t = adjacency[first[v] + j];
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	pIndices->swap(output);
+}
+
+// Reorder runs of cache ordered triangles so the ones facing out from the
+// middle of the mesh draw first. From any view those are the front of the
+// mesh, and hide what is drawn after them.
+static void OptimizeOverdraw(std::vector<uint32_t>* pIndices, const BakeStream& positions)
+{
+	const std::vector<uint32_t>& indices = *pIndices;
+	size_t triangles = indices.size() / 3;
+	size_t clusters = (triangles + BAKE_CLUSTER_TRIANGLES - 1) / BAKE_CLUSTER_TRIANGLES;
+
+	if (clusters < 2)
+		return;
+
+	std::vector<float> centroid(triangles * 3);
+	std::vector<float> normal(triangles * 3);
+	float middle[3] = {0.0f, 0.0f, 0.0f};
+
+	for (size_t t = 0; t < triangles; ++t)
+	{
+		const float* p0 = &positions.values[indices[t * 3] * 3];
+		const float* p1 = &positions.values[indices[t * 3 + 1] * 3];
+		const float* p2 = &positions.values[indices[t * 3 + 2] * 3];
+
+		float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+		float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+		// area weighted
+		normal[t * 3] = e1[1] * e2[2] - e1[2] * e2[1];
+		normal[t * 3 + 1] = e1[2] * e2[0] - e1[0] * e2[2];
+		normal[t * 3 + 2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+		for (int c = 0; c < 3; ++c)
+		{
+			centroid[t * 3 + c] = (p0[c] + p1[c] + p2[c]) / 3.0f;
+			middle[c] += centroid[t * 3 + c] / triangles;
+		}
+	}
+
+	std::vector<std::pair<float, uint32_t> > order(clusters);
+
+	for (size_t i = 0; i < clusters; ++i)
+	{
+		size_t begin = i * BAKE_CLUSTER_TRIANGLES;
+		size_t end = std::min(begin + BAKE_CLUSTER_TRIANGLES, triangles);
+		float center[3] = {0.0f, 0.0f, 0.0f};
+		float facing[3] = {0.0f, 0.0f, 0.0f};
+
+		for (size_t t = begin; t < end; ++t)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				center[c] += centroid[t * 3 + c] / (end - begin);
+				facing[c] += normal[t * 3 + c];
+			}
+		}
+
+		float length = sqrtf(facing[0] * facing[0] + facing[1] * facing[1] + facing[2] * facing[2]);
+		float outward = 0.0f;
+		if (length > 0.0f)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				outward += (center[c] - middle[c]) * facing[c] / length;
+			}
+		}
+
+		// most outward first, stable for ties
+		order[i] = std::make_pair(-outward, static_cast<uint32_t>(i));
+	}
+
+	std::sort(order.begin(), order.end());
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	for (size_t i = 0; i < clusters; ++i)
+	{
+		size_t begin = order[i].second * BAKE_CLUSTER_TRIANGLES;
+		size_t end = std::min(begin + BAKE_CLUSTER_TRIANGLES, triangles);
+		output.insert(output.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+	}
+
+	pIndices->swap(output);
+}
+
+// Renumber vertices in the order the indices first use them, so fetches
+// walk forward through the vertex data. pOrder is the source vertex of each,
+// vertices no index uses are dropped.
+static void OptimizeVertexFetch(std::vector<uint32_t>* pIndices, size_t vertexCount, std::vector<uint32_t>* pOrder)
+{
+	std::vector<uint32_t> remap(vertexCount, BAKE_EMPTY);
+	pOrder->clear();
+
+	for (size_t i = 0; i < pIndices->size(); ++i)
+	{
+		uint32_t v = (*pIndices)[i];
+		if (remap[v] == BAKE_EMPTY)
+		{
+			remap[v] = pOrder->size();
+			pOrder->push_back(v);
+		}
+
+		(*pIndices)[i] = remap[v];
+	}
+}
+
+// Append to the baked mesh buffer, 4 byte aligned as vertex attributes must be
+static int AddView(tinygltf::Model* pModel, int buffer, const void* pData, size_t size, size_t stride, GLenum target)
+{
+	std::vector<unsigned char>* data = &pModel->buffers[buffer].data;
+	size_t offset = (data->size() + 3) & ~static_cast<size_t>(3);
+
+	data->resize(offset + size);
+	memcpy(data->data() + offset, pData, size);
+
+	tinygltf::BufferView view;
+	view.buffer = buffer;
+	view.byteOffset = offset;
+	view.byteLength = size;
+	view.byteStride = stride;
+	view.target = target;
+	pModel->bufferViews.push_back(view);
+
+	return pModel->bufferViews.size() - 1;
+}
+
+static int AddAccessor(tinygltf::Model* pModel, int view, int componentType, int type, size_t count, bool normalized)
+{
+	tinygltf::Accessor accessor;
+	accessor.bufferView = view;
+	accessor.byteOffset = 0;
+	accessor.normalized = normalized;
+	accessor.componentType = componentType;
+	accessor.count = count;
+	accessor.type = type;
+	pModel->accessors.push_back(accessor);
+
+	return pModel->accessors.size() - 1;
+}
+
+static float KeepFloat(float value) { return value; }
+static int8_t QuantizeSnorm8(float value) { return static_cast<int8_t>(lrintf(std::min(std::max(value, -1.0f), 1.0f) * 127.0f)); }
+static uint8_t QuantizeUnorm8(float value) { return static_cast<uint8_t>(lrintf(std::min(std::max(value, 0.0f), 1.0f) * 255.0f)); }
+static uint16_t QuantizeUnorm16(float value) { return static_cast<uint16_t>(lrintf(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f)); }
+static uint8_t QuantizeUint8(float value) { return static_cast<uint8_t>(lrintf(value)); }
+static uint16_t QuantizeUint16(float value) { return static_cast<uint16_t>(lrintf(value)); }
+
+// Elements are padded to 4 bytes, as a stride must be
+template <typename T>
+static int AddStream(tinygltf::Model* pModel,
+		     int buffer,
+		     const BakeStream& stream,
+		     const std::vector<uint32_t>& order,
+		     int componentType,
+		     bool normalized,
+		     T (*pQuantize)(float))
+{
+	size_t packed = stream.components * sizeof(T);
+	size_t stride = (packed + 3) & ~static_cast<size_t>(3);
+	std::vector<unsigned char> bytes(order.size() * stride, 0);
+
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		for (int c = 0; c < stream.components; ++c)
+		{
+			T value = pQuantize(stream.values[order[i] * stream.components + c]);
+			memcpy(&bytes[i * stride + c * sizeof(T)], &value, sizeof(T));
+		}
+	}
+
+	int view = AddView(pModel, buffer, bytes.data(), bytes.size(), (stride != packed) ? stride : 0, GL_ARRAY_BUFFER);
+	return AddAccessor(pModel, view, componentType, stream.type, order.size(), normalized);
+}
+
+// Bytes that sum to exactly 255, the rounding error goes to the largest
+static int AddWeights(tinygltf::Model* pModel, int buffer, const BakeStream& stream, const std::vector<uint32_t>& order)
+{
+	std::vector<uint8_t> bytes(order.size() * 4);
+
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		const float* weights = &stream.values[order[i] * 4];
+		float sum = weights[0] + weights[1] + weights[2] + weights[3];
+		uint8_t* out = &bytes[i * 4];
+		int total = 0;
+		int largest = 0;
+
+		for (int c = 0; c < 4; ++c)
+		{
+			out[c] = QuantizeUnorm8((sum > 0.0f) ? weights[c] / sum : 0.0f);
+			total += out[c];
+			if (out[c] > out[largest])
+				largest = c;
+		}
+
+		if (total > 0)
+			out[largest] += 255 - total;
+	}
+
+	int view = AddView(pModel, buffer, bytes.data(), bytes.size(), 0, GL_ARRAY_BUFFER);
+	return AddAccessor(pModel, view, TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, stream.type, order.size(), true);
+}
+
+static bool InRange(const BakeStream& stream, float lower, float upper)
+{
+	for (size_t i = 0; i < stream.values.size(); ++i)
+	{
+		if (stream.values[i] < lower || stream.values[i] > upper)
+			return false;
+	}
+
+	return true;
+}
+
+// Normals and tangents to snorm8, texcoords in [0, 1] to unorm16, colors
+// to unorm8, weights to unorm8 and joints to the smallest integer that
+// holds them. Positions stay float, the skinning pass reads them as is.
+static int AddQuantized(tinygltf::Model* pModel, int buffer, const BakeStream& stream, const std::vector<uint32_t>& order, bool singleWeights)
+{
+	const std::string& semantic = stream.semantic;
+
+	if (semantic == "NORMAL" || semantic == "TANGENT")
+		return AddStream(pModel, buffer, stream, order, TINYGLTF_COMPONENT_TYPE_BYTE, true, QuantizeSnorm8);
+
+	if (StartsWith(semantic, "TEXCOORD_") && InRange(stream, 0.0f, 1.0f))
+		return AddStream(pModel, buffer, stream, order, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, true, QuantizeUnorm16);
+
+	if (StartsWith(semantic, "COLOR_") && InRange(stream, 0.0f, 1.0f))
+		return AddStream(pModel, buffer, stream, order, TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, true, QuantizeUnorm8);
+
+	// with more than one set the weights only sum to 1 across sets
+	if (semantic == "WEIGHTS_0" && singleWeights && stream.components == 4)
+		return AddWeights(pModel, buffer, stream, order);
+
+	if (StartsWith(semantic, "WEIGHTS_"))
+		return AddStream(pModel, buffer, stream, order, TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, true, QuantizeUnorm8);
+
+	if (StartsWith(semantic, "JOINTS_"))
+	{
+		if (InRange(stream, 0.0f, 255.0f))
+			return AddStream(pModel, buffer, stream, order, TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, false, QuantizeUint8);
+		return AddStream(pModel, buffer, stream, order, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, false, QuantizeUint16);
+	}
+
+	return AddStream(pModel, buffer, stream, order, TINYGLTF_COMPONENT_TYPE_FLOAT, false, KeepFloat);
+}
+
+static size_t AccessorBytes(const tinygltf::Model& model, int index)
+{
+	const tinygltf::Accessor* accessor = &model.accessors[index];
+	return accessor->count * tinygltf::GetComponentSizeInBytes(accessor->componentType)
+		* tinygltf::GetTypeSizeInBytes(accessor->type);
+}
+
+// Rebuild a triangle list into buffer, other primitives are kept as they are
+static GLResult BakePrimitive(tinygltf::Model* pModel, int buffer, tinygltf::Primitive* pPrimitive, BakeStats* pStats)
+{
+	if (pPrimitive->mode != TINYGLTF_MODE_TRIANGLES ||
+	    pPrimitive->targets.empty() == false ||
+	    pPrimitive->attributes.find("POSITION") == pPrimitive->attributes.end())
+		return GLResult::Success;
+
+	size_t vertexCount = pModel->accessors[pPrimitive->attributes["POSITION"]].count;
+	std::vector<BakeStream> streams;
+	int position = -1;
+	bool singleWeights = pPrimitive->attributes.find("WEIGHTS_1") == pPrimitive->attributes.end();
+
+	for (std::map<std::string, int>::const_iterator it = pPrimitive->attributes.begin(); it != pPrimitive->attributes.end(); ++it)
+	{
+		if (pModel->accessors[it->second].count != vertexCount)
+		{
+			fprintf(stderr, "[WARN] %s has %zu elements for %zu vertices, primitive left as is\n",
+				it->first.c_str(), pModel->accessors[it->second].count, vertexCount);
+			return GLResult::Success;
+		}
+
+		if (it->first == "POSITION")
+			position = streams.size();
+
+		streams.push_back(BakeStream());
+		if (ReadStream(*pModel, it->first, it->second, &streams.back()) != GLResult::Success)
+			return GLResult::Failed;
+	}
+
+	std::vector<uint32_t> indices;
+	if (pPrimitive->indices >= 0)
+	{
+		if (ReadIndices(*pModel, pPrimitive->indices, vertexCount, &indices) != GLResult::Success)
+			return GLResult::Failed;
+		pStats->indexBytesIn += AccessorBytes(*pModel, pPrimitive->indices);
+	}
+	else
+	{
+		indices.resize(vertexCount);
+		for (size_t i = 0; i < vertexCount; ++i)
+		{
+			indices[i] = i;
+		}
+	}
+
+	indices.resize(indices.size() - indices.size() % 3);
+
+	for (std::map<std::string, int>::const_iterator it = pPrimitive->attributes.begin(); it != pPrimitive->attributes.end(); ++it)
+	{
+		pStats->vertexBytesIn += AccessorBytes(*pModel, it->second);
+	}
+
+	std::vector<uint32_t> order;
+	DedupeVertices(streams, vertexCount, &indices);
+	OptimizeVertexCache(&indices, vertexCount);
+	OptimizeOverdraw(&indices, streams[position]);
+	OptimizeVertexFetch(&indices, vertexCount, &order);
+
+	size_t i = 0;
+	for (std::map<std::string, int>::iterator it = pPrimitive->attributes.begin(); it != pPrimitive->attributes.end(); ++it, ++i)
+	{
+		it->second = AddQuantized(pModel, buffer, streams[i], order, singleWeights);
+		pStats->vertexBytesOut += AccessorBytes(*pModel, it->second);
+	}
+
+	// bounds place instances, keep them exact
+	tinygltf::Accessor* bounds = &pModel->accessors[pPrimitive->attributes["POSITION"]];
+	bounds->minValues.assign(3, 0.0);
+	bounds->maxValues.assign(3, 0.0);
+	for (size_t v = 0; v < order.size(); ++v)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			double value = streams[position].values[order[v] * 3 + c];
+			bounds->minValues[c] = (v == 0) ? value : std::min(bounds->minValues[c], value);
+			bounds->maxValues[c] = (v == 0) ? value : std::max(bounds->maxValues[c], value);
+		}
+	}
+
+	// 0xffff is left out, it's the restart index in some APIs
+	int view;
+	if (order.size() < 0xffff)
+	{
+		std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+		view = AddView(pModel, buffer, shortIndices.data(), shortIndices.size() * sizeof(uint16_t), 0, GL_ELEMENT_ARRAY_BUFFER);
+		pPrimitive->indices = AddAccessor(pModel, view, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+						  TINYGLTF_TYPE_SCALAR, indices.size(), false);
+	}
+	else
+	{
+		view = AddView(pModel, buffer, indices.data(), indices.size() * sizeof(uint32_t), 0, GL_ELEMENT_ARRAY_BUFFER);
+		pPrimitive->indices = AddAccessor(pModel, view, TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT,
+						  TINYGLTF_TYPE_SCALAR, indices.size(), false);
+	}
+
+	pStats->indexBytesOut += AccessorBytes(*pModel, pPrimitive->indices);
+	pStats->verticesIn += vertexCount;
+	pStats->verticesOut += order.size();
+	++pStats->primitives;
+
+	return GLResult::Success;
+}
+
+static void Mark(std::vector<int>* pUsed, int index)
+{
+	if (index >= 0)
+		(*pUsed)[index] = 1;
+}
+
+static void Remap(int* pIndex, const std::vector<int>& map)
+{
+	if (*pIndex >= 0)
+		*pIndex = map[*pIndex];
+}
+
+// Turn used flags into new indices, -1 for dropped entries
+template <typename T>
+static void Compact(std::vector<T>* pItems, std::vector<int>* pMap)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < pItems->size(); ++i)
+	{
+		if ((*pMap)[i] == 0)
+		{
+			(*pMap)[i] = -1;
+			continue;
+		}
+
+		(*pMap)[i] = count;
+		(*pItems)[count++] = (*pItems)[i];
+	}
+
+	pItems->resize(count);
+}
+
+// Drop the accessors and bufferViews nothing refers to any more, the ones
+// rebuilt primitives replaced and encoded images
+static void PruneModel(tinygltf::Model* pModel)
+{
+	std::vector<int> accessors(pModel->accessors.size(), 0);
+
+	for (size_t i = 0; i < pModel->meshes.size(); ++i)
+	{
+		for (size_t j = 0; j < pModel->meshes[i].primitives.size(); ++j)
+		{
+			const tinygltf::Primitive* primitive = &pModel->meshes[i].primitives[j];
+
+			for (std::map<std::string, int>::const_iterator it = primitive->attributes.begin(); it != primitive->attributes.end(); ++it)
+			{
+				Mark(&accessors, it->second);
+			}
+
+			for (size_t k = 0; k < primitive->targets.size(); ++k)
+			{
+				for (std::map<std::string, int>::const_iterator it = primitive->targets[k].begin(); it != primitive->targets[k].end(); ++it)
+				{
+					Mark(&accessors, it->second);
+				}
+			}
+
+			Mark(&accessors, primitive->indices);
+		}
+	}
+
+	for (size_t i = 0; i < pModel->skins.size(); ++i)
+	{
+		Mark(&accessors, pModel->skins[i].inverseBindMatrices);
+	}
+
+	for (size_t i = 0; i < pModel->animations.size(); ++i)
+	{
+		for (size_t j = 0; j < pModel->animations[i].samplers.size(); ++j)
+		{
+			Mark(&accessors, pModel->animations[i].samplers[j].input);
+			Mark(&accessors, pModel->animations[i].samplers[j].output);
+		}
+	}
+
+	Compact(&pModel->accessors, &accessors);
+
+	for (size_t i = 0; i < pModel->meshes.size(); ++i)
+	{
+		for (size_t j = 0; j < pModel->meshes[i].primitives.size(); ++j)
+		{
+			tinygltf::Primitive* primitive = &pModel->meshes[i].primitives[j];
+
+			for (std::map<std::string, int>::iterator it = primitive->attributes.begin(); it != primitive->attributes.end(); ++it)
+			{
+				Remap(&it->second, accessors);
+			}
+
+			for (size_t k = 0; k < primitive->targets.size(); ++k)
+			{
+				for (std::map<std::string, int>::iterator it = primitive->targets[k].begin(); it != primitive->targets[k].end(); ++it)
+				{
+					Remap(&it->second, accessors);
+				}
+			}
+
+			Remap(&primitive->indices, accessors);
+		}
+	}
+
+	for (size_t i = 0; i < pModel->skins.size(); ++i)
+	{
+		Remap(&pModel->skins[i].inverseBindMatrices, accessors);
+	}
+
+	for (size_t i = 0; i < pModel->animations.size(); ++i)
+	{
+		for (size_t j = 0; j < pModel->animations[i].samplers.size(); ++j)
+		{
+			Remap(&pModel->animations[i].samplers[j].input, accessors);
+			Remap(&pModel->animations[i].samplers[j].output, accessors);
+		}
+	}
+
+	std::vector<int> views(pModel->bufferViews.size(), 0);
+	for (size_t i = 0; i < pModel->accessors.size(); ++i)
+	{
+		Mark(&views, pModel->accessors[i].bufferView);
+	}
+
+	Compact(&pModel->bufferViews, &views);
+
+	for (size_t i = 0; i < pModel->accessors.size(); ++i)
+	{
+		Remap(&pModel->accessors[i].bufferView, views);
+	}
+
+	// decoded levels are baked in their place
+	for (size_t i = 0; i < pModel->images.size(); ++i)
+	{
+		pModel->images[i].bufferView = -1;
+	}
+}
+
+// tinygltf image callback, decodes to RGBA8 as GltfScene does
+static bool DecodeImage(tinygltf::Image* image, const int imageIndex,
+			std::string* err, std::string* warn,
+			int reqWidth, int reqHeight,
+			const unsigned char* bytes, int size, void* pUser)
+{
+	int width, height, components;
+	unsigned char* pPixels = stbi_load_from_memory(bytes, size, &width, &height, &components, 4);
+
+	if (pPixels == nullptr)
+	{
+		if (err != nullptr)
+			*err += "Could not decode image " + std::to_string(imageIndex) + ": " + stbi_failure_reason() + "\n";
+		return false;
+	}
+
+	image->width = width;
+	image->height = height;
+	image->component = 4;
+	image->image.assign(pPixels, pPixels + 4 * static_cast<size_t>(width) * height);
+	stbi_image_free(pPixels);
+
+	return true;
+}
+
+// Level 0 is the decoded image, the rest are built into pLevels
+static void BuildImage(const tinygltf::Model& model, size_t index, std::vector<std::vector<unsigned char> >* pLevels, BakeImage* pImage)
+{
+	const tinygltf::Image* image = &model.images[index];
+
+	pImage->width = image->width;
+	pImage->height = image->height;
+	pImage->mipmapped = ImageMipmapped(model, index);
+	pImage->levels.assign(1, image->image.data());
+
+	if (pImage->mipmapped == false)
+		return;
+
+	uint32_t levels = MipLevelCount(pImage->width, pImage->height);
+	uint32_t width = pImage->width;
+	uint32_t height = pImage->height;
+
+	pLevels->resize(levels - 1);
+	for (uint32_t level = 1; level < levels; ++level)
+	{
+		uint32_t nextWidth = MipSize(width);
+		uint32_t nextHeight = MipSize(height);
+		std::vector<unsigned char>* data = &(*pLevels)[level - 1];
+
+		data->resize(4 * static_cast<size_t>(nextWidth) * nextHeight);
+		DownsampleRGBA8(pImage->levels.back(), width, height, data->data(), 0, nextHeight);
+		pImage->levels.push_back(data->data());
+
+		width = nextWidth;
+		height = nextHeight;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s <model.gltf|model.glb> <model.bake>\n", argv[0]);
+		return 1;
+	}
+
+	const char* pSource = argv[1];
+	const char* pOutput = argv[2];
+
+	MappedFile file;
+	if (file.Open(pSource) != GLResult::Success)
+		return 1;
+
+	tinygltf::TinyGLTF loader;
+	tinygltf::Model model;
+	std::string err;
+	std::string warn;
+
+	loader.SetImageLoader(DecodeImage, nullptr);
+
+	std::string baseDir = pSource;
+	size_t slash = baseDir.find_last_of('/');
+	baseDir = (slash == std::string::npos) ? "" : baseDir.substr(0, slash);
+
+	bool ret;
+	if (file.Size() >= 4 && memcmp(file.Data(), "glTF", 4) == 0)
+	{
+		ret = loader.LoadBinaryFromMemory(&model, &err, &warn,
+						  file.Data(), file.Size(),
+						  baseDir);
+	}
+	else
+	{
+		ret = loader.LoadASCIIFromString(&model, &err, &warn,
+						 reinterpret_cast<const char*>(file.Data()),
+						 file.Size(),
+						 baseDir);
+	}
+
+	if (warn.empty() == false)
+		fprintf(stderr, "[WARN] GLTF loading file %s: %s\n", pSource, warn.c_str());
+
+	if (ret == false)
+	{
+		fprintf(stderr, "[ERROR] Could not load GLTF from file %s: %s\n", pSource, err.c_str());
+		return 1;
+	}
+
+	// rebuilt primitives go to a buffer of their own
+	int buffer = model.buffers.size();
+	model.buffers.push_back(tinygltf::Buffer());
+
+	BakeStats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	for (size_t i = 0; i < model.meshes.size(); ++i)
+	{
+		for (size_t j = 0; j < model.meshes[i].primitives.size(); ++j)
+		{
+			if (BakePrimitive(&model, buffer, &model.meshes[i].primitives[j], &stats) != GLResult::Success)
+			{
+				fprintf(stderr, "[ERROR] Could not bake primitive %zu of mesh %zu\n", j, i);
+				return 1;
+			}
+		}
+	}
+
+	PruneModel(&model);
+
+	std::vector<const unsigned char*> bufferData(model.buffers.size());
+	for (size_t i = 0; i < model.buffers.size(); ++i)
+	{
+		bufferData[i] = model.buffers[i].data.data();
+	}
+
+	std::vector<GLenum> viewTargets;
+	InferViewTargets(model, &viewTargets);
+
+	std::vector<std::vector<std::vector<unsigned char> > > levels(model.images.size());
+	std::vector<BakeImage> images(model.images.size());
+	for (size_t i = 0; i < model.images.size(); ++i)
+	{
+		BuildImage(model, i, &levels[i], &images[i]);
+	}
+
+	if (WriteBake(pOutput, HashBytes(file.Data(), file.Size()), model, bufferData, viewTargets, images) != GLResult::Success)
+		return 1;
+
+	printf("%s: %zu primitives, %zu -> %zu vertices, vertex data %zu -> %zu bytes, index data %zu -> %zu bytes, %zu images\n",
+	       pOutput, stats.primitives,
+	       stats.verticesIn, stats.verticesOut,
+	       stats.vertexBytesIn, stats.vertexBytesOut,
+	       stats.indexBytesIn, stats.indexBytesOut,
+	       images.size());
+
+	return 0;
+}
@@ -0,0 +1,90 @@
+// Nodes per second through the batched animation kernels at each SIMD
+// level the CPU supports. Each node interpolates a cubic translation and
+// a linear rotation, then composes its local matrix, the per-node work
+// GltfScene does for an animated rig.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include "AnimKernels.h"
+
+#define BENCH_NODES 4096
+#define BENCH_SECONDS 0.5
+
+static float Random()
+{
+	return rand() / static_cast<float>(RAND_MAX) * 2.0f - 1.0f;
+}
+
+static glm::vec4 RandomVec()
+{
+	return glm::vec4(Random(), Random(), Random(), 0.0f);
+}
+
+static glm::quat RandomQuat()
+{
+	return glm::normalize(glm::quat(Random(), Random(), Random(), Random()));
+}
+
+int main(int argc, char *argv[])
+{
+	size_t count = (argc > 1) ? strtoul(argv[1], nullptr, 10) : BENCH_NODES;
+
+	std::vector<float> u(count), dt(count);
+	std::vector<glm::vec4> weights(count), p0(count), m0(count), p1(count), m1(count), position(count);
+	std::vector<glm::quat> q0(count), q1(count), rotation(count);
+	std::vector<glm::vec3> translation(count), scale(count, glm::vec3(1.0f));
+	std::vector<glm::mat4> local(count);
+
+	srand(1);
+	for (size_t i = 0; i < count; ++i)
+	{
+		u[i] = (Random() + 1.0f) * 0.5f;
+		dt[i] = 1.0f / 30.0f;
+		p0[i] = RandomVec();
+		m0[i] = RandomVec();
+		p1[i] = RandomVec();
+		m1[i] = RandomVec();
+		q0[i] = RandomQuat();
+		q1[i] = RandomQuat();
+	}
+
+	double scalarRate = 0.0;
+	SimdLevel detected = DetectSimdLevel();
+
+	printf("%zu nodes per batch\n", count);
+
+	for (int level = 0; level <= static_cast<int>(detected); ++level)
+	{
+		SetSimdLevel(static_cast<SimdLevel>(level));
+
+		size_t batches = 0;
+		std::chrono::duration<double> elapsed(0.0);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		while (elapsed.count() < BENCH_SECONDS)
+		{
+			HermiteWeightsBatch(count, u.data(), dt.data(), weights.data());
+			BlendBatch(count, weights.data(), p0.data(), m0.data(), p1.data(), m1.data(), position.data());
+			QuatBlendBatch(count, q0.data(), q1.data(), u.data(), rotation.data());
+			for (size_t i = 0; i < count; ++i)
+				translation[i] = glm::vec3(position[i].x, position[i].y, position[i].z);
+			ComposeTRSBatch(count, translation.data(), rotation.data(), scale.data(), local.data());
+
+			batches++;
+			elapsed = std::chrono::steady_clock::now() - start;
+		}
+
+		double rate = batches * count / elapsed.count();
+		if (level == 0)
+			scalarRate = rate;
+
+		printf("%-8s %8.2f Mnodes/s  %5.2fx  (check %f)\n",
+		       SimdLevelName(static_cast<SimdLevel>(level)),
+		       rate / 1e6, rate / scalarRate, local[count / 2][3][0]);
+	}
+
+	return 0;
+}
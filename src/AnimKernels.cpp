@@ -0,0 +1,666 @@
+#include "AnimKernels.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ANIM_KERNELS_X86
+#include <immintrin.h>
+// compiled for these targets regardless of the build flags, only called
+// once the CPU is known to support them
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "vec3 arrays are read as packed floats");
+static_assert(sizeof(glm::vec4) == 4 * sizeof(float), "vec4 arrays are read as packed floats");
+static_assert(sizeof(glm::quat) == 4 * sizeof(float), "quat arrays are read as packed floats");
+static_assert(sizeof(glm::mat4) == 16 * sizeof(float), "mat4 arrays are written as packed floats");
+
+// Coefficients of the slerp time correction for nlerp
+#define ONLERP_A0 1.0904f
+#define ONLERP_A1 -3.2452f
+#define ONLERP_A2 3.55645f
+#define ONLERP_A3 -1.43519f
+#define ONLERP_B0 0.848013f
+#define ONLERP_B1 -1.06021f
+#define ONLERP_B2 0.215638f
+
+static SimdLevel& CurrentLevel()
+{
+	static SimdLevel level = DetectSimdLevel();
+	return level;
+}
+
+SimdLevel DetectSimdLevel()
+{
+#ifdef ANIM_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+		return SimdLevel::AVX;
+	if (__builtin_cpu_supports("sse2"))
+		return SimdLevel::SSE;
+#endif
+	return SimdLevel::Scalar;
+}
+
+SimdLevel GetSimdLevel()
+{
+	return CurrentLevel();
+}
+
+void SetSimdLevel(SimdLevel level)
+{
+	SimdLevel detected = DetectSimdLevel();
+	CurrentLevel() = (static_cast<int>(level) > static_cast<int>(detected)) ? detected : level;
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+	switch (level) {
+	case SimdLevel::AVX:
+		return "avx";
+	case SimdLevel::SSE:
+		return "sse";
+	default:
+		return "scalar";
+	}
+}
+
+// Scalar versions, also finish the tail the wide versions leave
+
+static void HermiteWeightsScalar(size_t begin, size_t count, const float* u, const float* dt, float* w)
+{
+	for (size_t i = begin; i < count; ++i)
+	{
+		float u1 = u[i];
+		float u2 = u1 * u1;
+		float u3 = u2 * u1;
+
+		w[4 * i + 0] = 2.0f * u3 - 3.0f * u2 + 1.0f;
+		w[4 * i + 1] = (u3 - 2.0f * u2 + u1) * dt[i];
+		w[4 * i + 2] = 3.0f * u2 - 2.0f * u3;
+		w[4 * i + 3] = (u3 - u2) * dt[i];
+	}
+}
+
+static void BlendScalar(size_t begin, size_t count,
+			const float* w, const float* a, const float* b,
+			const float* c, const float* d, float* out)
+{
+	for (size_t i = begin; i < count; ++i)
+	{
+		const float* wi = w + 4 * i;
+
+		for (size_t j = 4 * i; j < 4 * i + 4; ++j)
+			out[j] = wi[0] * a[j] + wi[1] * b[j] + wi[2] * c[j] + wi[3] * d[j];
+	}
+}
+
+static void QuatBlendScalar(size_t begin, size_t count,
+			    const float* q0, const float* q1, const float* u, float* out)
+{
+	for (size_t i = begin; i < count; ++i)
+	{
+		const float* a = q0 + 4 * i;
+		const float* b = q1 + 4 * i;
+		float* r = out + 4 * i;
+
+		float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+		float sign = (dot < 0.0f) ? -1.0f : 1.0f;
+		float d = fabsf(dot);
+		float t = u[i];
+
+		float A = ONLERP_A0 + d * (ONLERP_A1 + d * (ONLERP_A2 + d * ONLERP_A3));
+		float B = ONLERP_B0 + d * (ONLERP_B1 + d * ONLERP_B2);
+		float th = t - 0.5f;
+		float k = A * th * th + B;
+		float ot = t + t * th * (t - 1.0f) * k;
+
+		float len = 0.0f;
+		for (int c = 0; c < 4; ++c)
+		{
+			r[c] = a[c] * (1.0f - ot) + b[c] * sign * ot;
+			len += r[c] * r[c];
+		}
+
+		float inv = 1.0f / sqrtf(len);
+		for (int c = 0; c < 4; ++c)
+			r[c] *= inv;
+	}
+}
+
+static void ComposeTRSScalar(size_t begin, size_t count,
+			     const float* t, const float* q, const float* s, float* out)
+{
+	for (size_t i = begin; i < count; ++i)
+	{
+		const float* ti = t + 3 * i;
+		const float* qi = q + 4 * i;
+		const float* si = s + 3 * i;
+		float* m = out + 16 * i;
+
+		float x = qi[0], y = qi[1], z = qi[2], w = qi[3];
+		float xx = x * x, yy = y * y, zz = z * z;
+		float xy = x * y, xz = x * z, yz = y * z;
+		float wx = w * x, wy = w * y, wz = w * z;
+
+		m[0] = (1.0f - 2.0f * (yy + zz)) * si[0];
+		m[1] = 2.0f * (xy + wz) * si[0];
+		m[2] = 2.0f * (xz - wy) * si[0];
+		m[3] = 0.0f;
+
+		m[4] = 2.0f * (xy - wz) * si[1];
+		m[5] = (1.0f - 2.0f * (xx + zz)) * si[1];
+		m[6] = 2.0f * (yz + wx) * si[1];
+		m[7] = 0.0f;
+
+		m[8] = 2.0f * (xz + wy) * si[2];
+		m[9] = 2.0f * (yz - wx) * si[2];
+		m[10] = (1.0f - 2.0f * (xx + yy)) * si[2];
+		m[11] = 0.0f;
+
+		m[12] = ti[0];
+		m[13] = ti[1];
+		m[14] = ti[2];
+		m[15] = 1.0f;
+	}
+}
+
+#ifdef ANIM_KERNELS_X86
+
+// 4 wide, lane k of every register belongs to element i + k
+
+TARGET_SSE static inline __m128 Gather4(const float* p, size_t stride)
+{
+	return _mm_set_ps(p[3 * stride], p[2 * stride], p[stride], p[0]);
+}
+
+TARGET_SSE static void HermiteWeightsSSE(size_t count, const float* u, const float* dt, float* w)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 three = _mm_set1_ps(3.0f);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 u1 = _mm_loadu_ps(u + i);
+		__m128 d = _mm_loadu_ps(dt + i);
+		__m128 u2 = _mm_mul_ps(u1, u1);
+		__m128 u3 = _mm_mul_ps(u2, u1);
+
+		__m128 h00 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(two, u3), _mm_mul_ps(three, u2)), one);
+		__m128 h10 = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(u3, _mm_mul_ps(two, u2)), u1), d);
+		__m128 h01 = _mm_sub_ps(_mm_mul_ps(three, u2), _mm_mul_ps(two, u3));
+		__m128 h11 = _mm_mul_ps(_mm_sub_ps(u3, u2), d);
+
+		_MM_TRANSPOSE4_PS(h00, h10, h01, h11);
+		_mm_storeu_ps(w + 4 * i + 0, h00);
+		_mm_storeu_ps(w + 4 * i + 4, h10);
+		_mm_storeu_ps(w + 4 * i + 8, h01);
+		_mm_storeu_ps(w + 4 * i + 12, h11);
+	}
+
+	HermiteWeightsScalar(i, count, u, dt, w);
+}
+
+TARGET_SSE static void BlendSSE(size_t count,
+				const float* w, const float* a, const float* b,
+				const float* c, const float* d, float* out)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t j = 4 * i;
+		__m128 wi = _mm_loadu_ps(w + j);
+
+		__m128 r = _mm_mul_ps(_mm_shuffle_ps(wi, wi, 0x00), _mm_loadu_ps(a + j));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(wi, wi, 0x55), _mm_loadu_ps(b + j)));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(wi, wi, 0xAA), _mm_loadu_ps(c + j)));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(wi, wi, 0xFF), _mm_loadu_ps(d + j)));
+		_mm_storeu_ps(out + j, r);
+	}
+}
+
+TARGET_SSE static void QuatBlendSSE(size_t count,
+				    const float* q0, const float* q1, const float* u, float* out)
+{
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 ax = _mm_loadu_ps(q0 + 4 * i + 0);
+		__m128 ay = _mm_loadu_ps(q0 + 4 * i + 4);
+		__m128 az = _mm_loadu_ps(q0 + 4 * i + 8);
+		__m128 aw = _mm_loadu_ps(q0 + 4 * i + 12);
+		_MM_TRANSPOSE4_PS(ax, ay, az, aw);
+
+		__m128 bx = _mm_loadu_ps(q1 + 4 * i + 0);
+		__m128 by = _mm_loadu_ps(q1 + 4 * i + 4);
+		__m128 bz = _mm_loadu_ps(q1 + 4 * i + 8);
+		__m128 bw = _mm_loadu_ps(q1 + 4 * i + 12);
+		_MM_TRANSPOSE4_PS(bx, by, bz, bw);
+
+		__m128 t = _mm_loadu_ps(u + i);
+
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+					_mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+
+		// take the short way round by flipping q1 where the dot is negative
+		__m128 sign = _mm_and_ps(dot, signBit);
+		bx = _mm_xor_ps(bx, sign);
+		by = _mm_xor_ps(by, sign);
+		bz = _mm_xor_ps(bz, sign);
+		bw = _mm_xor_ps(bw, sign);
+		__m128 d = _mm_andnot_ps(signBit, dot);
+
+		__m128 A = _mm_add_ps(_mm_set1_ps(ONLERP_A2), _mm_mul_ps(d, _mm_set1_ps(ONLERP_A3)));
+		A = _mm_add_ps(_mm_set1_ps(ONLERP_A1), _mm_mul_ps(d, A));
+		A = _mm_add_ps(_mm_set1_ps(ONLERP_A0), _mm_mul_ps(d, A));
+		__m128 B = _mm_add_ps(_mm_set1_ps(ONLERP_B1), _mm_mul_ps(d, _mm_set1_ps(ONLERP_B2)));
+		B = _mm_add_ps(_mm_set1_ps(ONLERP_B0), _mm_mul_ps(d, B));
+
+		__m128 th = _mm_sub_ps(t, half);
+		__m128 k = _mm_add_ps(_mm_mul_ps(A, _mm_mul_ps(th, th)), B);
+		__m128 ot = _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(t, th), _mm_mul_ps(_mm_sub_ps(t, one), k)));
+		__m128 ot0 = _mm_sub_ps(one, ot);
+
+		__m128 rx = _mm_add_ps(_mm_mul_ps(ax, ot0), _mm_mul_ps(bx, ot));
+		__m128 ry = _mm_add_ps(_mm_mul_ps(ay, ot0), _mm_mul_ps(by, ot));
+		__m128 rz = _mm_add_ps(_mm_mul_ps(az, ot0), _mm_mul_ps(bz, ot));
+		__m128 rw = _mm_add_ps(_mm_mul_ps(aw, ot0), _mm_mul_ps(bw, ot));
+
+		__m128 len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)),
+					_mm_add_ps(_mm_mul_ps(rz, rz), _mm_mul_ps(rw, rw)));
+		__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(len));
+		rx = _mm_mul_ps(rx, inv);
+		ry = _mm_mul_ps(ry, inv);
+		rz = _mm_mul_ps(rz, inv);
+		rw = _mm_mul_ps(rw, inv);
+
+		_MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+		_mm_storeu_ps(out + 4 * i + 0, rx);
+		_mm_storeu_ps(out + 4 * i + 4, ry);
+		_mm_storeu_ps(out + 4 * i + 8, rz);
+		_mm_storeu_ps(out + 4 * i + 12, rw);
+	}
+
+	QuatBlendScalar(i, count, q0, q1, u, out);
+}
+
+TARGET_SSE static void ComposeTRSSSE(size_t count,
+				     const float* t, const float* q, const float* s, float* out)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(q + 4 * i + 0);
+		__m128 y = _mm_loadu_ps(q + 4 * i + 4);
+		__m128 z = _mm_loadu_ps(q + 4 * i + 8);
+		__m128 w = _mm_loadu_ps(q + 4 * i + 12);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		__m128 sx = Gather4(s + 3 * i + 0, 3);
+		__m128 sy = Gather4(s + 3 * i + 1, 3);
+		__m128 sz = Gather4(s + 3 * i + 2, 3);
+
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		__m128 c0x = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		__m128 c0y = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+		__m128 c0z = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+		__m128 c0w = zero;
+
+		__m128 c1x = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+		__m128 c1y = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		__m128 c1z = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+		__m128 c1w = zero;
+
+		__m128 c2x = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+		__m128 c2y = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+		__m128 c2z = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+		__m128 c2w = zero;
+
+		__m128 c3x = Gather4(t + 3 * i + 0, 3);
+		__m128 c3y = Gather4(t + 3 * i + 1, 3);
+		__m128 c3z = Gather4(t + 3 * i + 2, 3);
+		__m128 c3w = one;
+
+		// back to one column of one matrix per register
+		_MM_TRANSPOSE4_PS(c0x, c0y, c0z, c0w);
+		_MM_TRANSPOSE4_PS(c1x, c1y, c1z, c1w);
+		_MM_TRANSPOSE4_PS(c2x, c2y, c2z, c2w);
+		_MM_TRANSPOSE4_PS(c3x, c3y, c3z, c3w);
+
+		float* m = out + 16 * i;
+		__m128 columns[16] = {
+			c0x, c1x, c2x, c3x,
+			c0y, c1y, c2y, c3y,
+			c0z, c1z, c2z, c3z,
+			c0w, c1w, c2w, c3w,
+		};
+		for (int j = 0; j < 16; ++j)
+			_mm_storeu_ps(m + 4 * j, columns[j]);
+	}
+
+	ComposeTRSScalar(i, count, t, q, s, out);
+}
+
+// 8 wide, the low half of each register holds elements i..i+3 and the high
+// half i+4..i+7, so 4x4 transposes stay within 128 bit lanes
+
+TARGET_AVX static inline __m256 Load2(const float* lo, const float* hi)
+{
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+}
+
+TARGET_AVX static inline void Store2(float* lo, float* hi, __m256 v)
+{
+	_mm_storeu_ps(lo, _mm256_castps256_ps128(v));
+	_mm_storeu_ps(hi, _mm256_extractf128_ps(v, 1));
+}
+
+TARGET_AVX static inline __m256 Gather8(const float* p, size_t stride)
+{
+	return _mm256_set_ps(p[7 * stride], p[6 * stride], p[5 * stride], p[4 * stride],
+			     p[3 * stride], p[2 * stride], p[stride], p[0]);
+}
+
+TARGET_AVX static inline void Transpose(__m256& r0, __m256& r1, __m256& r2, __m256& r3)
+{
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+	__m256 t1 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t2 = _mm256_unpackhi_ps(r0, r1);
+	__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+	r0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+	r1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+	r2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	r3 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+// Four vec4s at p + 4 * (i + k) for k 0..3 and 4..7, transposed to lanes
+TARGET_AVX static inline void LoadLanes(const float* p, __m256& x, __m256& y, __m256& z, __m256& w)
+{
+	x = Load2(p + 0, p + 16);
+	y = Load2(p + 4, p + 20);
+	z = Load2(p + 8, p + 24);
+	w = Load2(p + 12, p + 28);
+	Transpose(x, y, z, w);
+}
+
+TARGET_AVX static inline void StoreLanes(float* p, __m256 x, __m256 y, __m256 z, __m256 w)
+{
+	Transpose(x, y, z, w);
+	Store2(p + 0, p + 16, x);
+	Store2(p + 4, p + 20, y);
+	Store2(p + 8, p + 24, z);
+	Store2(p + 12, p + 28, w);
+}
+
+TARGET_AVX static void HermiteWeightsAVX(size_t count, const float* u, const float* dt, float* w)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 three = _mm256_set1_ps(3.0f);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 u1 = _mm256_loadu_ps(u + i);
+		__m256 d = _mm256_loadu_ps(dt + i);
+		__m256 u2 = _mm256_mul_ps(u1, u1);
+		__m256 u3 = _mm256_mul_ps(u2, u1);
+
+		__m256 h00 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(two, u3), _mm256_mul_ps(three, u2)), one);
+		__m256 h10 = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(u3, _mm256_mul_ps(two, u2)), u1), d);
+		__m256 h01 = _mm256_sub_ps(_mm256_mul_ps(three, u2), _mm256_mul_ps(two, u3));
+		__m256 h11 = _mm256_mul_ps(_mm256_sub_ps(u3, u2), d);
+
+		StoreLanes(w + 4 * i, h00, h10, h01, h11);
+	}
+
+	HermiteWeightsSSE(count - i, u + i, dt + i, w + 4 * i);
+}
+
+TARGET_AVX static void BlendAVX(size_t count,
+				const float* w, const float* a, const float* b,
+				const float* c, const float* d, float* out)
+{
+	size_t i = 0;
+
+	// two elements per register, weights broadcast within each half
+	for (; i + 2 <= count; i += 2)
+	{
+		size_t j = 4 * i;
+		__m256 wi = _mm256_loadu_ps(w + j);
+
+		__m256 r = _mm256_mul_ps(_mm256_permute_ps(wi, 0x00), _mm256_loadu_ps(a + j));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(wi, 0x55), _mm256_loadu_ps(b + j)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(wi, 0xAA), _mm256_loadu_ps(c + j)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(wi, 0xFF), _mm256_loadu_ps(d + j)));
+		_mm256_storeu_ps(out + j, r);
+	}
+
+	BlendScalar(i, count, w, a, b, c, d, out);
+}
+
+TARGET_AVX static void QuatBlendAVX(size_t count,
+				    const float* q0, const float* q1, const float* u, float* out)
+{
+	const __m256 signBit = _mm256_set1_ps(-0.0f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 ax, ay, az, aw;
+		__m256 bx, by, bz, bw;
+		LoadLanes(q0 + 4 * i, ax, ay, az, aw);
+		LoadLanes(q1 + 4 * i, bx, by, bz, bw);
+
+		// lanes are i, i+1, i+2, i+3, i+4.. to match the quaternion lanes
+		__m256 t = _mm256_loadu_ps(u + i);
+
+		__m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)),
+					   _mm256_add_ps(_mm256_mul_ps(az, bz), _mm256_mul_ps(aw, bw)));
+
+		__m256 sign = _mm256_and_ps(dot, signBit);
+		bx = _mm256_xor_ps(bx, sign);
+		by = _mm256_xor_ps(by, sign);
+		bz = _mm256_xor_ps(bz, sign);
+		bw = _mm256_xor_ps(bw, sign);
+		__m256 d = _mm256_andnot_ps(signBit, dot);
+
+		__m256 A = _mm256_add_ps(_mm256_set1_ps(ONLERP_A2), _mm256_mul_ps(d, _mm256_set1_ps(ONLERP_A3)));
+		A = _mm256_add_ps(_mm256_set1_ps(ONLERP_A1), _mm256_mul_ps(d, A));
+		A = _mm256_add_ps(_mm256_set1_ps(ONLERP_A0), _mm256_mul_ps(d, A));
+		__m256 B = _mm256_add_ps(_mm256_set1_ps(ONLERP_B1), _mm256_mul_ps(d, _mm256_set1_ps(ONLERP_B2)));
+		B = _mm256_add_ps(_mm256_set1_ps(ONLERP_B0), _mm256_mul_ps(d, B));
+
+		__m256 th = _mm256_sub_ps(t, half);
+		__m256 k = _mm256_add_ps(_mm256_mul_ps(A, _mm256_mul_ps(th, th)), B);
+		__m256 ot = _mm256_add_ps(t, _mm256_mul_ps(_mm256_mul_ps(t, th), _mm256_mul_ps(_mm256_sub_ps(t, one), k)));
+		__m256 ot0 = _mm256_sub_ps(one, ot);
+
+		__m256 rx = _mm256_add_ps(_mm256_mul_ps(ax, ot0), _mm256_mul_ps(bx, ot));
+		__m256 ry = _mm256_add_ps(_mm256_mul_ps(ay, ot0), _mm256_mul_ps(by, ot));
+		__m256 rz = _mm256_add_ps(_mm256_mul_ps(az, ot0), _mm256_mul_ps(bz, ot));
+		__m256 rw = _mm256_add_ps(_mm256_mul_ps(aw, ot0), _mm256_mul_ps(bw, ot));
+
+		__m256 len = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rx, rx), _mm256_mul_ps(ry, ry)),
+					   _mm256_add_ps(_mm256_mul_ps(rz, rz), _mm256_mul_ps(rw, rw)));
+		__m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(len));
+
+		StoreLanes(out + 4 * i,
+			   _mm256_mul_ps(rx, inv),
+			   _mm256_mul_ps(ry, inv),
+			   _mm256_mul_ps(rz, inv),
+			   _mm256_mul_ps(rw, inv));
+	}
+
+	QuatBlendSSE(count - i, q0 + 4 * i, q1 + 4 * i, u + i, out + 4 * i);
+}
+
+TARGET_AVX static void ComposeTRSAVX(size_t count,
+				     const float* t, const float* q, const float* s, float* out)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 x, y, z, w;
+		LoadLanes(q + 4 * i, x, y, z, w);
+
+		__m256 sx = Gather8(s + 3 * i + 0, 3);
+		__m256 sy = Gather8(s + 3 * i + 1, 3);
+		__m256 sz = Gather8(s + 3 * i + 2, 3);
+
+		__m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+		__m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+		__m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+		__m256 c0x = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), sx);
+		__m256 c0y = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx);
+		__m256 c0z = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx);
+
+		__m256 c1x = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy);
+		__m256 c1y = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), sy);
+		__m256 c1z = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy);
+
+		__m256 c2x = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz);
+		__m256 c2y = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz);
+		__m256 c2z = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))), sz);
+
+		__m256 c3x = Gather8(t + 3 * i + 0, 3);
+		__m256 c3y = Gather8(t + 3 * i + 1, 3);
+		__m256 c3z = Gather8(t + 3 * i + 2, 3);
+
+		// matrices are 16 floats apart, columns 4 apart
+		__m256 columns[4][4] = {
+			{ c0x, c0y, c0z, zero },
+			{ c1x, c1y, c1z, zero },
+			{ c2x, c2y, c2z, zero },
+			{ c3x, c3y, c3z, one },
+		};
+
+		float* m = out + 16 * i;
+		for (int c = 0; c < 4; ++c)
+		{
+			__m256 r0 = columns[c][0], r1 = columns[c][1];
+			__m256 r2 = columns[c][2], r3 = columns[c][3];
+			Transpose(r0, r1, r2, r3);
+			Store2(m + 4 * c + 0 * 16, m + 4 * c + 4 * 16, r0);
+			Store2(m + 4 * c + 1 * 16, m + 4 * c + 5 * 16, r1);
+			Store2(m + 4 * c + 2 * 16, m + 4 * c + 6 * 16, r2);
+			Store2(m + 4 * c + 3 * 16, m + 4 * c + 7 * 16, r3);
+		}
+	}
+
+	ComposeTRSSSE(count - i, t + 3 * i, q + 4 * i, s + 3 * i, out + 16 * i);
+}
+
+#endif // ANIM_KERNELS_X86
+
+void HermiteWeightsBatch(size_t count, const float* u, const float* dt, glm::vec4* w)
+{
+	float* pW = reinterpret_cast<float*>(w);
+
+	switch (GetSimdLevel()) {
+#ifdef ANIM_KERNELS_X86
+	case SimdLevel::AVX:
+		HermiteWeightsAVX(count, u, dt, pW);
+		break;
+	case SimdLevel::SSE:
+		HermiteWeightsSSE(count, u, dt, pW);
+		break;
+#endif
+	default:
+		HermiteWeightsScalar(0, count, u, dt, pW);
+		break;
+	}
+}
+
+void BlendBatch(size_t count,
+		const glm::vec4* w,
+		const glm::vec4* a,
+		const glm::vec4* b,
+		const glm::vec4* c,
+		const glm::vec4* d,
+		glm::vec4* out)
+{
+	const float* pW = reinterpret_cast<const float*>(w);
+	const float* pA = reinterpret_cast<const float*>(a);
+	const float* pB = reinterpret_cast<const float*>(b);
+	const float* pC = reinterpret_cast<const float*>(c);
+	const float* pD = reinterpret_cast<const float*>(d);
+	float* pOut = reinterpret_cast<float*>(out);
+
+	switch (GetSimdLevel()) {
+#ifdef ANIM_KERNELS_X86
+	case SimdLevel::AVX:
+		BlendAVX(count, pW, pA, pB, pC, pD, pOut);
+		break;
+	case SimdLevel::SSE:
+		BlendSSE(count, pW, pA, pB, pC, pD, pOut);
+		break;
+#endif
+	default:
+		BlendScalar(0, count, pW, pA, pB, pC, pD, pOut);
+		break;
+	}
+}
+
+void QuatBlendBatch(size_t count, const glm::quat* q0, const glm::quat* q1, const float* u, glm::quat* out)
+{
+	const float* pQ0 = reinterpret_cast<const float*>(q0);
+	const float* pQ1 = reinterpret_cast<const float*>(q1);
+	float* pOut = reinterpret_cast<float*>(out);
+
+	switch (GetSimdLevel()) {
+#ifdef ANIM_KERNELS_X86
+	case SimdLevel::AVX:
+		QuatBlendAVX(count, pQ0, pQ1, u, pOut);
+		break;
+	case SimdLevel::SSE:
+		QuatBlendSSE(count, pQ0, pQ1, u, pOut);
+		break;
+#endif
+	default:
+		QuatBlendScalar(0, count, pQ0, pQ1, u, pOut);
+		break;
+	}
+}
+
+void ComposeTRSBatch(size_t count, const glm::vec3* t, const glm::quat* r, const glm::vec3* s, glm::mat4* out)
+{
+	const float* pT = reinterpret_cast<const float*>(t);
+	const float* pR = reinterpret_cast<const float*>(r);
+	const float* pS = reinterpret_cast<const float*>(s);
+	float* pOut = reinterpret_cast<float*>(out);
+
+	switch (GetSimdLevel()) {
+#ifdef ANIM_KERNELS_X86
+	case SimdLevel::AVX:
+		ComposeTRSAVX(count, pT, pR, pS, pOut);
+		break;
+	case SimdLevel::SSE:
+		ComposeTRSSSE(count, pT, pR, pS, pOut);
+		break;
+#endif
+	default:
+		ComposeTRSScalar(0, count, pT, pR, pS, pOut);
+		break;
+	}
+}
@@ -0,0 +1,334 @@
+#include "AnimationClip.h"
+#include "GltfScene.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+AnimationClip::AnimationClip()
+{
+	m_duration = 0.0f;
+}
+
+// Copy an accessor out as floats, normalized integers are converted the
+// way glTF allows them for rotation outputs
+static bool ReadFloats(const tinygltf::Model& model,
+		       const std::vector<const unsigned char*>& bufferData,
+		       int accessorId,
+		       std::vector<float>* pOut)
+{
+	if (accessorId < 0)
+		return false;
+
+	const tinygltf::Accessor* accessor = &model.accessors[accessorId];
+	if (accessor->bufferView < 0)
+		return false;
+
+	const tinygltf::BufferView* bufferView = &model.bufferViews[accessor->bufferView];
+	size_t components = tinygltf::GetTypeSizeInBytes(accessor->type);
+	size_t componentSize = tinygltf::GetComponentSizeInBytes(accessor->componentType);
+	size_t stride = bufferView->byteStride ? bufferView->byteStride : components * componentSize;
+	const unsigned char* pData = bufferData[bufferView->buffer]
+		+ bufferView->byteOffset + accessor->byteOffset;
+
+	pOut->resize(accessor->count * components);
+
+	for (size_t i = 0; i < accessor->count; ++i)
+	{
+		const unsigned char* pElement = pData + i * stride;
+
+		for (size_t c = 0; c < components; ++c)
+		{
+			float* pValue = &(*pOut)[i * components + c];
+
+			switch (accessor->componentType) {
+			case TINYGLTF_COMPONENT_TYPE_FLOAT:
+				memcpy(pValue, pElement + c * 4, 4);
+				break;
+			case TINYGLTF_COMPONENT_TYPE_BYTE:
+				*pValue = fmaxf(reinterpret_cast<const int8_t*>(pElement)[c] / 127.0f, -1.0f);
+				break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+				*pValue = pElement[c] / 255.0f;
+				break;
+			case TINYGLTF_COMPONENT_TYPE_SHORT:
+			{
+				int16_t value;
+				memcpy(&value, pElement + c * 2, 2);
+				*pValue = fmaxf(value / 32767.0f, -1.0f);
+				break;
+			}
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+			{
+				uint16_t value;
+				memcpy(&value, pElement + c * 2, 2);
+				*pValue = value / 65535.0f;
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+GLResult AnimationClip::Build(const tinygltf::Model& model,
+			      const tinygltf::Animation& animation,
+			      const std::vector<const unsigned char*>& bufferData,
+			      const std::vector<int32_t>& nodeIndex)
+{
+	m_name = animation.name;
+	m_samplers.resize(animation.samplers.size());
+
+	for (size_t i = 0; i < animation.samplers.size(); ++i)
+	{
+		const tinygltf::AnimationSampler* source = &animation.samplers[i];
+		AnimationSampler* sampler = &m_samplers[i];
+
+		sampler->interpolation = Interpolation::Linear;
+		if (source->interpolation == "STEP")
+			sampler->interpolation = Interpolation::Step;
+		else if (source->interpolation == "CUBICSPLINE")
+			sampler->interpolation = Interpolation::CubicSpline;
+
+		if (ReadFloats(model, bufferData, source->input, &sampler->times) == false ||
+		    ReadFloats(model, bufferData, source->output, &sampler->values) == false ||
+		    sampler->times.empty())
+		{
+			fprintf(stderr, "[ERROR] Animation %s sampler %zu has unreadable keyframes\n",
+				m_name.c_str(), i);
+			return GLResult::Failed;
+		}
+
+		sampler->components = tinygltf::GetTypeSizeInBytes(model.accessors[source->output].type);
+
+		size_t expected = sampler->times.size() * sampler->components;
+		if (sampler->interpolation == Interpolation::CubicSpline)
+			expected *= 3;
+
+		if (sampler->values.size() != expected)
+		{
+			fprintf(stderr, "[ERROR] Animation %s sampler %zu has %zu values, expected %zu\n",
+				m_name.c_str(), i, sampler->values.size(), expected);
+			return GLResult::Failed;
+		}
+
+		m_duration = fmaxf(m_duration, sampler->times.back());
+	}
+
+	for (size_t i = 0; i < animation.channels.size(); ++i)
+	{
+		const tinygltf::AnimationChannel* source = &animation.channels[i];
+		AnimationChannel channel;
+
+		if (source->target_path == "translation")
+			channel.path = AnimationPath::Translation;
+		else if (source->target_path == "rotation")
+			channel.path = AnimationPath::Rotation;
+		else if (source->target_path == "scale")
+			channel.path = AnimationPath::Scale;
+		else
+			continue;	// morph target weights aren't supported
+
+		if (source->target_node < 0 ||
+		    static_cast<size_t>(source->target_node) >= nodeIndex.size() ||
+		    nodeIndex[source->target_node] < 0 ||
+		    source->sampler < 0)
+			continue;
+
+		channel.sampler = source->sampler;
+		channel.node = nodeIndex[source->target_node];
+
+		uint32_t components = (channel.path == AnimationPath::Rotation) ? 4 : 3;
+		if (m_samplers[channel.sampler].components != components)
+			continue;
+
+		m_channels.push_back(channel);
+	}
+
+	return GLResult::Success;
+}
+
+// Index of the key at or before time. Steps forward from the cursor, only
+// searching when time moved backwards (looping) or jumped.
+uint32_t AnimationClip::FindKey(const AnimationSampler* sampler, float time, uint32_t* pCursor) const
+{
+	const std::vector<float>& times = sampler->times;
+	uint32_t last = times.size() - 1;
+	uint32_t key = *pCursor;
+
+	if (key > last || times[key] > time)
+	{
+		key = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+		key = (key > 0) ? key - 1 : 0;
+	}
+	else
+	{
+		// a step rarely crosses more than a key or two
+		for (uint32_t steps = 0; key < last && times[key + 1] <= time; ++steps)
+		{
+			if (steps == 4)
+			{
+				key = std::upper_bound(times.begin() + key, times.end(), time) - times.begin() - 1;
+				break;
+			}
+			key++;
+		}
+	}
+
+	*pCursor = key;
+	return key;
+}
+
+static glm::vec4 LoadVec(const float* p, uint32_t components)
+{
+	return (components == 4) ? glm::vec4(p[0], p[1], p[2], p[3])
+		: glm::vec4(p[0], p[1], p[2], 0.0f);
+}
+
+static void AddVector(AnimationScratch* pScratch, uint32_t channel, glm::vec4 weights,
+		      glm::vec4 a, glm::vec4 b, glm::vec4 c, glm::vec4 d)
+{
+	pScratch->vectorChannels.push_back(channel);
+	pScratch->weights.push_back(weights);
+	pScratch->a.push_back(a);
+	pScratch->b.push_back(b);
+	pScratch->c.push_back(c);
+	pScratch->d.push_back(d);
+}
+
+void AnimationClip::Evaluate(float time, uint32_t* pCursors, AnimationScratch* pScratch, GltfNodeList* pNodes) const
+{
+	AnimationScratch* s = pScratch;
+	const glm::vec4 zero = glm::vec4(0.0f);
+
+	s->vectorChannels.clear();
+	s->weights.clear();
+	s->a.clear();
+	s->b.clear();
+	s->c.clear();
+	s->d.clear();
+	s->cubicSlots.clear();
+	s->cubicU.clear();
+	s->cubicDt.clear();
+	s->quatChannels.clear();
+	s->q0.clear();
+	s->q1.clear();
+	s->quatU.clear();
+
+	// find every channel's span and gather its keys
+	for (uint32_t i = 0; i < m_channels.size(); ++i)
+	{
+		const AnimationSampler* sampler = &m_samplers[m_channels[i].sampler];
+		uint32_t n = sampler->components;
+		uint32_t key = FindKey(sampler, time, &pCursors[m_channels[i].sampler]);
+		uint32_t last = sampler->times.size() - 1;
+		bool clamped = (key == last || time <= sampler->times[key]);
+		const float* values = sampler->values.data();
+
+		float u = 0.0f;
+		float dt = 0.0f;
+		if (clamped == false)
+		{
+			dt = sampler->times[key + 1] - sampler->times[key];
+			u = (time - sampler->times[key]) / dt;
+		}
+
+		if (sampler->interpolation == Interpolation::CubicSpline)
+		{
+			// in tangent, value, out tangent
+			const float* k0 = values + key * 3 * n;
+
+			if (clamped)
+			{
+				AddVector(s, i, glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
+					  LoadVec(k0 + n, n), zero, zero, zero);
+				continue;
+			}
+
+			const float* k1 = k0 + 3 * n;
+			s->cubicSlots.push_back(s->weights.size());
+			s->cubicU.push_back(u);
+			s->cubicDt.push_back(dt);
+			AddVector(s, i, zero,
+				  LoadVec(k0 + n, n), LoadVec(k0 + 2 * n, n),
+				  LoadVec(k1 + n, n), LoadVec(k1, n));
+			continue;
+		}
+
+		const float* v0 = values + key * n;
+
+		if (sampler->interpolation == Interpolation::Step || clamped)
+		{
+			AddVector(s, i, glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
+				  LoadVec(v0, n), zero, zero, zero);
+		}
+		else if (n == 4)
+		{
+			const float* v1 = v0 + n;
+			s->quatChannels.push_back(i);
+			s->q0.push_back(glm::quat(v0[3], v0[0], v0[1], v0[2]));
+			s->q1.push_back(glm::quat(v1[3], v1[0], v1[1], v1[2]));
+			s->quatU.push_back(u);
+		}
+		else
+		{
+			AddVector(s, i, glm::vec4(1.0f - u, 0.0f, u, 0.0f),
+				  LoadVec(v0, n), zero, LoadVec(v0 + n, n), zero);
+		}
+	}
+
+	s->cubicWeights.resize(s->cubicU.size());
+	HermiteWeightsBatch(s->cubicU.size(), s->cubicU.data(), s->cubicDt.data(), s->cubicWeights.data());
+	for (size_t i = 0; i < s->cubicSlots.size(); ++i)
+		s->weights[s->cubicSlots[i]] = s->cubicWeights[i];
+
+	s->values.resize(s->vectorChannels.size());
+	BlendBatch(s->values.size(),
+		   s->weights.data(),
+		   s->a.data(), s->b.data(), s->c.data(), s->d.data(),
+		   s->values.data());
+
+	s->quats.resize(s->quatChannels.size());
+	QuatBlendBatch(s->quats.size(), s->q0.data(), s->q1.data(), s->quatU.data(), s->quats.data());
+
+	// scatter into the nodes
+	for (size_t i = 0; i < s->vectorChannels.size(); ++i)
+	{
+		const AnimationChannel* channel = &m_channels[s->vectorChannels[i]];
+		const glm::vec4& value = s->values[i];
+		int32_t node = channel->node;
+
+		if (pNodes->hasMatrix[node])
+			continue;
+
+		switch (channel->path) {
+		case AnimationPath::Translation:
+			pNodes->translation[node] = glm::vec3(value.x, value.y, value.z);
+			break;
+		case AnimationPath::Rotation:
+			// stored xyzw in glTF
+			pNodes->rotation[node] = glm::normalize(glm::quat(value.w, value.x,
+									  value.y, value.z));
+			break;
+		case AnimationPath::Scale:
+			pNodes->scale[node] = glm::vec3(value.x, value.y, value.z);
+			break;
+		}
+
+		pNodes->dirty[node] = true;
+	}
+
+	for (size_t i = 0; i < s->quatChannels.size(); ++i)
+	{
+		int32_t node = m_channels[s->quatChannels[i]].node;
+
+		if (pNodes->hasMatrix[node])
+			continue;
+
+		pNodes->rotation[node] = s->quats[i];
+		pNodes->dirty[node] = true;
+	}
+}
@@ -0,0 +1,96 @@
+#ifndef CUBE_ANIMATIONCLIP_H
+#define CUBE_ANIMATIONCLIP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <tiny_gltf.h>
+
+#include "glutils.h"
+#include "AnimKernels.h"
+
+struct GltfNodeList;
+
+enum class Interpolation {
+	Step = 0,
+	Linear,
+	CubicSpline,
+};
+
+enum class AnimationPath {
+	Translation = 0,
+	Rotation,
+	Scale,
+};
+
+// Keyframes of one sampler, copied out of the glTF buffers into flat
+// arrays. CUBICSPLINE stores in tangent, value, out tangent per key.
+struct AnimationSampler
+{
+	std::vector<float> times;
+	std::vector<float> values;
+	uint32_t components;
+	Interpolation interpolation;
+};
+
+struct AnimationChannel
+{
+	uint32_t sampler;
+	int32_t node;		// flattened node index
+	AnimationPath path;
+};
+
+// Staging for Evaluate, owned by the caller and reused so evaluation stops
+// allocating once it has warmed up. Channels are gathered into these
+// arrays and interpolated in batches.
+struct AnimationScratch
+{
+	// translation, scale, step and cubic channels: w.x*a + w.y*b + w.z*c + w.w*d
+	std::vector<uint32_t> vectorChannels;
+	std::vector<glm::vec4> weights;
+	std::vector<glm::vec4> a, b, c, d;
+	std::vector<glm::vec4> values;
+
+	// cubic spans, their weights land in weights[cubicSlots[i]]
+	std::vector<uint32_t> cubicSlots;
+	std::vector<float> cubicU;
+	std::vector<float> cubicDt;
+	std::vector<glm::vec4> cubicWeights;
+
+	// linearly interpolated rotations
+	std::vector<uint32_t> quatChannels;
+	std::vector<glm::quat> q0, q1;
+	std::vector<float> quatU;
+	std::vector<glm::quat> quats;
+};
+
+// A glTF animation, immutable once built so instances can share it. The
+// playback position of each sampler lives in a cursor array owned by the
+// caller, sequential playback then finds its keyframe in O(1).
+class AnimationClip
+{
+public:
+	AnimationClip();
+	GLResult Build(const tinygltf::Model& model,
+		       const tinygltf::Animation& animation,
+		       const std::vector<const unsigned char*>& bufferData,
+		       const std::vector<int32_t>& nodeIndex);
+
+	// Write every channel at time seconds into the node TRS arrays
+	void Evaluate(float time, uint32_t* pCursors, AnimationScratch* pScratch, GltfNodeList* pNodes) const;
+
+	const std::string& Name() const { return m_name; }
+	float Duration() const { return m_duration; }
+	size_t SamplerCount() const { return m_samplers.size(); }
+
+private:
+	uint32_t FindKey(const AnimationSampler* sampler, float time, uint32_t* pCursor) const;
+
+	std::string m_name;
+	std::vector<AnimationSampler> m_samplers;
+	std::vector<AnimationChannel> m_channels;
+	float m_duration;
+};
+
+#endif // CUBE_ANIMATIONCLIP_H
@@ -0,0 +1,326 @@
+#include "Benchmark.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+
+#include "AnimKernels.h"
+
+Benchmark::Benchmark(uint32_t frames)
+{
+	m_frames = (frames > 0) ? frames : BENCHMARK_FRAMES;
+	m_measuring = false;
+	m_renderCube = true;
+	m_frameStart = 0;
+	m_passStart = 0;
+	m_current = Sample();
+	m_samples.reserve(m_frames);
+
+	BuildPath();
+}
+
+// Orbit the display cube, move the cube camera and walk through both
+// projections and both views. CubeRenderer starts from the first key.
+void Benchmark::BuildPath()
+{
+	const glm::vec3 center = glm::vec3(0.0f, 1.5f, -5.0f);
+	const glm::vec3 cubeForward = glm::vec3(0.0f, 0.0f, 2.0f);
+	const glm::vec3 cubeHome = glm::vec3(0.0f, 1.5f, -1.0f);
+	const glm::vec3 cubeAside = glm::vec3(2.0f, 1.5f, -1.0f);
+
+	BenchmarkKey key;
+	key.appTarget = center;
+	key.appPerspective = true;
+	key.cubePerspective = false;
+	key.renderCube = true;
+
+	key.frame = 0;
+	key.appPosition = glm::vec3(2.5f, 3.0f, 0.0f);
+	key.cubePosition = cubeHome;
+	key.cubeTarget = cubeHome + cubeForward;
+	m_path.push_back(key);
+
+	key.frame = 150;
+	key.appPosition = glm::vec3(-3.0f, 2.5f, -1.0f);
+	m_path.push_back(key);
+
+	key.frame = 300;
+	key.appPosition = glm::vec3(-2.0f, 4.0f, -9.0f);
+	key.cubePosition = cubeAside;
+	key.cubeTarget = cubeAside + cubeForward;
+	m_path.push_back(key);
+
+	key.frame = 360;
+	key.appPosition = glm::vec3(2.0f, 1.0f, -9.0f);
+	key.appPerspective = false;
+	m_path.push_back(key);
+
+	key.frame = 420;
+	key.appPosition = glm::vec3(3.0f, 2.0f, -3.0f);
+	key.appPerspective = true;
+	key.renderCube = false;
+	m_path.push_back(key);
+
+	key.frame = 480;
+	key.appPosition = glm::vec3(2.5f, 3.0f, 0.0f);
+	key.cubePosition = cubeHome;
+	key.cubeTarget = cubeHome + cubeForward;
+	key.cubePerspective = true;
+	key.renderCube = true;
+	m_path.push_back(key);
+
+	key.frame = 540;
+	key.cubePerspective = false;
+	m_path.push_back(key);
+
+	// back to the start, so the path loops without a jump
+	key = m_path[0];
+	key.frame = 600;
+	m_path.push_back(key);
+}
+
+BenchmarkKey Benchmark::KeyAt(uint32_t frame) const
+{
+	uint32_t length = m_path.back().frame;
+	frame = (frame < BENCHMARK_WARMUP) ? 0 : (frame - BENCHMARK_WARMUP) % length;
+
+	size_t next = 1;
+	while (m_path[next].frame <= frame)
+		next++;
+
+	const BenchmarkKey* a = &m_path[next - 1];
+	const BenchmarkKey* b = &m_path[next];
+	float t = static_cast<float>(frame - a->frame) / (b->frame - a->frame);
+
+	BenchmarkKey key = *a;
+	key.frame = frame;
+	key.appPosition = glm::mix(a->appPosition, b->appPosition, t);
+	key.appTarget = glm::mix(a->appTarget, b->appTarget, t);
+	key.cubePosition = glm::mix(a->cubePosition, b->cubePosition, t);
+	key.cubeTarget = glm::mix(a->cubeTarget, b->cubeTarget, t);
+
+	return key;
+}
+
+// Only touch what moved, so cube faces that could be reused still are
+static void PlaceCamera(Camera *pCamera, glm::vec3 position, glm::vec3 target, bool bPerspective)
+{
+	if (pCamera->GetPosition() != position)
+		pCamera->SetPosition(position);
+	if (pCamera->GetTarget() != target)
+		pCamera->Target(target);
+	if (pCamera->IsPerspective() != bPerspective)
+		pCamera->SetPerspective(bPerspective);
+}
+
+void Benchmark::BeginFrame(uint32_t frame, CubeRenderer *pCube)
+{
+	BenchmarkKey key = KeyAt(frame);
+
+	PlaceCamera(pCube->AppCamera(), key.appPosition, key.appTarget, key.appPerspective);
+	PlaceCamera(pCube->CubeCamera(), key.cubePosition, key.cubeTarget, key.cubePerspective);
+	pCube->SetRenderCube(key.renderCube);
+	m_renderCube = key.renderCube;
+
+	m_measuring = (frame >= BENCHMARK_WARMUP);
+	m_current = Sample();
+	m_frameStart = SDL_GetPerformanceCounter();
+	m_passStart = m_frameStart;
+}
+
+void Benchmark::EndPass(BenchmarkPass pass)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	m_current.passMs[static_cast<int>(pass)] += (now - m_passStart) * 1000.0 / SDL_GetPerformanceFrequency();
+	m_passStart = now;
+}
+
+void Benchmark::EndFrame(const CubeStats& stats, uint32_t drawCalls)
+{
+	if (m_measuring == false)
+		return;
+
+	m_current.frameMs = (SDL_GetPerformanceCounter() - m_frameStart) * 1000.0 / SDL_GetPerformanceFrequency();
+
+	// GPU times are CubeRenderer's rolling averages, a few frames behind.
+	// Only the view the frame showed was measured, the report keeps cube
+	// and scene view frames apart.
+	m_current.drawCalls = drawCalls;
+	m_current.renderCube = m_renderCube;
+	if (m_renderCube)
+	{
+		m_current.gpuFacesMs = stats.facesMs;
+		m_current.gpuCompositeMs = stats.compositeMs;
+		m_current.facesRendered = stats.facesRendered;
+		m_current.facesReused = stats.facesReused;
+		m_current.facesSkipped = stats.facesSkipped;
+	}
+	else
+	{
+		m_current.gpuSceneMs = stats.sceneMs;
+	}
+
+	m_samples.push_back(m_current);
+}
+
+// Nearest rank, values is sorted
+static float Percentile(const std::vector<float>& values, float percent)
+{
+	size_t rank = static_cast<size_t>(ceilf(percent / 100.0f * values.size()));
+	return values[(rank > 0) ? rank - 1 : 0];
+}
+
+static void WriteStats(FILE* pFile, const char* pIndent, const char* pName, std::vector<float> values, bool bLast)
+{
+	if (values.empty())
+		values.push_back(0.0f);
+
+	std::sort(values.begin(), values.end());
+
+	double sum = 0.0;
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		sum += values[i];
+	}
+
+	fprintf(pFile, "%s\"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+		pIndent, pName,
+		sum / values.size(),
+		Percentile(values, 50.0f),
+		Percentile(values, 95.0f),
+		Percentile(values, 99.0f),
+		values.back(),
+		bLast ? "" : ",");
+}
+
+// For values the run never measured
+static void WriteNull(FILE* pFile, const char* pIndent, const char* pName, bool bLast)
+{
+	fprintf(pFile, "%s\"%s\": null%s\n", pIndent, pName, bLast ? "" : ",");
+}
+
+static void WriteString(FILE* pFile, const char* pText)
+{
+	fputc('"', pFile);
+	for (const char* p = pText; p != nullptr && *p != '\0'; ++p)
+	{
+		if (*p == '"' || *p == '\\')
+			fputc('\\', pFile);
+		if (static_cast<unsigned char>(*p) >= 0x20)
+			fputc(*p, pFile);
+	}
+	fputc('"', pFile);
+}
+
+GLResult Benchmark::WriteReport(const char* pFileName,
+				const char* pModelFile,
+				uint32_t instances,
+				uint32_t width,
+				uint32_t height,
+				bool bSoftware)
+{
+	FILE* pFile = fopen(pFileName, "w");
+	if (pFile == nullptr)
+	{
+		fprintf(stderr, "[ERROR] Could not write %s\n", pFileName);
+		return GLResult::Failed;
+	}
+
+	std::vector<float> frameMs, passMs[static_cast<int>(BenchmarkPass::Count)];
+	std::vector<float> gpuFacesMs, gpuCompositeMs, gpuSceneMs;
+	std::vector<float> drawCalls, facesRendered, facesReused, facesSkipped;
+	double totalMs = 0.0;
+
+	for (size_t i = 0; i < m_samples.size(); ++i)
+	{
+		const Sample* sample = &m_samples[i];
+
+		frameMs.push_back(sample->frameMs);
+		for (int j = 0; j < static_cast<int>(BenchmarkPass::Count); ++j)
+		{
+			passMs[j].push_back(sample->passMs[j]);
+		}
+		drawCalls.push_back(sample->drawCalls);
+		totalMs += sample->frameMs;
+
+		if (sample->renderCube == false)
+		{
+			gpuSceneMs.push_back(sample->gpuSceneMs);
+			continue;
+		}
+
+		gpuFacesMs.push_back(sample->gpuFacesMs);
+		gpuCompositeMs.push_back(sample->gpuCompositeMs);
+		facesRendered.push_back(sample->facesRendered);
+		facesReused.push_back(sample->facesReused);
+		facesSkipped.push_back(sample->facesSkipped);
+	}
+
+	const GLubyte* pRenderer = glGetString(GL_RENDERER);
+
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "  \"model\": ");
+	WriteString(pFile, pModelFile);
+	fprintf(pFile, ",\n");
+	fprintf(pFile, "  \"instances\": %u,\n", instances);
+	fprintf(pFile, "  \"size\": [%u, %u],\n", width, height);
+	fprintf(pFile, "  \"backend\": \"%s\",\n", bSoftware ? "software" : "gl");
+	fprintf(pFile, "  \"gl_renderer\": ");
+	WriteString(pFile, reinterpret_cast<const char*>(pRenderer));
+	fprintf(pFile, ",\n");
+	fprintf(pFile, "  \"simd\": \"%s\",\n", SimdLevelName(GetSimdLevel()));
+	fprintf(pFile, "  \"warmup_frames\": %d,\n", BENCHMARK_WARMUP);
+	fprintf(pFile, "  \"frames\": %zu,\n", m_samples.size());
+	fprintf(pFile, "  \"total_ms\": %.3f,\n", totalMs);
+	fprintf(pFile, "  \"fps\": %.2f,\n", (totalMs > 0.0) ? m_samples.size() * 1000.0 / totalMs : 0.0);
+	WriteStats(pFile, "  ", "frame_ms", frameMs, false);
+	fprintf(pFile, "  \"passes\": {\n");
+	WriteStats(pFile, "    ", "step_ms", passMs[static_cast<int>(BenchmarkPass::Step)], false);
+	WriteStats(pFile, "    ", "render_ms", passMs[static_cast<int>(BenchmarkPass::Render)], false);
+	WriteStats(pFile, "    ", "present_ms", passMs[static_cast<int>(BenchmarkPass::Present)], false);
+	// software runs never draw the cube on the GPU or schedule its faces,
+	// and a short run may never reach one of the views
+	if (bSoftware || gpuFacesMs.empty())
+	{
+		WriteNull(pFile, "    ", "gpu_faces_ms", false);
+		WriteNull(pFile, "    ", "gpu_composite_ms", false);
+	}
+	else
+	{
+		WriteStats(pFile, "    ", "gpu_faces_ms", gpuFacesMs, false);
+		WriteStats(pFile, "    ", "gpu_composite_ms", gpuCompositeMs, false);
+	}
+	if (bSoftware || gpuSceneMs.empty())
+		WriteNull(pFile, "    ", "gpu_scene_ms", true);
+	else
+		WriteStats(pFile, "    ", "gpu_scene_ms", gpuSceneMs, true);
+	fprintf(pFile, "  },\n");
+	fprintf(pFile, "  \"draws\": {\n");
+	WriteStats(pFile, "    ", "draw_calls", drawCalls, false);
+	if (bSoftware || facesRendered.empty())
+	{
+		WriteNull(pFile, "    ", "faces_rendered", false);
+		WriteNull(pFile, "    ", "faces_reused", false);
+		WriteNull(pFile, "    ", "faces_skipped", true);
+	}
+	else
+	{
+		WriteStats(pFile, "    ", "faces_rendered", facesRendered, false);
+		WriteStats(pFile, "    ", "faces_reused", facesReused, false);
+		WriteStats(pFile, "    ", "faces_skipped", facesSkipped, true);
+	}
+	fprintf(pFile, "  }\n");
+	fprintf(pFile, "}\n");
+
+	bool failed = (ferror(pFile) != 0);
+	if (fclose(pFile) != 0 || failed)
+	{
+		fprintf(stderr, "[ERROR] Could not write %s\n", pFileName);
+		return GLResult::Failed;
+	}
+
+	return GLResult::Success;
+}
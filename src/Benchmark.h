@@ -0,0 +1,93 @@
+#ifndef CUBE_BENCHMARK_H
+#define CUBE_BENCHMARK_H
+
+#include <stdint.h>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "CubeRenderer.h"
+#include "glutils.h"
+
+// frames run before measuring, holding the first key of the path
+#define BENCHMARK_WARMUP 30
+// measured frames without --frames, one pass over the built-in path
+#define BENCHMARK_FRAMES 600
+
+// Point on a scripted camera path. Positions and targets are interpolated
+// between keys, the flags switch when a key is reached.
+struct BenchmarkKey
+{
+	uint32_t frame;
+	glm::vec3 appPosition;
+	glm::vec3 appTarget;
+	glm::vec3 cubePosition;
+	glm::vec3 cubeTarget;
+	bool appPerspective;
+	bool cubePerspective;
+	bool renderCube;	// false shows the scene through the cube camera
+};
+
+// CPU passes of a frame, in the order RunGame ends them
+enum class BenchmarkPass {
+	Step,		// scenes and cameras stepped and joined
+	Render,		// commands issued, or faces rasterized on the CPU
+	Present,	// swap or flush
+	Count
+};
+
+// Plays a fixed camera path frame by frame, independent of input and of
+// wall clock time, and reports frame time statistics as JSON
+class Benchmark
+{
+public:
+	Benchmark(uint32_t frames);
+
+	// Warmup and measured frames together
+	uint32_t TotalFrames() const { return BENCHMARK_WARMUP + m_frames; }
+
+	// Move the cameras to where the path is at frame and start its clock
+	void BeginFrame(uint32_t frame, CubeRenderer *pCube);
+	void EndPass(BenchmarkPass pass);
+	// drawCalls counts every scene draw issued since the previous frame
+	void EndFrame(const CubeStats& stats, uint32_t drawCalls);
+
+	GLResult WriteReport(const char* pFileName,
+			     const char* pModelFile,
+			     uint32_t instances,
+			     uint32_t width,
+			     uint32_t height,
+			     bool bSoftware);
+
+private:
+	void BuildPath();
+	BenchmarkKey KeyAt(uint32_t frame) const;
+
+	// one sample per measured frame
+	struct Sample
+	{
+		float frameMs;
+		float passMs[static_cast<int>(BenchmarkPass::Count)];
+		bool renderCube;	// the GPU and face figures below are the cube's
+		float gpuFacesMs;
+		float gpuCompositeMs;
+		float gpuSceneMs;	// when the scene view was shown instead
+		uint32_t drawCalls;
+		uint32_t facesRendered;
+		uint32_t facesReused;
+		uint32_t facesSkipped;
+	};
+
+	uint32_t m_frames;
+	std::vector<BenchmarkKey> m_path;	// ascending frames, the last closes the loop
+	std::vector<Sample> m_samples;
+
+	bool m_measuring;			// the current frame is past the warmup
+	bool m_renderCube;			// the current frame draws the cube and its faces
+	uint64_t m_frameStart;
+	uint64_t m_passStart;
+	Sample m_current;
+};
+
+#endif // CUBE_BENCHMARK_H
@@ -1,4 +1,5 @@
 #include "Camera.h"
+#include "Profiler.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
@@ -35,6 +36,7 @@ Camera::Camera(float width, float height, float fov, float znear, float zfar, fl
 	projection_state = ProjectionState::Not;
 
 	this->persp = true;
+	this->generation = 0;
 }
 
 glm::mat4 Camera::View() {
@@ -57,6 +59,7 @@ glm::mat4 Camera::Projection() {
 void Camera::SetPerspective(bool persp)
 {
 	this->persp = persp;
+	generation++;
 }
 
 bool Camera::HandleKeys(SDL_KeyboardEvent event) {
@@ -68,6 +71,7 @@ bool Camera::HandleKeys(SDL_KeyboardEvent event) {
 	case SDLK_TAB:
 		if (event.state == SDL_PRESSED) {
 			targeting = !targeting;
+			generation++;
 			result = true;
 		}
 		break;
@@ -159,6 +163,7 @@ bool Camera::HandleKeys(SDL_KeyboardEvent event) {
 		if (event.state == SDL_RELEASED)
 		{
 			this->persp = !this->persp;
+			generation++;
 			result = true;
 		}
 		break;
@@ -229,6 +234,7 @@ void Camera::Rotate(float delta_x, float delta_y) {
 		direction = glm::rotate(direction,
 					delta_y * fov,
 					glm::cross(direction, up));
+		generation++;
 	}
 }
 
@@ -247,6 +253,7 @@ void Camera::Reproject()
 				   scale,
 				   znear,
 				   zfar);
+	generation++;
 }
 
 glm::vec3 Camera::Move(glm::vec3 delta)
@@ -261,6 +268,7 @@ void Camera::SetPosition(glm::vec3 position)
 	if (targeting) {
 		this->direction = glm::fastNormalize(target - position);
 	}
+	generation++;
 }
 
 void Camera::Target(glm::vec3 target, glm::vec3 new_up)
@@ -268,6 +276,7 @@ void Camera::Target(glm::vec3 target, glm::vec3 new_up)
 	this->target = target;
 	this->up = glm::fastNormalize(new_up);
 	this->direction = glm::fastNormalize(target - position);
+	generation++;
 }
 
 void Camera::Target(glm::vec3 target)
@@ -276,6 +285,8 @@ void Camera::Target(glm::vec3 target)
 }
 
 void Camera::Step(long delta=16) {
+	PROFILE_ZONE("Camera::Step");
+
 	if (targeting) {
 		direction = glm::fastNormalize(target - position);
 	}
@@ -294,18 +305,22 @@ void Camera::Step(long delta=16) {
 	switch (vertical) {
 	case MoveVertical::Up:
 		position += direction * (delta * 0.01f);
+		generation++;
 		break;
 	case MoveVertical::Down:
 		position -= direction * (delta * 0.01f);
+		generation++;
 		break;
 	}
 
 	switch (horizontal) {
 	case MoveHorizontal::Left:
 		position -= glm::cross(direction, up) * (delta * 0.01f);
+		generation++;
 		break;
 	case MoveHorizontal::Right:
 		position += glm::cross(direction, up) * (delta * 0.01f);
+		generation++;
 		break;
 	}
 
@@ -46,6 +46,9 @@ private:
 	glm::mat4 orthographic;
 	float scale;
 
+	// bumped whenever View() or Projection() may have changed
+	uint64_t generation;
+
 	bool HandleKeys(SDL_KeyboardEvent event);
 	bool HandleMouseMotion(SDL_MouseMotionEvent event);
 
@@ -72,6 +75,8 @@ public:
 	glm::vec3 GetTarget() const { return target; }
 	glm::vec3 GetDirection() const { return direction; }
 	glm::vec3 GetUp() const { return up; }
+	bool IsPerspective() const { return persp; }
+	uint64_t GetGeneration() const { return generation; }
 
 	bool HandleInputEvent(SDL_Event event);
 	void Step(long delta);
@@ -1,6 +1,8 @@
 #include "CubeRenderer.h"
+#include "Profiler.h"
 
 #include <math.h>
+#include <string.h>
 #include <glm/gtc/matrix_transform.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/fast_square_root.hpp>
@@ -9,6 +11,17 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/string_cast.hpp>
 
+// smallest face level adaptive resolution will drop to
+#define MIN_FACE_SIZE 16
+
+// std140 layout of the CubeFaces uniform block
+struct CubeFacesBlock
+{
+	glm::mat4 viewProjection[NUM_SIDES];
+	GLint faceMask;
+	GLint pad[3];
+};
+
 static GLfloat vertices[] = {-0.5, -0.5, -0.5,
 			      0.5, -0.5, -0.5,
 			     -0.5, -0.5,  0.5,
@@ -72,6 +85,14 @@ static GLfloat uvs[] = { -1.0,  -1.0,  1.0,
 };
 
 
+// Cube map face shown by each vertex, see faceNormals
+static GLfloat faces[] = {3, 3, 3, 3,
+			  4, 4, 4, 4,
+			  0, 0, 0, 0,
+			  1, 1, 1, 1,
+			  5, 5, 5, 5,
+			  2, 2, 2, 2};
+
 static GLuint indices[] = {0, 1, 2,
 			   1, 2, 3,
 
@@ -94,28 +115,61 @@ static const char vs_src[] =
 "#version 330\n\
 in vec3 position;\n\
 in vec3 uvs;\n\
+in float face;\n\
 out vec4 color;\n\
 out vec3 tex_coord;\n\
+flat out float lod;\n\
 uniform mat4 world;\n\
+uniform float face_lod[6];\n\
 void main() {\n\
     tex_coord = uvs;\n\
+    lod = face_lod[int(face)];\n\
     gl_Position = world * vec4(position, 1.0);\n\
 }";
 
 static const char fs_src[] =
 "#version 330\n\
 in  vec3 tex_coord;\n\
+flat in float lod;\n\
 out vec4 out_color;\n\
 uniform samplerCube frameTexture;\n\
 void main() {\n\
-    out_color = texture(frameTexture, tex_coord);\n\
+    out_color = textureLod(frameTexture, tex_coord, lod);\n\
 }";
 
-CubeRenderer::CubeRenderer(uint32_t width, uint32_t height)
+CubeRenderer::CubeRenderer(uint32_t width, uint32_t height, CubeTargetDesc desc)
 {
 	m_width = width;
 	m_height = height;
+	m_desc = desc;
+	m_centerPosition = glm::vec3(0.0, 1.5, -5.0);
+	m_extent = 1.0;
+	m_stats.facesRendered = 0;
+	m_stats.facesSkipped = 0;
+	m_stats.facesReused = 0;
+	m_stats.facesDeferred = 0;
+	m_stats.facePixels = 0;
+	m_stats.faceMsPerPixel = 0.0f;
+	m_stats.facesMs = 0.0f;
+	m_stats.compositeMs = 0.0f;
+	m_stats.sceneMs = 0.0f;
+	m_frameBudgetMs = 0.0f;
+	m_visibleMask = 0;
+	m_prepared = false;
+	m_pPlaceholder = nullptr;
+	m_outputFbo = 0;
+	m_refreshWindowStart = SDL_GetTicks();
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		m_stats.faceRefreshHz[i] = 0.0f;
+		m_stats.faceMs[i] = 0.0f;
+		m_faceAge[i] = 0;
+		m_faceRefreshes[i] = 0;
+	}
+	InvalidateFaces();
 	this->bRenderCube = true;
+	this->bAdaptive = true;
+	this->bLayered = true;
 	Init();
 }
 
@@ -124,12 +178,11 @@ CubeRenderer::~CubeRenderer()
 	delete pAppCamera;
 	delete pCubeCamera;
 	glDeleteProgram(m_program);
-	glDeleteBuffers(2, m_vbos);
+	glDeleteBuffers(3, m_vbos);
 	glDeleteBuffers(1, &m_ibo);
 	glDeleteVertexArrays(1, &m_vao);
-	glDeleteTextures(1, &m_color);
-	glDeleteTextures(1, &m_depth);
-	glDeleteFramebuffers(NUM_SIDES, m_fbos);
+	glDeleteBuffers(1, &m_faceUbo);
+	ReleaseTargets();
 }
 
 GLResult CubeRenderer::Init()
@@ -148,10 +201,12 @@ GLResult CubeRenderer::Init()
 			       0,
 			       "out_color");
 	
+	m_faceLodUniform = glGetUniformLocation(m_program, "face_lod");
+
 	glGenVertexArrays(1, &m_vao);
 	glBindVertexArray(m_vao);
 	
-	glGenBuffers(2, m_vbos);
+	glGenBuffers(3, m_vbos);
 	glBindBuffer(GL_ARRAY_BUFFER, m_vbos[0]);
 	glBufferData(GL_ARRAY_BUFFER,
 		     sizeof(vertices),
@@ -188,6 +243,24 @@ GLResult CubeRenderer::Init()
 			      0,
 			      nullptr);
 
+	glBindBuffer(GL_ARRAY_BUFFER, m_vbos[2]);
+	glBufferData(GL_ARRAY_BUFFER,
+		     sizeof(faces),
+		     faces,
+		     GL_STATIC_DRAW);
+
+	GLint face_attr = glGetAttribLocation(m_program, "face");
+	if (face_attr == -1) {
+		return GLResult::Error;
+	}
+	glEnableVertexAttribArray(face_attr);
+	glVertexAttribPointer(face_attr,
+			      1,
+			      GL_FLOAT,
+			      GL_FALSE,
+			      0,
+			      nullptr);
+
 	glGenBuffers(1, &m_ibo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
@@ -195,243 +268,319 @@ GLResult CubeRenderer::Init()
 		     indices,
 		     GL_STATIC_DRAW);
 
-	// allocate textures and fbos for attachment
-	// make one per face
-	glGenTextures(1, &m_color);
-	glGenTextures(1, &m_depth);
+	result = AllocateTargets();
 
-	// +x
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_color);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X,
-		     0,
-		     GL_RGBA,
-		     512, 512,
-		     0,
-		     GL_RGBA,
-		     GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	glGenBuffers(1, &m_faceUbo);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_faceUbo);
+	glBufferData(GL_UNIFORM_BUFFER,
+		     sizeof(CubeFacesBlock),
+		     nullptr,
+		     GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_depth);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X,
-		     0,
-		     GL_DEPTH_COMPONENT24,
-		     512, 512,
-		     0,
-		     GL_DEPTH_COMPONENT,
-		     GL_FLOAT, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	// allocate cameras
+	// change to ortho, make one per face
+	pCubeCamera = new Camera(static_cast<float>(m_desc.faceSize),
+				 static_cast<float>(m_desc.faceSize),
+				 3.14 / 4.0,
+				 0.01,
+				 10000.0,
+				 10.0);
 
-	// -x
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_color);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-		     0,
-		     GL_RGBA,
-		     512, 512,
-		     0,
-		     GL_RGBA,
-		     GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	pCubeCamera->SetPosition(glm::vec3(0.0, 1.5, -1.0));
+	pCubeCamera->Target(glm::vec3(0.f, 1.5f, 1.f));
+	pCubeCamera->SetPerspective(false);
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_depth);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-		     0,
-		     GL_DEPTH_COMPONENT24,
-		     512, 512,
-		     0,
-		     GL_DEPTH_COMPONENT,
-		     GL_FLOAT, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	pAppCamera = new Camera(static_cast<float>(m_width),
+				static_cast<float>(m_height),
+				3.14 / 4.0,
+				0.1,
+				10000.0,
+				1.0);
+	pAppCamera->Move(glm::vec3(2.5, 3.0, 0.0));
 
-	// +y
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_color);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
-		     0,
-		     GL_RGBA,
-		     512, 512,
-		     0,
-		     GL_RGBA,
-		     GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	this->pControlCamera = pAppCamera;
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_depth);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
-		     0,
-		     GL_DEPTH_COMPONENT24,
-		     512, 512,
-		     0,
-		     GL_DEPTH_COMPONENT,
-		     GL_FLOAT, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	return result;
+}
 
-	// -y
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_color);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-		     0,
-		     GL_RGBA,
-		     512, 512,
-		     0,
-		     GL_RGBA,
-		     GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+GLResult CubeRenderer::AllocateTargets()
+{
+	GLResult result = GLResult::Success;
+	GLsizei size = m_desc.faceSize;
+	GLsizei samples = m_desc.samples;
+	bool multisample = (samples > 1);
+	GLenum attachments[2] = {GL_COLOR_ATTACHMENT0};
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_depth);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-		     0,
-		     GL_DEPTH_COMPONENT24,
-		     512, 512,
-		     0,
-		     GL_DEPTH_COMPONENT,
-		     GL_FLOAT, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	// reduced resolution faces are drawn into lower levels
+	m_maxLevel = 0;
+	while ((size >> (m_maxLevel + 1)) >= MIN_FACE_SIZE)
+		m_maxLevel++;
 
-	// +z
+	// the cubemap the display cube samples from
+	glGenTextures(1, &m_color);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, m_color);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
-		     0,
-		     GL_RGBA,
-		     512, 512,
-		     0,
-		     GL_RGBA,
-		     GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
-
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_depth);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
-		     0,
-		     GL_DEPTH_COMPONENT24,
-		     512, 512,
-		     0,
-		     GL_DEPTH_COMPONENT,
-		     GL_FLOAT, 0);
+	for (uint32_t level=0; level <= m_maxLevel; ++level)
+	{
+		for (uint8_t i=0; i < NUM_SIDES; ++i)
+		{
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+				     level,
+				     m_desc.colorFormat,
+				     size >> level, size >> level,
+				     0,
+				     GL_RGBA,
+				     GL_UNSIGNED_BYTE, 0);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, m_maxLevel);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
-	// -z
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_color);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
-		     0,
-		     GL_RGBA,
-		     512, 512,
-		     0,
-		     GL_RGBA,
-		     GL_UNSIGNED_BYTE, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	m_msColor = 0;
+	m_depth = 0;
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_depth);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
-		     0,
-		     GL_DEPTH_COMPONENT24,
-		     512, 512,
-		     0,
-		     GL_DEPTH_COMPONENT,
-		     GL_FLOAT, 0);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE); 
+	if (m_desc.depth == CubeDepth::Texture)
+	{
+		if (multisample)
+		{
+			// cube maps can't be multisampled, draw into a 6 layer array and resolve
+			glGenTextures(1, &m_msColor);
+			glBindTexture(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, m_msColor);
+			glTexImage3DMultisample(GL_TEXTURE_2D_MULTISAMPLE_ARRAY,
+						samples,
+						m_desc.colorFormat,
+						size, size, NUM_SIDES,
+						GL_TRUE);
+
+			glGenTextures(1, &m_depth);
+			glBindTexture(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, m_depth);
+			glTexImage3DMultisample(GL_TEXTURE_2D_MULTISAMPLE_ARRAY,
+						samples,
+						GL_DEPTH_COMPONENT24,
+						size, size, NUM_SIDES,
+						GL_TRUE);
+			glBindTexture(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, 0);
+		}
+		else
+		{
+			glGenTextures(1, &m_depth);
+			glBindTexture(GL_TEXTURE_CUBE_MAP, m_depth);
+			for (uint8_t i=0; i < NUM_SIDES; ++i)
+			{
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+					     0,
+					     GL_DEPTH_COMPONENT24,
+					     size, size,
+					     0,
+					     GL_DEPTH_COMPONENT,
+					     GL_FLOAT, 0);
+			}
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		}
+	}
+	else
+	{
+		// depth is never sampled, so one face worth is shared by every face pass
+		glGenRenderbuffers(1, &m_depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER,
+						 multisample ? samples : 0,
+						 GL_DEPTH_COMPONENT24,
+						 size, size);
+
+		if (multisample)
+		{
+			glGenRenderbuffers(1, &m_msColor);
+			glBindRenderbuffer(GL_RENDERBUFFER, m_msColor);
+			glRenderbufferStorageMultisample(GL_RENDERBUFFER,
+							 samples,
+							 m_desc.colorFormat,
+							 size, size);
+		}
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	}
 
+	// per face draw targets, also used to clear single faces
 	glGenFramebuffers(NUM_SIDES, m_fbos);
-	GLenum attachments[2] = {GL_COLOR_ATTACHMENT0};
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		GLenum face = GL_TEXTURE_CUBE_MAP_POSITIVE_X + i;
+		glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[i]);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[0]);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X, m_color, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X, m_depth, 0);
-	glDrawBuffers(2, attachments);
+		if (m_desc.depth == CubeDepth::Texture)
+		{
+			if (multisample)
+			{
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_msColor, 0, i);
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depth, 0, i);
+			}
+			else
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, face, m_color, 0);
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, face, m_depth, 0);
+			}
+		}
+		else
+		{
+			if (multisample)
+				glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_msColor);
+			else
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, face, m_color, 0);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+		}
+		glDrawBuffers(2, attachments);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[1]);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_NEGATIVE_X, m_color, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_NEGATIVE_X, m_depth, 0);
-	glDrawBuffers(2, attachments);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			fprintf(stderr, "[ERROR] cube face %u framebuffer incomplete\n", i);
+			result = GLResult::Failed;
+		}
+	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[2]);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_Y, m_color, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_Y, m_depth, 0);
-	glDrawBuffers(2, attachments);
+	// multisampled faces are resolved into the cubemap through these
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		m_resolveFbos[i] = 0;
+		m_attachedLevels[i] = 0;
+	}
+	m_layeredLevel = 0;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[3]);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, m_color, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, m_depth, 0);
-	glDrawBuffers(2, attachments);
+	if (multisample)
+	{
+		glGenFramebuffers(NUM_SIDES, m_resolveFbos);
+		for (uint8_t i=0; i < NUM_SIDES; ++i)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, m_resolveFbos[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, m_color, 0);
+			glDrawBuffers(2, attachments);
+		}
+	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[4]);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_Z, m_color, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_Z, m_depth, 0);
-	glDrawBuffers(2, attachments);
+	// whole target attached, faces selected per primitive with gl_Layer
+	// renderbuffers can't be layered, so that setup only has the per-face path
+	m_layeredFbo = 0;
+	if (m_desc.depth == CubeDepth::Texture)
+	{
+		glGenFramebuffers(1, &m_layeredFbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_layeredFbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, multisample ? m_msColor : m_color, 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depth, 0);
+		glDrawBuffers(2, attachments);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			fprintf(stderr, "[WARN] layered cube framebuffer incomplete, rendering faces separately\n");
+			glDeleteFramebuffers(1, &m_layeredFbo);
+			m_layeredFbo = 0;
+		}
+	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[5]);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, m_color, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, m_depth, 0);
-	glDrawBuffers(2, attachments);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	// allocate cameras
-	// change to ortho, make one per face
-	pCubeCamera = new Camera(512.0, 512.0,
-				 3.14 / 4.0,
-				 0.01,
-				 10000.0,
-				 10.0);
+	return result;
+}
 
-	pCubeCamera->SetPosition(glm::vec3(0.0, 1.5, -1.0));
-	pCubeCamera->Target(glm::vec3(0.f, 1.5f, 1.f));
-	pCubeCamera->SetPerspective(false);
+void CubeRenderer::ReleaseTargets()
+{
+	glDeleteTextures(1, &m_color);
 
-	pAppCamera = new Camera(static_cast<float>(m_width),
-				static_cast<float>(m_height),
-				3.14 / 4.0,
-				0.1,
-				10000.0,
-				1.0);
-	pAppCamera->Move(glm::vec3(2.5, 3.0, 0.0));
+	if (m_desc.depth == CubeDepth::Texture)
+	{
+		glDeleteTextures(1, &m_depth);
+		glDeleteTextures(1, &m_msColor);
+	}
+	else
+	{
+		glDeleteRenderbuffers(1, &m_depth);
+		glDeleteRenderbuffers(1, &m_msColor);
+	}
 
-	this->pControlCamera = pAppCamera;
+	glDeleteFramebuffers(NUM_SIDES, m_fbos);
+	glDeleteFramebuffers(NUM_SIDES, m_resolveFbos);
+	glDeleteFramebuffers(1, &m_layeredFbo);
+}
+
+GLResult CubeRenderer::SetTargetDesc(CubeTargetDesc desc)
+{
+	GLint maxSamples = 0;
+	glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+	if (desc.samples > static_cast<uint32_t>(maxSamples)) {
+		fprintf(stderr, "[WARN] %u samples not supported, using %d\n", desc.samples, maxSamples);
+		desc.samples = maxSamples;
+	}
+
+	CubeTargetDesc previous = m_desc;
+
+	ReleaseTargets();
+	m_desc = desc;
+	GLResult result = AllocateTargets();
+
+	if (result != GLResult::Success)
+	{
+		fprintf(stderr, "[WARN] %u px faces with %u samples could not be allocated, keeping %u px with %u\n",
+			desc.faceSize, desc.samples, previous.faceSize, previous.samples);
+		ReleaseTargets();
+		m_desc = previous;
+		AllocateTargets();
+	}
+
+	// old contents went with the old textures
+	InvalidateFaces();
 
 	return result;
 }
 
+void CubeRenderer::ResolveFaces(uint32_t faceMask)
+{
+	if (m_desc.samples <= 1)
+		return;
+
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		if ((faceMask & (1 << i)) == 0)
+			continue;
+
+		GLint size = m_desc.faceSize >> m_faceLevels[i];
+
+		AttachFaceLevel(i, m_faceLevels[i]);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbos[i]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_resolveFbos[i]);
+		glBlitFramebuffer(0, 0, size, size,
+				  0, 0, size, size,
+				  GL_COLOR_BUFFER_BIT,
+				  GL_NEAREST);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Point the face's cubemap attachment at the level it is drawn at this frame
+void CubeRenderer::AttachFaceLevel(uint8_t face, uint32_t level)
+{
+	if (m_attachedLevels[face] == level)
+		return;
+
+	// multisampled faces draw into level sized corners of the sample buffer
+	if (m_desc.samples > 1)
+		glBindFramebuffer(GL_FRAMEBUFFER, m_resolveFbos[face]);
+	else
+		glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[face]);
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER,
+			       GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+			       m_color,
+			       level);
+
+	m_attachedLevels[face] = level;
+}
+
 void CubeRenderer::Resize(uint32_t width, uint32_t height)
 {
 	m_width = width;
@@ -445,69 +594,567 @@ void CubeRenderer::Step(uint32_t stepMs)
 	pCubeCamera->Step(stepMs);
 }
 
+// Display cube face normal (model space) that shows each cube map face
+static const glm::vec3 faceNormals[NUM_SIDES] = {
+	glm::vec3(-1.0f,  0.0f,  0.0f),
+	glm::vec3( 1.0f,  0.0f,  0.0f),
+	glm::vec3( 0.0f,  1.0f,  0.0f),
+	glm::vec3( 0.0f, -1.0f,  0.0f),
+	glm::vec3( 0.0f,  0.0f,  1.0f),
+	glm::vec3( 0.0f,  0.0f, -1.0f),
+};
+
+static uint32_t CountFaces(uint32_t faceMask)
+{
+	uint32_t count = 0;
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		if (faceMask & (1 << i))
+			count++;
+	}
+	return count;
+}
+
+static uint8_t LowestFace(uint32_t faceMask)
+{
+	uint8_t i = 0;
+	while (i < NUM_SIDES && (faceMask & (1 << i)) == 0)
+		i++;
+	return i;
+}
+
+// Face timers are tagged with the faces of the pass and their mip level
+static uint32_t FaceTimerTag(uint32_t faceMask, uint32_t level)
+{
+	return faceMask | (level << 8);
+}
+
+static uint32_t ClipOutcode(glm::vec4 clip)
+{
+	uint32_t code = 0;
+	if (clip.x < -clip.w) code |= 0x01;
+	if (clip.x >  clip.w) code |= 0x02;
+	if (clip.y < -clip.w) code |= 0x04;
+	if (clip.y >  clip.w) code |= 0x08;
+	if (clip.z < -clip.w) code |= 0x10;
+	if (clip.z >  clip.w) code |= 0x20;
+	return code;
+}
+
+// Model space corner of a display cube face, bit 0 of corner steps along
+// the face tangent and bit 1 along the bitangent
+static glm::vec3 FaceCorner(uint8_t face, uint8_t corner)
+{
+	glm::vec3 normal = faceNormals[face];
+	glm::vec3 tangent = glm::vec3(normal.y, normal.z, normal.x);
+	glm::vec3 bitangent = glm::cross(normal, tangent);
+	float s = (corner & 1) ? 0.5f : -0.5f;
+	float t = (corner & 2) ? 0.5f : -0.5f;
+
+	return (normal * 0.5f) + (tangent * s) + (bitangent * t);
+}
+
+glm::mat4 CubeRenderer::CubeModelViewProjection()
+{
+	return pAppCamera->Projection() *
+		pAppCamera->View() *
+		glm::translate(m_centerPosition) *
+		glm::scale(glm::vec3(m_extent));
+}
+
+// Pick the cubemap level each face is drawn at from its on screen size
+void CubeRenderer::FaceLevels(uint32_t faceMask)
+{
+	glm::mat4 model_view_projection = CubeModelViewProjection();
+	glm::vec2 viewport = glm::vec2(m_width, m_height);
+
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		m_faceLevels[i] = 0;
+
+		if (bAdaptive == false || (faceMask & (1 << i)) == 0)
+			continue;
+
+		glm::vec2 screen[4];
+		bool clipped = false;
+
+		for (uint8_t corner=0; corner < 4; ++corner)
+		{
+			glm::vec4 clip = model_view_projection * glm::vec4(FaceCorner(i, corner), 1.0f);
+			if (clip.w <= 0.0001f) {
+				clipped = true;
+				break;
+			}
+
+			screen[corner] = glm::vec2(clip.x / clip.w, clip.y / clip.w) * 0.5f;
+			screen[corner] = glm::vec2(screen[corner].x * viewport.x,
+						   screen[corner].y * viewport.y);
+		}
+
+		// crosses the eye plane, no sensible footprint
+		if (clipped)
+			continue;
+
+		// longest edge, so the sampled level never has to magnify along either axis
+		float extent = glm::length(screen[1] - screen[0]);
+		extent = glm::max(extent, glm::length(screen[3] - screen[2]));
+		extent = glm::max(extent, glm::length(screen[2] - screen[0]));
+		extent = glm::max(extent, glm::length(screen[3] - screen[1]));
+
+		if (extent < 1.0f)
+			extent = 1.0f;
+
+		float level = floorf(log2f(m_desc.faceSize / extent));
+		if (level > 0.0f)
+			m_faceLevels[i] = glm::min(static_cast<uint32_t>(level), m_maxLevel);
+	}
+}
+
+uint32_t CubeRenderer::VisibleFaces()
+{
+	glm::vec3 offset = (pAppCamera->GetPosition() - m_centerPosition) / m_extent;
+
+	// from inside every face is a back face, but all of them can be seen
+	if (fabs(offset.x) < 0.5f && fabs(offset.y) < 0.5f && fabs(offset.z) < 0.5f)
+		return (1 << NUM_SIDES) - 1;
+
+	glm::mat4 model_view_projection = CubeModelViewProjection();
+
+	uint32_t mask = 0;
+
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		glm::vec3 normal = faceNormals[i];
+
+		bool facing;
+		if (pAppCamera->IsPerspective())
+			facing = glm::dot(offset - (normal * 0.5f), normal) > 0.0f;
+		else
+			facing = glm::dot(pAppCamera->GetDirection(), normal) < 0.0f;
+
+		if (facing == false)
+			continue;
+
+		uint32_t outside = ~0u;
+
+		for (uint8_t corner=0; corner < 4; ++corner)
+		{
+			glm::vec4 p = glm::vec4(FaceCorner(i, corner), 1.0f);
+			outside &= ClipOutcode(model_view_projection * p);
+		}
+
+		// all corners beyond the same clip plane
+		if (outside == 0)
+			mask |= (1 << i);
+	}
+
+	return mask;
+}
+
+void CubeRenderer::InvalidateFaces()
+{
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		m_faces[i].valid = false;
+		m_faces[i].level = 0;
+		m_faceLevels[i] = 0;
+		m_faces[i].pScene = nullptr;
+		m_faces[i].sceneGeneration = 0;
+		m_faces[i].cameraGeneration = 0;
+	}
+}
+
+// Faces in faceMask whose texture doesn't match the current scene and camera
+uint32_t CubeRenderer::StaleFaces(Scene *pTargetScene, uint32_t faceMask)
+{
+	uint32_t stale = 0;
+	uint64_t cameraGeneration = pCubeCamera->GetGeneration();
+
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		if ((faceMask & (1 << i)) == 0)
+			continue;
+
+		CubeFaceState *face = &m_faces[i];
+		// a finer level than needed is still fine to sample from
+		if (face->valid == false ||
+		    face->level > m_faceLevels[i] ||
+		    face->pScene != pTargetScene ||
+		    pTargetScene->ChangedSince(face->sceneGeneration) ||
+		    face->cameraGeneration != cameraGeneration)
+		{
+			stale |= (1 << i);
+		}
+	}
+
+	return stale;
+}
+
+void CubeRenderer::MarkFaces(Scene *pTargetScene, uint32_t faceMask)
+{
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		if ((faceMask & (1 << i)) == 0)
+			continue;
+
+		m_faceRefreshes[i]++;
+		m_faces[i].valid = true;
+		m_faces[i].level = m_faceLevels[i];
+		m_faces[i].pScene = pTargetScene;
+		m_faces[i].sceneGeneration = pTargetScene->Generation();
+		m_faces[i].cameraGeneration = pCubeCamera->GetGeneration();
+	}
+}
+
+static float Smooth(float average, float sample)
+{
+	if (average <= 0.0f)
+		return sample;
+	return average + (sample - average) * 0.1f;
+}
+
+void CubeRenderer::UpdateTimings()
+{
+	float ms;
+	uint32_t tag;
+
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		while (m_faceTimers[i].Poll(&ms, &tag))
+		{
+			uint32_t faceMask = tag & 0xff;
+			uint32_t count = CountFaces(faceMask);
+			if (count == 0)
+				continue;
+
+			// a layered pass is shared evenly between its faces
+			uint32_t size = m_desc.faceSize >> (tag >> 8);
+			for (uint8_t j=0; j < NUM_SIDES; ++j)
+			{
+				if (faceMask & (1 << j))
+					m_stats.faceMs[j] = Smooth(m_stats.faceMs[j], ms / count);
+			}
+			m_stats.faceMsPerPixel = Smooth(m_stats.faceMsPerPixel, ms / (count * size * size));
+		}
+	}
+
+	while (m_compositeTimer.Poll(&ms))
+	{
+		m_stats.compositeMs = Smooth(m_stats.compositeMs, ms);
+	}
+
+	while (m_sceneTimer.Poll(&ms))
+	{
+		m_stats.sceneMs = Smooth(m_stats.sceneMs, ms);
+	}
+
+	uint32_t now = SDL_GetTicks();
+	uint32_t window = now - m_refreshWindowStart;
+	if (window >= 1000)
+	{
+		for (uint8_t i=0; i < NUM_SIDES; ++i)
+		{
+			m_stats.faceRefreshHz[i] = (m_faceRefreshes[i] * 1000.0f) / window;
+			m_faceRefreshes[i] = 0;
+		}
+		m_refreshWindowStart = now;
+	}
+}
+
+// Scene and cube camera updates a face has missed, holding nothing usable
+// counts as the most changed
+uint64_t CubeRenderer::FaceChange(Scene *pTargetScene, uint8_t face)
+{
+	const CubeFaceState *state = &m_faces[face];
+
+	if (state->valid == false || state->pScene != pTargetScene)
+		return UINT64_MAX;
+
+	return (pTargetScene->Generation() - state->sceneGeneration) +
+	       (pCubeCamera->GetGeneration() - state->cameraGeneration);
+}
+
+// Measured GPU time of a face's pass, scaled from the level it was last
+// drawn at to the one it needs now. Faces not timed yet use the average
+// cost per pixel.
+float CubeRenderer::FaceCost(uint8_t face)
+{
+	uint32_t size = m_desc.faceSize >> m_faceLevels[face];
+
+	if (m_stats.faceMs[face] <= 0.0f)
+		return m_stats.faceMsPerPixel * size * size;
+
+	uint32_t drawnSize = m_desc.faceSize >> m_faces[face].level;
+	float scale = static_cast<float>(size) / drawnSize;
+	return m_stats.faceMs[face] * scale * scale;
+}
+
+// Pick the stale faces that fit in the frame budget, longest waiting first,
+// then most changed and then largest on screen, so deferred faces are
+// refreshed round-robin
+uint32_t CubeRenderer::ScheduleFaces(Scene *pTargetScene, uint32_t faceMask)
+{
+	if (m_frameBudgetMs <= 0.0f || faceMask == 0)
+		return faceMask;
+
+	uint8_t order[NUM_SIDES];
+	uint64_t change[NUM_SIDES];
+	uint8_t count = 0;
+
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		if ((faceMask & (1 << i)) == 0)
+			continue;
+
+		change[i] = FaceChange(pTargetScene, i);
+
+		uint8_t j = count++;
+		while (j > 0 &&
+		       (m_faceAge[order[j - 1]] < m_faceAge[i] ||
+			(m_faceAge[order[j - 1]] == m_faceAge[i] &&
+			 (change[order[j - 1]] < change[i] ||
+			  (change[order[j - 1]] == change[i] &&
+			   m_faceLevels[order[j - 1]] > m_faceLevels[i])))))
+		{
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+
+	float budget = m_frameBudgetMs - m_stats.compositeMs;
+	float cost = 0.0f;
+	uint32_t scheduled = 0;
+
+	for (uint8_t k=0; k < count; ++k)
+	{
+		uint8_t i = order[k];
+		float faceCost = FaceCost(i);
+
+		// always make progress, then fill what's left of the budget
+		if (scheduled != 0 && cost + faceCost > budget)
+			continue;
+
+		scheduled |= (1 << i);
+		cost += faceCost;
+	}
+
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		if (scheduled & (1 << i))
+			m_faceAge[i] = 0;
+		else if (faceMask & (1 << i))
+			m_faceAge[i]++;
+	}
+
+	return scheduled;
+}
+
 static glm::vec3 up1 = glm::vec3(0.0f, 1.0f, 0.0f);
 static glm::vec3 up2 = glm::vec3(0.0f, 0.0f, 1.0f);
 
-void CubeRenderer::RenderCube(Scene *pTargetScene)
+// Same placements RenderFaces walks pCubeCamera through, without touching it
+void CubeRenderer::FaceViewProjections(glm::mat4 *pFaces)
 {
 	glm::vec3 position = pCubeCamera->GetPosition();
-	glm::vec3 target = pCubeCamera->GetTarget();
 	glm::vec3 up = pCubeCamera->GetUp();
 	glm::vec3 direction = pCubeCamera->GetDirection();
 	glm::vec3 right = glm::cross(direction, up);
 	float scale = pCubeCamera->GetScale();
+	glm::vec3 center = position + (direction * scale);
+	glm::mat4 projection = pCubeCamera->Projection();
+
+	pFaces[0] = projection * glm::lookAt(center + (right * -scale), center, up);
+	pFaces[1] = projection * glm::lookAt(center + (right * scale), center, up);
+	pFaces[2] = projection * glm::lookAt(center + (up * scale), center, direction);
+	pFaces[3] = projection * glm::lookAt(center + (up * -scale), center, -direction);
+	pFaces[4] = projection * glm::lookAt(position, center, up);
+	pFaces[5] = projection * glm::lookAt(center + (direction * scale), center, up);
+}
 
+// Every face in faceMask must be at the same level
+bool CubeRenderer::RenderFacesLayered(Scene *pTargetScene, uint32_t faceMask)
+{
+	uint32_t level = m_faceLevels[LowestFace(faceMask)];
+	GLsizei size = m_desc.faceSize >> level;
+	CubeFacesBlock block;
+	memcpy(block.viewProjection, m_faceViewProjections, sizeof(block.viewProjection));
+	block.faceMask = faceMask;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, m_faceUbo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, CUBE_FACES_BINDING, m_faceUbo);
+
+	// a layered clear hits every face, skipped faces have to keep their contents
+	glClearColor(0.2, 0.2, 0.2, 0.2);
 	for (uint8_t i=0; i < NUM_SIDES; ++i)
 	{
+		if ((faceMask & (1 << i)) == 0)
+			continue;
+
+		AttachFaceLevel(i, level);
 		glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[i]);
-		glViewport(0,0,512,512);
+		glViewport(0,0,size,size);
+		glClear(GL_COLOR_BUFFER_BIT |
+			GL_DEPTH_BUFFER_BIT);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_layeredFbo);
+	if (m_desc.samples <= 1 && m_layeredLevel != level)
+	{
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_color, level);
+		m_layeredLevel = level;
+	}
+	glViewport(0,0,size,size);
+
+	return pTargetScene->RenderLayered();
+}
+
+void CubeRenderer::RenderFaces(Scene *pTargetScene, uint32_t faceMask)
+{
+	// walk a copy so pCubeCamera (and its generation) is left alone
+	Camera faceCamera = *pCubeCamera;
+	glm::vec3 position = pCubeCamera->GetPosition();
+	glm::vec3 up = pCubeCamera->GetUp();
+	glm::vec3 direction = pCubeCamera->GetDirection();
+	glm::vec3 right = glm::cross(direction, up);
+	float scale = pCubeCamera->GetScale();
+
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		if ((faceMask & (1 << i)) == 0)
+			continue;
 
-		pCubeCamera->Target(position + (direction * scale), up);
+		GLsizei size = m_desc.faceSize >> m_faceLevels[i];
+
+		m_faceTimers[i].Begin();
+		AttachFaceLevel(i, m_faceLevels[i]);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[i]);
+		glViewport(0,0,size,size);
+
+		faceCamera.Target(position + (direction * scale), up);
 
 		switch(i)
 		{
 		case 0: // -X
-			pCubeCamera->SetPosition(position         +
-						 (right * -scale) +
-						 (direction * scale));
+			faceCamera.SetPosition(position         +
+					       (right * -scale) +
+					       (direction * scale));
 			break;
 		case 1: // +X
-			pCubeCamera->SetPosition(position        +
-						 (right * scale) +
-						 (direction * scale));
+			faceCamera.SetPosition(position        +
+					       (right * scale) +
+					       (direction * scale));
 			break;
 		case 2: // +Y
-			pCubeCamera->SetPosition(position     +
-						 (up * scale) +
-						 (direction * scale));
-			pCubeCamera->Target(position + (direction * scale),
-					    direction);
+			faceCamera.SetPosition(position     +
+					       (up * scale) +
+					       (direction * scale));
+			faceCamera.Target(position + (direction * scale),
+					  direction);
 			break;
 		case 3: // -Y
-			pCubeCamera->SetPosition(position      +
-						 (up * -scale) +
-						 (direction * scale));
-			pCubeCamera->Target(position + (direction * scale),
-					    -direction);
+			faceCamera.SetPosition(position      +
+					       (up * -scale) +
+					       (direction * scale));
+			faceCamera.Target(position + (direction * scale),
+					  -direction);
 			break;
 		case 4: // +Z
-			pCubeCamera->SetPosition(position);
+			faceCamera.SetPosition(position);
 			break;
 		case 5: // -Z
-			pCubeCamera->SetPosition(position +
-						 (direction * 2.f * scale));
+			faceCamera.SetPosition(position +
+					       (direction * 2.f * scale));
 			break;
 
 		}
 
-		pTargetScene->Render(pCubeCamera);
+		pTargetScene->Render(&faceCamera);
+
+		// the next face may draw into the same multisample target
+		ResolveFaces(1 << i);
+		m_faceTimers[i].End(FaceTimerTag(1 << i, m_faceLevels[i]));
 	}
+}
+
+void CubeRenderer::Prepare()
+{
+	PROFILE_ZONE("CubeRenderer::Prepare");
 
-	//restore... okay this really needs to move once working
-	pCubeCamera->SetPosition(position);
-	pCubeCamera->Target(target, up);
+	m_visibleMask = VisibleFaces();
+	FaceLevels(m_visibleMask);
+	FaceViewProjections(m_faceViewProjections);
+	m_prepared = true;
+}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void CubeRenderer::RenderCube(Scene *pTargetScene)
+{
+	PROFILE_ZONE("CubeRenderer::RenderCube");
+
+	if (m_prepared == false)
+		Prepare();
+	m_prepared = false;
+
+	uint32_t visibleMask = m_visibleMask;
+	uint32_t staleMask = StaleFaces(pTargetScene, visibleMask);
+	uint32_t faceMask = ScheduleFaces(pTargetScene, staleMask);
+
+	m_stats.facesRendered = CountFaces(faceMask);
+	m_stats.facesSkipped = NUM_SIDES - CountFaces(visibleMask);
+	m_stats.facesReused = CountFaces(visibleMask & ~staleMask);
+	m_stats.facesDeferred = CountFaces(staleMask & ~faceMask);
+	m_stats.facePixels = 0;
+	m_stats.facesMs = 0.0f;
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		if (faceMask & (1 << i))
+		{
+			uint32_t size = m_desc.faceSize >> m_faceLevels[i];
+			m_stats.facePixels += size * size;
+			m_stats.facesMs += m_stats.faceMs[i];
+		}
+	}
+
+	if (faceMask != 0)
+	{
+		uint32_t remaining = faceMask;
+
+		// each pass has its own timer, GL_TIME_ELAPSED queries can't nest
+		// one layered pass per distinct level, usually just one or two
+		while (bLayered != false && m_layeredFbo != 0 && remaining != 0)
+		{
+			uint32_t level = m_faceLevels[LowestFace(remaining)];
+			uint32_t group = 0;
+
+			for (uint8_t i=0; i < NUM_SIDES; ++i)
+			{
+				if ((remaining & (1 << i)) && m_faceLevels[i] == level)
+					group |= (1 << i);
+			}
+
+			GpuTimer* timer = &m_faceTimers[LowestFace(group)];
+			timer->Begin();
+			if (RenderFacesLayered(pTargetScene, group) == false)
+			{
+				// nothing drawn, the faces are timed again below
+				timer->End();
+				break;
+			}
+
+			ResolveFaces(group);
+			timer->End(FaceTimerTag(group, level));
+			remaining &= ~group;
+		}
+
+		if (remaining != 0)
+			RenderFaces(pTargetScene, remaining);
+
+		MarkFaces(pTargetScene, faceMask);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_outputFbo);
 	// resize...
 	glViewport(0,0,m_width,m_height);
 	
@@ -520,45 +1167,66 @@ void CubeRenderer::RenderCube(Scene *pTargetScene)
 	glEnable(GL_DEPTH_TEST);
 	glCullFace(GL_BACK);
 
-	glm::mat4 model = glm::translate(glm::vec3(0.0, 1.5, -5.0));
+	glm::mat4 model = glm::translate(m_centerPosition) * glm::scale(glm::vec3(m_extent));
 	glm::mat4 view = pAppCamera->View();
 	glm::mat4 model_view_projection = pAppCamera->Projection() * view * model;
 
 	glClear(GL_COLOR_BUFFER_BIT |
 		GL_DEPTH_BUFFER_BIT);
 
+	GLfloat lods[NUM_SIDES];
+	for (uint8_t i=0; i < NUM_SIDES; ++i)
+	{
+		lods[i] = static_cast<GLfloat>(m_faces[i].level);
+	}
+
 	glUseProgram(m_program);
 	glUniformMatrix4fv(world_uniform,
 			   1,
 			   GL_FALSE,
 			   glm::value_ptr(model_view_projection));
+	glUniform1fv(m_faceLodUniform,
+		     NUM_SIDES,
+		     lods);
 
 	//attach texture(s)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, m_color);
 
+	m_compositeTimer.Begin();
 	glBindVertexArray(m_vao);
 	glDrawElements(GL_TRIANGLES,
 		       36,
 		       GL_UNSIGNED_INT,
 		       nullptr);
 	glBindVertexArray(0);
+	m_compositeTimer.End();
 }
 
 void CubeRenderer::RenderScene(Scene *pTargetScene)
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_outputFbo);
 	// resize...
 	glViewport(0,0,m_width,m_height);
+
+	m_sceneTimer.Begin();
         pTargetScene->Render(pCubeCamera);
+	m_sceneTimer.End();
 }
 
 void CubeRenderer::Render(Scene *pTargetScene)
 {
+	if (pTargetScene->IsReady() == false && m_pPlaceholder != nullptr)
+		pTargetScene = m_pPlaceholder;
+
+	UpdateTimings();
+
 	if (bRenderCube != false)
 		RenderCube(pTargetScene);
 	else
 		RenderScene(pTargetScene);
+
+	m_prepared = false;
 }
 
 bool CubeRenderer::HandleInputEvent(SDL_Event event)
@@ -572,6 +1240,56 @@ bool CubeRenderer::HandleInputEvent(SDL_Event event)
 			this->bRenderCube = !this->bRenderCube;
 			result = true;
 			break;
+		case SDLK_l:
+			this->bLayered = !this->bLayered;
+			result = true;
+			break;
+		case SDLK_LEFTBRACKET:
+			if (m_desc.faceSize > 64) {
+				CubeTargetDesc desc = m_desc;
+				desc.faceSize /= 2;
+				SetTargetDesc(desc);
+			}
+			result = true;
+			break;
+		case SDLK_RIGHTBRACKET:
+			if (m_desc.faceSize < 4096) {
+				CubeTargetDesc desc = m_desc;
+				desc.faceSize *= 2;
+				SetTargetDesc(desc);
+			}
+			result = true;
+			break;
+		case SDLK_f:
+			this->bAdaptive = !this->bAdaptive;
+			result = true;
+			break;
+		case SDLK_COMMA:
+			SetFrameBudget(m_frameBudgetMs - 1.0f);
+			fprintf(stderr, "frame budget %.1f ms\n", m_frameBudgetMs);
+			result = true;
+			break;
+		case SDLK_PERIOD:
+			SetFrameBudget(m_frameBudgetMs + 1.0f);
+			fprintf(stderr, "frame budget %.1f ms\n", m_frameBudgetMs);
+			result = true;
+			break;
+		case SDLK_i:
+			fprintf(stderr, "faces rendered %u skipped %u reused %u deferred %u, %u face pixels\n",
+				m_stats.facesRendered, m_stats.facesSkipped, m_stats.facesReused,
+				m_stats.facesDeferred, m_stats.facePixels);
+			fprintf(stderr, "face refresh Hz %.1f %.1f %.1f %.1f %.1f %.1f, composite %.2f ms\n",
+				m_stats.faceRefreshHz[0], m_stats.faceRefreshHz[1],
+				m_stats.faceRefreshHz[2], m_stats.faceRefreshHz[3],
+				m_stats.faceRefreshHz[4], m_stats.faceRefreshHz[5],
+				m_stats.compositeMs);
+			fprintf(stderr, "face GPU ms %.2f %.2f %.2f %.2f %.2f %.2f, faces %.2f ms, scene %.2f ms\n",
+				m_stats.faceMs[0], m_stats.faceMs[1],
+				m_stats.faceMs[2], m_stats.faceMs[3],
+				m_stats.faceMs[4], m_stats.faceMs[5],
+				m_stats.facesMs, m_stats.sceneMs);
+			result = true;
+			break;
 		case SDLK_c:
 			if (this->pControlCamera == this->pAppCamera)
 				this->pControlCamera = this->pCubeCamera;
@@ -9,31 +9,129 @@
 #include "Camera.h"
 #include "Scene.h"
 #include "glutils.h"
+#include "GpuTimer.h"
 
-#define NUM_SIDES 6
+struct CubeStats
+{
+	uint32_t facesRendered;
+	uint32_t facesSkipped;
+	uint32_t facesReused;
+	uint32_t facesDeferred;		// stale but held back by the frame budget
+	uint32_t facePixels;
+	float faceMsPerPixel;		// measured GPU cost of face rendering
+	float faceMs[NUM_SIDES];	// measured GPU cost of each face's pass
+	float facesMs;			// of this frame's face passes, from faceMs
+	float compositeMs;		// measured GPU cost of drawing the cube
+	float sceneMs;			// measured GPU cost of the scene view, when shown instead
+	float faceRefreshHz[NUM_SIDES];
+};
+
+enum class CubeDepth {
+	Texture,	// layered depth target, allows single pass rendering
+	Renderbuffer,	// one face sized buffer shared by all faces, per-face passes only
+};
+
+// How the cube face render targets are allocated
+struct CubeTargetDesc
+{
+	uint32_t faceSize;
+	GLenum colorFormat;	// sized, color-renderable, non-integer format
+	CubeDepth depth;
+	uint32_t samples;	// > 1 renders multisampled and resolves into the cubemap
+
+	CubeTargetDesc() :
+		faceSize(512),
+		colorFormat(GL_RGBA8),
+		depth(CubeDepth::Texture),
+		samples(1) {}
+};
+
+// What a face texture currently holds
+struct CubeFaceState
+{
+	bool valid;
+	uint32_t level;
+	Scene *pScene;
+	uint64_t sceneGeneration;
+	uint64_t cameraGeneration;
+};
 
 class CubeRenderer
 {
 public:
-	CubeRenderer(uint32_t width, uint32_t height);
+	CubeRenderer(uint32_t width, uint32_t height, CubeTargetDesc desc = CubeTargetDesc());
 	~CubeRenderer();
 	void Resize(uint32_t width, uint32_t height);
+	// Falls back to the current targets if the new ones can't be allocated
+	GLResult SetTargetDesc(CubeTargetDesc desc);
+	const CubeTargetDesc& TargetDesc() const { return m_desc; }
+
+	// Target GPU frame time in ms, stale faces beyond it wait for a later
+	// frame. 0 renders every stale face.
+	void SetFrameBudget(float ms) { m_frameBudgetMs = (ms > 0.0f) ? ms : 0.0f; }
+	float FrameBudget() const { return m_frameBudgetMs; }
 	void Step(uint32_t stepMs);
+
+	// Face visibility, levels and projections for the next Render. CPU only
+	// and independent of the scene, so it can run while scenes step on the
+	// job system. Render prepares itself when this wasn't called.
+	void Prepare();
 	void Render(Scene *pTargetScene);
 
+	// View-projection of each face from the current cube camera, the
+	// transforms the face passes draw with
+	void FaceViewProjections(glm::mat4 *pFaces);
+
+	// Where the frame is drawn, 0 for the window
+	void SetOutputFramebuffer(GLuint fbo) { m_outputFbo = fbo; }
+
+	// Drawn instead of a target scene that is not IsReady, may be nullptr
+	void SetPlaceholder(Scene *pScene) { m_pPlaceholder = pScene; }
+	const CubeStats& Stats() const { return m_stats; }
+
+	// Scripted runs drive these instead of input
+	Camera *AppCamera() { return pAppCamera; }
+	Camera *CubeCamera() { return pCubeCamera; }
+	void SetRenderCube(bool bCube) { bRenderCube = bCube; }
+
 	bool HandleInputEvent(SDL_Event event);
 
 private:
 	GLResult Init();
+	GLResult AllocateTargets();
+	void ReleaseTargets();
+	void ResolveFaces(uint32_t faceMask);
+	void AttachFaceLevel(uint8_t face, uint32_t level);
 	void RenderCube(Scene *pTargetScene);
+	void RenderFaces(Scene *pTargetScene, uint32_t faceMask);
+	bool RenderFacesLayered(Scene *pTargetScene, uint32_t faceMask);
+	glm::mat4 CubeModelViewProjection();
+	uint32_t VisibleFaces();
+	void FaceLevels(uint32_t faceMask);
+	uint32_t StaleFaces(Scene *pTargetScene, uint32_t faceMask);
+	void MarkFaces(Scene *pTargetScene, uint32_t faceMask);
+	uint64_t FaceChange(Scene *pTargetScene, uint8_t face);
+	float FaceCost(uint8_t face);
+	uint32_t ScheduleFaces(Scene *pTargetScene, uint32_t faceMask);
+	void UpdateTimings();
+	void InvalidateFaces();
 	void RenderScene(Scene *pTargetScene);
        
 	// TODO general entities?
 	GLuint m_program;
-	GLuint m_vao, m_vbos[2], m_ibo;
+	GLuint m_vao, m_vbos[3], m_ibo;
+	GLint m_faceLodUniform;
+	CubeTargetDesc m_desc;
 	GLuint m_fbos[NUM_SIDES];
+	GLuint m_resolveFbos[NUM_SIDES];
+	GLuint m_layeredFbo;
+	GLuint m_faceUbo;
 	GLuint m_color;
-	GLuint m_depth;
+	GLuint m_depth;		// texture or renderbuffer, per m_desc.depth
+	GLuint m_msColor;	// multisampled draw target, 0 without MSAA
+	uint32_t m_maxLevel;
+	uint32_t m_attachedLevels[NUM_SIDES];
+	uint32_t m_layeredLevel;
 
 	uint32_t m_width, m_height;
 	bool persp;
@@ -41,7 +139,29 @@ private:
 	glm::vec3 m_centerPosition;
 	float m_extent;
 
+	CubeStats m_stats;
+	CubeFaceState m_faces[NUM_SIDES];
+	uint32_t m_faceLevels[NUM_SIDES];	// level each face is drawn at this frame
+	glm::mat4 m_faceViewProjections[NUM_SIDES];
+	uint32_t m_visibleMask;
+	bool m_prepared;			// the above are current for this frame
+
+	// GPU time of each pass, averaged as results arrive a few frames later.
+	// A layered pass is timed by its lowest face, tagged with FaceTimerTag.
+	GpuTimer m_faceTimers[NUM_SIDES];
+	GpuTimer m_compositeTimer;
+	GpuTimer m_sceneTimer;
+	float m_frameBudgetMs;
+	uint32_t m_faceAge[NUM_SIDES];		// frames a stale face has been waiting
+	uint32_t m_faceRefreshes[NUM_SIDES];
+	uint32_t m_refreshWindowStart;
+
 	bool bRenderCube;
+	bool bLayered;
+	bool bAdaptive;
+
+	Scene *m_pPlaceholder;
+	GLuint m_outputFbo;
 
 	Camera *pCubeCamera;
 	Camera *pAppCamera;
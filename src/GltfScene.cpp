@@ -6,6 +6,15 @@
 #include <tiny_gltf.h>
 
 #include <math.h>
+#include <algorithm>
+
+#include "MipKernels.h"
+#include "Profiler.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <glm/gtc/matrix_transform.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/fast_square_root.hpp>
@@ -15,40 +24,136 @@
 #include <glm/gtx/string_cast.hpp>
 
 
-GltfScene::GltfScene(const char* pFileName)
+GltfScene::GltfScene(const char* pFileName, JobSystem* pJobs, uint32_t instances, const char* pCacheDir)
 {
-	Init(pFileName);
+	m_pJobs = pJobs;
+	m_loadResult = GLResult::Success;
+	m_cacheDir = (pCacheDir != nullptr) ? pCacheDir : "";
+	m_sourceHash = 0;
+	m_baked = false;
+	m_ready = false;
+	m_program.program = 0;
+	m_layeredProgram.program = 0;
+	m_skinProgram = 0;
+	m_vertexBuffer = 0;
+	m_indexBuffer = 0;
+	m_animation = -1;
+	m_keepSoftTextures = false;
+	Init(pFileName, instances);
 }
 
 GltfScene::~GltfScene()
 {
-	glDeleteProgram(m_program);
+	// loading jobs write to the scene, let them run out first, the cache
+	// write included
+	WaitUntilLoaded();
+	if (m_releaseJob)
+		m_pJobs->Wait(m_releaseJob);
 
-	glDeleteVertexArrays(1, &m_vao);
+	glDeleteProgram(m_program.program);
+	glDeleteProgram(m_layeredProgram.program);
 
-	for (size_t i = 0; i < m_glBuffers.size(); ++i)
+	for (size_t i = 0; i < m_packets.size(); ++i)
 	{
-		GLBufferState* state = &m_glBuffers[i];
-		glDeleteBuffers(1, &state->buffer);
+		glDeleteVertexArrays(1, &m_packets[i].vao);
 	}
 
-	for (size_t i = 0; i < m_textures.size(); ++i)
+	glDeleteBuffers(1, &m_vertexBuffer);
+	glDeleteBuffers(1, &m_indexBuffer);
+
+	glDeleteProgram(m_skinProgram);
+
+	for (size_t i = 0; i < m_instances.size(); ++i)
 	{
-		glDeleteTextures(1, &m_textures[i]);
+		GltfInstance* instance = &m_instances[i];
+
+		glDeleteBuffers(instance->jointUbos.size(), instance->jointUbos.data());
+		glDeleteBuffers(instance->skinnedPositions.size(), instance->skinnedPositions.data());
+
+		for (size_t j = 0; j < instance->skinnedPackets.size(); ++j)
+		{
+			glDeleteVertexArrays(1, &instance->skinnedPackets[j].vao);
+		}
 	}
+
+	glDeleteTextures(m_textures.size(), m_textures.data());
 }
 
-GLResult GltfScene::Init(const char* pFileName)
+static uint32_t ReadU32(const unsigned char* pData)
 {
-	GLResult result = GLResult::Success;
+	uint32_t value;
+	memcpy(&value, pData, sizeof(value));
+	return value;
+}
+
+GLResult GltfScene::Load(const char* pFileName)
+{
+	GLResult result = m_file.Open(pFileName);
+
+	if (result != GLResult::Success)
+		return result;
+
+	if (m_file.Size() >= sizeof(uint32_t) && ReadU32(m_file.Data()) == BAKE_MAGIC)
+	{
+		result = LoadBake(0);
+		if (result != GLResult::Success)
+			fprintf(stderr, "[ERROR] %s is not a usable baked scene\n", pFileName);
+		return result;
+	}
+
+	// a bake of this exact file skips parsing, decoding and layout
+	if (m_cacheDir.empty() == false)
+	{
+		m_sourceHash = HashBytes(m_file.Data(), m_file.Size());
+
+		char name[32];
+		snprintf(name, sizeof(name), "/%016llx.bake", static_cast<unsigned long long>(m_sourceHash));
+		std::string cachePath = m_cacheDir + name;
+
+		if (access(cachePath.c_str(), R_OK) == 0)
+		{
+			m_file.Close();
+			if (m_file.Open(cachePath.c_str()) == GLResult::Success &&
+			    LoadBake(m_sourceHash) == GLResult::Success)
+				return GLResult::Success;
+
+			fprintf(stderr, "[WARN] Ignoring unusable cache %s\n", cachePath.c_str());
+			m_model = tinygltf::Model();
+			result = m_file.Open(pFileName);
+			if (result != GLResult::Success)
+				return result;
+		}
+	}
 
 	tinygltf::TinyGLTF loader;
 	std::string err;
 	std::string warn;
 	bool ret = true;
 
-	// detect gltf vs gltfb?
-	ret = loader.LoadASCIIFromFile(&m_model, &err, &warn, pFileName);
+	// images are decoded afterwards, in parallel
+	loader.SetImageLoader(DeferImage, this);
+
+	// relative uris resolve against the file's directory
+	std::string baseDir = pFileName;
+	size_t slash = baseDir.find_last_of('/');
+	baseDir = (slash == std::string::npos) ? "" : baseDir.substr(0, slash);
+
+	bool binary = (m_file.Size() >= GLB_HEADER_SIZE &&
+		       ReadU32(m_file.Data()) == GLB_MAGIC);
+
+	if (binary)
+	{
+		ret = loader.LoadBinaryFromMemory(&m_model, &err, &warn,
+						  m_file.Data(), m_file.Size(),
+						  baseDir);
+	}
+	else
+	{
+		ret = loader.LoadASCIIFromString(&m_model, &err, &warn,
+						 reinterpret_cast<const char*>(m_file.Data()),
+						 m_file.Size(),
+						 baseDir);
+	}
 
 	if (ret == false)
 	{
@@ -67,336 +172,1769 @@ GLResult GltfScene::Init(const char* pFileName)
 	}
 
 	if (result == GLResult::Success)
+		MapBuffers(binary);
+
+	if (binary == false)
+		m_file.Close();
+
+	return result;
+}
+
+// Point each buffer at its bytes, a .glb BIN chunk is used in place and
+// tinygltf's copy of it dropped
+void GltfScene::MapBuffers(bool binary)
+{
+	const unsigned char* pBin = nullptr;
+	size_t binSize = 0;
+
+	if (binary)
 	{
-		m_glBuffers.reserve(m_model.bufferViews.size());
+		const unsigned char* pData = m_file.Data();
+		size_t size = m_file.Size();
 
-		for (size_t i = 0; i < m_model.bufferViews.size(); ++i)
+		// JSON chunk always comes first, BIN is the optional second chunk
+		size_t offset = GLB_HEADER_SIZE;
+		if (offset + GLB_CHUNK_HEADER_SIZE <= size)
+			offset += GLB_CHUNK_HEADER_SIZE + ReadU32(pData + offset);
+
+		if (offset + GLB_CHUNK_HEADER_SIZE <= size &&
+		    ReadU32(pData + offset + 4) == GLB_CHUNK_BIN)
 		{
-			GLBufferState* state = &m_glBuffers[i];
-			const tinygltf::BufferView* bufferView = &m_model.bufferViews[i];
-			const tinygltf::Buffer*     buffer = &m_model.buffers[bufferView->buffer];
-			if (bufferView->target == 0) {
-				fprintf(stderr, "[WARN] bufferView target is %x is not supported", bufferView->target);
-				continue;
+			binSize = ReadU32(pData + offset);
+			pBin = pData + offset + GLB_CHUNK_HEADER_SIZE;
+			if (offset + GLB_CHUNK_HEADER_SIZE + binSize > size)
+			{
+				fprintf(stderr, "[WARN] GLB BIN chunk runs past the end of the file\n");
+				pBin = nullptr;
 			}
+		}
+	}
+
+	m_bufferData.resize(m_model.buffers.size());
 
-			state->target = bufferView->target;
+	for (size_t i = 0; i < m_model.buffers.size(); ++i)
+	{
+		tinygltf::Buffer* buffer = &m_model.buffers[i];
 
-			glGenBuffers(1, &state->buffer);
-			glBindBuffer(state->target, state->buffer);
-			glBufferData(state->target,
-				     bufferView->byteLength,
-				     &buffer->data[bufferView->byteOffset],
-				     GL_STATIC_DRAW);
-			glBindBuffer(state->target, 0);
+		if (i == 0 && pBin != nullptr &&
+		    buffer->uri.empty() &&
+		    buffer->data.size() <= binSize)
+		{
+			m_bufferData[i] = pBin;
+			std::vector<unsigned char>().swap(buffer->data);
+		}
+		else
+		{
+			m_bufferData[i] = buffer->data.data();
 		}
 	}
+}
 
-	if (result == GLResult::Success)
+// Model, buffers and image levels straight from the mapped bake
+GLResult GltfScene::LoadBake(uint64_t sourceHash)
+{
+	std::vector<BakeImage> images;
+	GLResult result = ReadBake(m_file.Data(), m_file.Size(), sourceHash,
+				   &m_model, &m_bufferData, &m_bufferSizes, &images);
+
+	if (result != GLResult::Success)
+		return result;
+
+	m_images.resize(images.size());
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		m_images[i].mipmapped = images[i].mipmapped;
+		m_images[i].width = images[i].width;
+		m_images[i].height = images[i].height;
+		m_images[i].levelData = images[i].levels;
+	}
+
+	m_baked = true;
+	return GLResult::Success;
+}
+
+// Runs once every image is decoded, written to a temporary name of its
+// own first so a partial file is never picked up, even with several
+// processes caching the same model
+void GltfScene::WriteCache()
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bake", static_cast<unsigned long long>(m_sourceHash));
+	std::string cachePath = m_cacheDir + name;
+
+	if (mkdir(m_cacheDir.c_str(), 0755) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "[WARN] Could not create cache directory %s: %s\n",
+			m_cacheDir.c_str(), strerror(errno));
+		return;
+	}
+
+	std::vector<char> tempName(cachePath.begin(), cachePath.end());
+	const char suffix[] = ".XXXXXX";
+	tempName.insert(tempName.end(), suffix, suffix + sizeof(suffix));
+
+	int fd = mkstemp(tempName.data());
+	if (fd < 0)
+	{
+		fprintf(stderr, "[WARN] Could not create a temporary file in %s: %s\n",
+			m_cacheDir.c_str(), strerror(errno));
+		return;
+	}
+	// mkstemp makes it private, the cache is shared like the directory
+	fchmod(fd, 0644);
+	close(fd);
+	std::string tempPath = tempName.data();
+
+	std::vector<GLenum> viewTargets(m_glBuffers.size());
+	for (size_t i = 0; i < m_glBuffers.size(); ++i)
+	{
+		viewTargets[i] = m_glBuffers[i].target;
+	}
+
+	std::vector<BakeImage> images(m_images.size());
+	for (size_t i = 0; i < m_images.size(); ++i)
+	{
+		images[i].mipmapped = m_images[i].mipmapped;
+		images[i].width = m_images[i].width;
+		images[i].height = m_images[i].height;
+		images[i].levels = m_images[i].levelData;
+	}
+
+	if (WriteBake(tempPath.c_str(), m_sourceHash, m_model, m_bufferData, viewTargets, images) != GLResult::Success)
+	{
+		unlink(tempPath.c_str());
+		return;
+	}
+
+	if (rename(tempPath.c_str(), cachePath.c_str()) != 0)
+	{
+		fprintf(stderr, "[WARN] Could not move %s into place\n", cachePath.c_str());
+		unlink(tempPath.c_str());
+	}
+}
+
+void GltfScene::Init(const char* pFileName, uint32_t instances)
+{
+	std::string fileName = pFileName;
+
+	// never on the main thread's deque, where a frame's Wait could run it
+	m_loadJob = m_pJobs->Run([this, fileName, instances]() {
+		LoadJob(fileName, instances);
+	}, JobQueue::Background);
+}
+
+// Parse on a worker, then queue the GL work as short JobQueue::Main jobs
+// the render thread runs a time slice of each frame, in submit order
+void GltfScene::LoadJob(const std::string& fileName, uint32_t instances)
+{
+	m_loadResult = Load(fileName.c_str());
+	if (m_loadResult != GLResult::Success)
 	{
-		m_textures.reserve(m_model.textures.size());
+		fprintf(stderr, "[ERROR] Could not load %s, scene stays empty\n", fileName.c_str());
+		return;
+	}
 
-		for (size_t i = 0; i < m_model.textures.size(); ++i)
+	// decode each image on its own, they are uploaded as they finish
+	std::vector<JobHandle> images;
+	if (m_baked == false)
+	{
+		images.resize(m_images.size());
+		for (size_t i = 0; i < m_images.size(); ++i)
 		{
-			tinygltf::Texture* texture = &m_model.textures[i];
-			GLuint* textureId = &m_textures[i];
+			// done once the image and its mip chain are, submitted by DecodeImage
+			JobHandle done = m_pJobs->Create([]() {}, JobQueue::Background);
+			images[i] = done;
+			m_pJobs->Run([this, i, done]() { DecodeImage(i, done); }, JobQueue::Background);
+		}
+	}
 
-			glGenTextures(1, textureId);
-			glBindTexture(GL_TEXTURE_2D, *textureId);
+	JobHandle nodes = m_pJobs->Create([this]() { FlattenNodes(); }, JobQueue::Background);
+	JobHandle skins = m_pJobs->Create([this]() { BuildSkins(); }, JobQueue::Background);
+	JobHandle animations = m_pJobs->Create([this]() { BuildAnimations(); }, JobQueue::Background);
 
-			tinygltf::Image* image = &m_model.images[texture->source];
+	m_pJobs->AddDependency(skins, nodes);
+	m_pJobs->AddDependency(animations, nodes);
+	m_pJobs->Submit(skins);
+	m_pJobs->Submit(animations);
+	m_pJobs->Submit(nodes);
 
-			GLenum format = GL_RGBA;
-			if (image->component == 3) {
-				format = GL_RGB;
-			}
+	size_t vertexSize;
+	size_t indexSize;
+	LayoutBuffers(&vertexSize, &indexSize);
 
-			glTexImage2D(GL_TEXTURE_2D,
-				     0,
-				     format,
-				     image->width,
-				     image->height,
-				     0,
-				     format,
-				     image->pixel_type,
-				     &image->image.at(0));
+	m_pJobs->Run([this, vertexSize, indexSize]() {
+		CreateArenas(vertexSize, indexSize);
+	}, JobQueue::Main);
 
+	// baked arenas are already packed, upload them whole
+	for (size_t offset = 0; m_baked && offset < vertexSize; offset += UPLOAD_CHUNK_SIZE)
+	{
+		size_t size = std::min<size_t>(UPLOAD_CHUNK_SIZE, vertexSize - offset);
+		m_pJobs->Run([this, offset, size]() {
+			UploadArenaRange(GL_ARRAY_BUFFER, offset, size);
+		}, JobQueue::Main);
+	}
 
-			if (texture->sampler < 0)
-			{
-				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			} else {
-				tinygltf::Sampler* sampler = &m_model.samplers[texture->sampler];
-				glTexParameterf(GL_TEXTURE_2D,
-						GL_TEXTURE_MIN_FILTER,
-						sampler->minFilter);
-				glTexParameterf(GL_TEXTURE_2D,
-						GL_TEXTURE_MAG_FILTER,
-						sampler->magFilter);
-				glTexParameterf(GL_TEXTURE_2D,
-						GL_TEXTURE_WRAP_S,
-						sampler->wrapS);
-				glTexParameterf(GL_TEXTURE_2D,
-						GL_TEXTURE_WRAP_T,
-						sampler->wrapT);
-
-				if ((sampler->minFilter == GL_NEAREST_MIPMAP_NEAREST) ||
-				    (sampler->minFilter == GL_NEAREST_MIPMAP_LINEAR) ||
-				    (sampler->minFilter == GL_LINEAR_MIPMAP_NEAREST) ||
-				    (sampler->minFilter == GL_LINEAR_MIPMAP_LINEAR))
-				{
-					glGenerateMipmap(GL_TEXTURE_2D);		
-				}
-			}
+	for (size_t offset = 0; m_baked && offset < indexSize; offset += UPLOAD_CHUNK_SIZE)
+	{
+		size_t size = std::min<size_t>(UPLOAD_CHUNK_SIZE, indexSize - offset);
+		m_pJobs->Run([this, offset, size]() {
+			UploadArenaRange(GL_ELEMENT_ARRAY_BUFFER, offset, size);
+		}, JobQueue::Main);
+	}
 
-			glBindTexture(GL_TEXTURE_2D, 0);
+	for (size_t i = 0; m_baked == false && i < m_glBuffers.size(); ++i)
+	{
+		if (m_glBuffers[i].target != GL_ARRAY_BUFFER &&
+		    m_glBuffers[i].target != GL_ELEMENT_ARRAY_BUFFER)
+			continue;
+
+		size_t length = m_model.bufferViews[i].byteLength;
+
+		for (size_t offset = 0; offset < length; offset += UPLOAD_CHUNK_SIZE)
+		{
+			size_t size = std::min<size_t>(UPLOAD_CHUNK_SIZE, length - offset);
+
+			m_pJobs->Run([this, i, offset, size]() {
+				UploadBufferRange(i, offset, size);
+			}, JobQueue::Main);
 		}
 	}
 
-	if (result == GLResult::Success)
+	// names exist up front so packets can be built before the images decode
+	m_textures.assign(m_model.textures.size(), 0);
+	m_pJobs->Run([this]() {
+		glGenTextures(m_textures.size(), m_textures.data());
+	}, JobQueue::Main);
+
+	for (size_t i = 0; i < m_model.textures.size(); ++i)
 	{
-		glGenVertexArrays(1, &m_vao);
+		JobHandle upload = m_pJobs->Create([this, i]() { UploadTexture(i); }, JobQueue::Main);
+		int source = m_model.textures[i].source;
+
+		if (source >= 0 && static_cast<size_t>(source) < images.size())
+			m_pJobs->AddDependency(upload, images[source]);
+		m_pJobs->Submit(upload);
+	}
 
-		//when rendering, iterate nodes and follow references to meshes and such
-		GLuint vs, fs;
+	m_pJobs->Run([this]() {
+		m_loadResult = InitProgram(vs_src, nullptr, &m_program);
+		if (m_loadResult == GLResult::Success)
+			m_loadResult = InitProgram(layered_vs_src, layered_gs_src, &m_layeredProgram);
+	}, JobQueue::Main);
 
-		result = CompileShader(vs_src, GL_VERTEX_SHADER, &vs);
-		result = CompileShader(fs_src, GL_FRAGMENT_SHADER, &fs);
-		result = LinkProgram(vs, fs, &m_program);
+	m_pJobs->Run([this]() { BuildPackets(); }, JobQueue::Main);
 
-		glDeleteShader(vs);
-		glDeleteShader(fs);
+	// queued after every upload, and waits for the CPU tables
+	JobHandle finish = m_pJobs->Create([this, instances]() {
+		FinishLoad(instances);
+	}, JobQueue::Main);
 
-		glBindFragDataLocation(m_program,
-				       0,
-				       "out_color");
+	m_pJobs->AddDependency(finish, skins);
+	m_pJobs->AddDependency(finish, animations);
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		m_pJobs->AddDependency(finish, images[i]);
 	}
-	
-	return result;
+
+	// the decoded levels are released once uploaded and baked, the scene
+	// is ready without waiting for the cache write
+	JobHandle release = m_pJobs->Create([this]() {
+		std::vector<GltfImageData>().swap(m_images);
+	}, JobQueue::Background);
+	m_pJobs->AddDependency(release, finish);
+
+	if (m_baked == false && m_cacheDir.empty() == false)
+	{
+		JobHandle bake = m_pJobs->Create([this]() { WriteCache(); }, JobQueue::Background);
+		for (size_t i = 0; i < images.size(); ++i)
+		{
+			m_pJobs->AddDependency(bake, images[i]);
+		}
+		m_pJobs->AddDependency(release, bake);
+		m_pJobs->Submit(bake);
+	}
+	m_finishJob = finish;
+	m_releaseJob = release;
+	m_pJobs->Submit(finish);
+	m_pJobs->Submit(release);
 }
 
-void GltfScene::Step(uint32_t stepMs)
+void GltfScene::WaitUntilLoaded()
+{
+	// the finish job is created by the load job
+	m_pJobs->Wait(m_loadJob);
+	if (m_finishJob)
+		m_pJobs->Wait(m_finishJob);
+}
+
+void GltfScene::FinishLoad(uint32_t instances)
 {
+	if (m_keepSoftTextures)
+		CopySoftTextures();
+
+	if (m_loadResult != GLResult::Success)
+		return;
+
+	BuildInstances(instances);
+	BuildSkinnedMeshes();
 
+	m_ready = true;
+	m_generation++;
+
+	if (m_animations.empty() == false)
+		NextAnimation();
 }
 
-inline char* strlwr(const char* c_string)
+
+// Pack every bufferView used for drawing into a vertex or an index arena
+void GltfScene::LayoutBuffers(size_t* pVertexSize, size_t* pIndexSize)
 {
-	char* lowerString = reinterpret_cast<char*>(malloc(strlen(c_string)));
+	m_glBuffers.resize(m_model.bufferViews.size());
+
+	// baked views were packed when written, and carry their target
+	if (m_baked)
+	{
+		for (size_t i = 0; i < m_model.bufferViews.size(); ++i)
+		{
+			m_glBuffers[i].buffer = 0;
+			m_glBuffers[i].target = m_model.bufferViews[i].target;
+			m_glBuffers[i].offset = m_model.bufferViews[i].byteOffset;
+		}
+
+		*pVertexSize = m_bufferSizes[BAKE_VERTEX_BUFFER];
+		*pIndexSize = m_bufferSizes[BAKE_INDEX_BUFFER];
+		return;
+	}
 
-	char* p = lowerString;
+	std::vector<GLenum> targets;
+	InferViewTargets(m_model, &targets);
 
-	while (*c_string != '\0')
+	for (size_t i = 0; i < m_model.bufferViews.size(); ++i)
 	{
-		*p = tolower(*c_string);
-		++p;
-		++c_string;
+		m_glBuffers[i].buffer = 0;
+		m_glBuffers[i].target = targets[i];
+		m_glBuffers[i].offset = 0;
 	}
 
-	return lowerString;
+	*pVertexSize = 0;
+	*pIndexSize = 0;
+
+	for (size_t i = 0; i < m_model.bufferViews.size(); ++i)
+	{
+		GLBufferState* state = &m_glBuffers[i];
+		size_t* size = nullptr;
+
+		if (state->target == GL_ARRAY_BUFFER)
+			size = pVertexSize;
+		else if (state->target == GL_ELEMENT_ARRAY_BUFFER)
+			size = pIndexSize;
+		else
+			continue;
+
+		state->offset = (*size + BUFFER_ARENA_ALIGNMENT - 1) & ~static_cast<size_t>(BUFFER_ARENA_ALIGNMENT - 1);
+		*size = state->offset + m_model.bufferViews[i].byteLength;
+	}
 }
 
-void GltfScene::DrawMesh(const tinygltf::Mesh* mesh, glm::mat4 transform)
+void GltfScene::CreateArenas(size_t vertexSize, size_t indexSize)
 {
-	GLint world_uniform = glGetUniformLocation(m_program, "world");
-	if (world_uniform == -1) {
-		fprintf(stderr, "[ERROR] could not get uniform location\n");
-	}
+	glGenBuffers(1, &m_vertexBuffer);
+	glGenBuffers(1, &m_indexBuffer);
 
-	GLint color_factor_uniform = glGetUniformLocation(m_program, "color_factor");
-	if (world_uniform == -1) {
-		fprintf(stderr, "[ERROR] could not get uniform location\n");
-	}
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertexSize, nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, m_indexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, indexSize, nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	GLint color_tex_uniform = glGetUniformLocation(m_program, "color_texture");
-	if (world_uniform == -1) {
-		fprintf(stderr, "[ERROR] could not get uniform location\n");
+	for (size_t i = 0; i < m_glBuffers.size(); ++i)
+	{
+		GLBufferState* state = &m_glBuffers[i];
+
+		if (state->target == GL_ARRAY_BUFFER)
+			state->buffer = m_vertexBuffer;
+		else if (state->target == GL_ELEMENT_ARRAY_BUFFER)
+			state->buffer = m_indexBuffer;
 	}
+}
 
+// Sub-uploads go through GL_ARRAY_BUFFER, binding GL_ELEMENT_ARRAY_BUFFER
+// would change whatever VAO is bound
+void GltfScene::UploadBufferRange(size_t view, size_t offset, size_t size)
+{
+	const GLBufferState* state = &m_glBuffers[view];
+	const tinygltf::BufferView* bufferView = &m_model.bufferViews[view];
+	const unsigned char* pData = m_bufferData[bufferView->buffer];
+
+	glBindBuffer(GL_ARRAY_BUFFER, state->buffer);
+	glBufferSubData(GL_ARRAY_BUFFER,
+			state->offset + offset,
+			size,
+			pData + bufferView->byteOffset + offset);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-	glUniformMatrix4fv(world_uniform,
-			   1,
-			   GL_FALSE,
-			   glm::value_ptr(transform));
+// tinygltf image callback, runs on the parsing thread and only keeps a copy
+// of the encoded bytes, which may point into buffers dropped after parsing
+bool GltfScene::DeferImage(tinygltf::Image* image, const int imageIndex,
+			   std::string* err, std::string* warn,
+			   int reqWidth, int reqHeight,
+			   const unsigned char* bytes, int size, void* pUser)
+{
+	GltfScene* scene = static_cast<GltfScene*>(pUser);
 
-	// loop primitives, assembling draws
-	for (size_t i = 0; i < mesh->primitives.size(); ++i)
+	if (imageIndex < 0)
+		return false;
+
+	if (static_cast<size_t>(imageIndex) >= scene->m_images.size())
+		scene->m_images.resize(imageIndex + 1);
+
+	GltfImageData* data = &scene->m_images[imageIndex];
+	data->encoded.assign(bytes, bytes + size);
+	data->mipmapped = false;
+	data->width = 0;
+	data->height = 0;
+
+	return true;
+}
+
+// Decode to RGBA8 and build the mip chain if any texture samples it
+void GltfScene::DecodeImage(size_t image, const JobHandle& done)
+{
+	GltfImageData* data = &m_images[image];
+
+	data->mipmapped = ImageMipmapped(m_model, image);
+
+	int width, height, components;
+	unsigned char* pPixels = stbi_load_from_memory(data->encoded.data(),
+						       data->encoded.size(),
+						       &width, &height, &components, 4);
+	std::vector<unsigned char>().swap(data->encoded);
+
+	if (pPixels == nullptr)
 	{
-		glBindVertexArray(m_vao);
-		const tinygltf::Primitive* primitive = &mesh->primitives[i];
-		// handle material
-		// glUseProgram?
-		// uniforms, textures, samplers?
-		if (primitive->material >= 0)
-		{
-			tinygltf::Material* material = &m_model.materials[primitive->material];
+		fprintf(stderr, "[ERROR] Could not decode image %zu: %s\n",
+			image, stbi_failure_reason());
+		m_pJobs->Submit(done);
+		return;
+	}
 
-			/* Yay PBR? */
-			if (material->values.find("baseColorFactor") != material->values.end())
-			{
-			} else {
-				glUniform4f(color_factor_uniform,
-					    0., 0., 0., 0.);
-			}
+	data->width = width;
+	data->height = height;
+	data->levels.resize(data->mipmapped ? MipLevelCount(width, height) : 1);
+	data->levels[0].assign(pPixels, pPixels + 4 * static_cast<size_t>(width) * height);
+	stbi_image_free(pPixels);
 
-			if (material->values.find("baseColorTexture") != material->values.end())
-			{
-				tinygltf::Parameter* texParam = &material->values["baseColorTexture"];
+	tinygltf::Image* source = &m_model.images[image];
+	source->width = width;
+	source->height = height;
+	source->component = 4;
+	source->bits = 8;
+	source->pixel_type = GL_UNSIGNED_BYTE;
 
-				int texIdx = texParam->TextureIndex();
-				if (texIdx >= 0 ||
-				    texIdx < m_textures.size())
-				{
-					glActiveTexture(GL_TEXTURE1);
-					glBindTexture(GL_TEXTURE_2D, m_textures[texIdx]);
-					glUniform1i(color_tex_uniform,
-						    1);
-				} else {
-					glUniform1i(color_tex_uniform, 0);
-				}
+	// every level is allocated up front, so the jobs below can fill them
+	uint32_t levelWidth = width;
+	uint32_t levelHeight = height;
 
-				//todo tex coord match?
-					
-			} else {
-				glUniform1i(color_tex_uniform,
-					    0);
-			}
+	for (size_t level = 1; level < data->levels.size(); ++level)
+	{
+		levelWidth = MipSize(levelWidth);
+		levelHeight = MipSize(levelHeight);
+		data->levels[level].resize(4 * static_cast<size_t>(levelWidth) * levelHeight);
+	}
 
-		}
-		
-		// handle attributes
-		for (std::map<std::string, int>::const_iterator it = primitive->attributes.begin(); it != primitive->attributes.end(); ++it)
-		{
-		        char* attributeName = strlwr(it->first.c_str());
+	for (size_t level = 0; level < data->levels.size(); ++level)
+	{
+		data->levelData.push_back(data->levels[level].data());
+	}
 
-			GLint location = glGetAttribLocation(m_program, attributeName);
-			if (location == -1) {
-				//fprintf(stderr, "[WARN] draw has unused attribute: %s\n", attributeName);
-				free(attributeName);
-				continue;
-			}
-			free(attributeName);
+	// large levels are split into background jobs of rows, each level
+	// after the one it reads, and done waits for the last of them. The
+	// small levels at the end of the chain are built here or in one job.
+	JobHandle previous;
+	size_t level = 1;
+	levelWidth = width;
+	levelHeight = height;
 
-			tinygltf::Accessor* accessor = &m_model.accessors[it->second];
-			tinygltf::BufferView* bufferView = &m_model.bufferViews[accessor->bufferView];
-			GLBufferState* state = &m_glBuffers[accessor->bufferView];
+	for (; level < data->levels.size(); ++level)
+	{
+		uint32_t srcWidth = levelWidth;
+		uint32_t srcHeight = levelHeight;
+		levelWidth = MipSize(levelWidth);
+		levelHeight = MipSize(levelHeight);
 
-			if (state->target != GL_ARRAY_BUFFER)
-				continue;
+		if (static_cast<size_t>(levelWidth) * levelHeight <= MIP_TILE_PIXELS)
+		{
+			levelWidth = srcWidth;
+			levelHeight = srcHeight;
+			break;
+		}
 
-			glBindBuffer(GL_ARRAY_BUFFER, state->buffer);
-			
-			glEnableVertexAttribArray(location);
-			glVertexAttribPointer(location,
-					      tinygltf::GetTypeSizeInBytes(static_cast<uint32_t>(accessor->type)),
-					      accessor->componentType,
-					      accessor->normalized ? GL_TRUE : GL_FALSE,
-					      bufferView->byteStride,
-					      nullptr);
+		const unsigned char* pSrc = data->levels[level - 1].data();
+		unsigned char* pDst = data->levels[level].data();
+		uint32_t rows = std::max<uint32_t>(1, MIP_TILE_PIXELS / levelWidth);
+		JobHandle barrier = m_pJobs->Create([]() {}, JobQueue::Background);
 
+		for (uint32_t begin = 0; begin < levelHeight; begin += rows)
+		{
+			uint32_t end = std::min(levelHeight, begin + rows);
+			JobHandle chunk = m_pJobs->Create([=]() {
+				DownsampleRGBA8(pSrc, srcWidth, srcHeight, pDst, begin, end);
+			}, JobQueue::Background);
+
+			if (previous)
+				m_pJobs->AddDependency(chunk, previous);
+			m_pJobs->AddDependency(barrier, chunk);
+			m_pJobs->Submit(chunk);
 		}
-		
-		if (primitive->indices < 0)
+
+		m_pJobs->Submit(barrier);
+		previous = barrier;
+	}
+
+	if (level < data->levels.size())
+	{
+		size_t first = level;
+		auto buildTail = [data, first, levelWidth, levelHeight]() {
+			uint32_t srcWidth = levelWidth;
+			uint32_t srcHeight = levelHeight;
+
+			for (size_t i = first; i < data->levels.size(); ++i)
+			{
+				DownsampleRGBA8(data->levels[i - 1].data(), srcWidth, srcHeight,
+						data->levels[i].data(), 0, MipSize(srcHeight));
+				srcWidth = MipSize(srcWidth);
+				srcHeight = MipSize(srcHeight);
+			}
+		};
+
+		if (previous)
 		{
-			tinygltf::Accessor* accessor = &m_model.accessors[primitive->attributes.begin()->second];
-			// accessor would already have offset t start
-			glDrawArrays(primitive->mode, 0, accessor->count);
+			JobHandle tail = m_pJobs->Create(buildTail, JobQueue::Background);
+			m_pJobs->AddDependency(tail, previous);
+			m_pJobs->Submit(tail);
+			previous = tail;
 		}
 		else
 		{
-			tinygltf::Accessor* accessor = &m_model.accessors[primitive->indices];
-			GLBufferState* state = &m_glBuffers[accessor->bufferView];
-			if (state->target != GL_ELEMENT_ARRAY_BUFFER)
-				fprintf(stderr, "[WARN] Buffer used for indicies that isn't marked as element array buffer target\n");
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state->buffer);
-			GLenum mode = (primitive->mode < 0) ? GL_TRIANGLES : primitive->mode;
-			glDrawElements(mode,
-				       accessor->count,
-				       accessor->componentType,
-				       static_cast<void*>(NULL) + accessor->byteOffset);
+			// nothing large to wait for, finish the chain in this job
+			buildTail();
 		}
-		glBindVertexArray(0); 
 	}
+
+	if (previous)
+		m_pJobs->AddDependency(done, previous);
+	m_pJobs->Submit(done);
 }
 
-void GltfScene::DrawNode(tinygltf::Node* node, glm::mat4 parent_transform)
+void GltfScene::UploadArenaRange(GLenum target, size_t offset, size_t size)
 {
-	glm::mat4 local_transform = glm::mat4(1.0f);
-	if (node->matrix.size() == 16)
+	bool index = (target == GL_ELEMENT_ARRAY_BUFFER);
+
+	glBindBuffer(GL_ARRAY_BUFFER, index ? m_indexBuffer : m_vertexBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER,
+			offset,
+			size,
+			m_bufferData[index ? BAKE_INDEX_BUFFER : BAKE_VERTEX_BUFFER] + offset);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GltfScene::UploadTexture(size_t texture)
+{
+	tinygltf::Texture* pTexture = &m_model.textures[texture];
+
+	if (pTexture->source < 0 ||
+	    static_cast<size_t>(pTexture->source) >= m_images.size() ||
+	    m_images[pTexture->source].levelData.empty())
+		return;
+
+	GltfImageData* image = &m_images[pTexture->source];
+	bool mipmapped = false;
+
+	glBindTexture(GL_TEXTURE_2D, m_textures[texture]);
+
+	if (pTexture->sampler < 0)
 	{
-		local_transform = glm::make_mat4(node->matrix.data());
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	} else {
+		tinygltf::Sampler* sampler = &m_model.samplers[pTexture->sampler];
+		glTexParameterf(GL_TEXTURE_2D,
+				GL_TEXTURE_MIN_FILTER,
+				sampler->minFilter);
+		glTexParameterf(GL_TEXTURE_2D,
+				GL_TEXTURE_MAG_FILTER,
+				sampler->magFilter);
+		glTexParameterf(GL_TEXTURE_2D,
+				GL_TEXTURE_WRAP_S,
+				sampler->wrapS);
+		glTexParameterf(GL_TEXTURE_2D,
+				GL_TEXTURE_WRAP_T,
+				sampler->wrapT);
+
+		mipmapped = MipmapFilter(sampler->minFilter);
 	}
-	else
+
+	// levels were built by DecodeImage, nothing is generated on the driver
+	uint32_t levels = mipmapped ? image->levelData.size() : 1;
+	uint32_t width = image->width;
+	uint32_t height = image->height;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+	for (uint32_t level = 0; level < levels; ++level)
 	{
-		if (node->scale.size() == 3)
-			local_transform = glm::scale(glm::vec3(
-							     node->scale[0],
-							     node->scale[1],
-							     node->scale[2]))
-				* local_transform;
-		if (node->rotation.size() == 4)
-			local_transform = glm::mat4_cast(glm::quat(node->rotation[3],
-								   node->rotation[0],
-								   node->rotation[1],
-								   node->rotation[2]))
-				* local_transform;
-		if (node->translation.size() == 3)
-			local_transform = glm::translate(
-				glm::vec3(
-					node->translation[0],
-					node->translation[1],
-					node->translation[2])) * local_transform;
+		glTexImage2D(GL_TEXTURE_2D,
+			     level,
+			     GL_RGBA,
+			     width,
+			     height,
+			     0,
+			     GL_RGBA,
+			     GL_UNSIGNED_BYTE,
+			     image->levelData[level]);
+
+		width = MipSize(width);
+		height = MipSize(height);
 	}
 
-	local_transform = parent_transform * local_transform;
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GLResult GltfScene::InitProgram(const char* vs_source, const char* gs_source, GltfProgram* pProgram)
+{
+	GLResult result = GLResult::Success;
+	GLuint vs, gs = 0, fs;
+
+	result = CompileShader(vs_source, GL_VERTEX_SHADER, &vs);
+	if (gs_source != nullptr)
+		result = CompileShader(gs_source, GL_GEOMETRY_SHADER, &gs);
+	result = CompileShader(fs_src, GL_FRAGMENT_SHADER, &fs);
+	result = LinkProgram(vs, gs, fs, &pProgram->program);
+
+	glDeleteShader(vs);
+	if (gs != 0)
+		glDeleteShader(gs);
+	glDeleteShader(fs);
 
-	if (node->mesh >= 0)
+	glBindFragDataLocation(pProgram->program,
+			       0,
+			       "out_color");
+
+	if (gs_source != nullptr)
 	{
-		tinygltf::Mesh* mesh = &m_model.meshes[node->mesh];
-		DrawMesh(mesh, local_transform);
+		GLuint faces_block = glGetUniformBlockIndex(pProgram->program, "CubeFaces");
+		glUniformBlockBinding(pProgram->program, faces_block, CUBE_FACES_BINDING);
 	}
 
-	for (size_t i = 0; i < node->children.size(); ++i)
-	{
-		int nodeId = node->children[i];
-		if (nodeId < m_model.nodes.size())
-		{
-			tinygltf::Node* node = &m_model.nodes[nodeId];
-			DrawNode(node, local_transform);
-		}
-		else
-		{
-			fprintf(stderr, "[ERROR] Child ID out of bound %u [bounds %u]",
-				nodeId, m_model.nodes.size());
-		}
+	pProgram->world = glGetUniformLocation(pProgram->program, "world");
+	if (pProgram->world == -1) {
+		fprintf(stderr, "[ERROR] could not get uniform location\n");
 	}
+
+	// unused by the current shaders, location is -1 and uploads are ignored
+	pProgram->colorFactor = glGetUniformLocation(pProgram->program, "color_factor");
+
+	// base color textures are always bound to unit 1
+	pProgram->colorTexture = glGetUniformLocation(pProgram->program, "color_texture");
+	glUseProgram(pProgram->program);
+	glUniform1i(pProgram->colorTexture, 1);
+	glUseProgram(0);
+
+	return result;
 }
 
-void GltfScene::Render(Camera* pCamera)
+void GltfScene::BuildPackets()
 {
-	glClearColor(0.2, 0.2, 0.2, 0.2);
-	glEnable(GL_DEPTH_TEST);
-	glCullFace(GL_BACK);
+	m_meshPackets.resize(m_model.meshes.size());
 
-	glClear(GL_COLOR_BUFFER_BIT |
-		GL_DEPTH_BUFFER_BIT);
+	for (size_t i = 0; i < m_model.meshes.size(); ++i)
+	{
+		const tinygltf::Mesh* mesh = &m_model.meshes[i];
 
+		m_meshPackets[i].first = m_packets.size();
+		m_meshPackets[i].count = mesh->primitives.size();
 
-	glm::mat4 view_project = pCamera->Projection() * pCamera->View();
+		for (size_t j = 0; j < mesh->primitives.size(); ++j)
+		{
+			GltfDrawPacket packet;
+			BuildPacket(&mesh->primitives[j], 0, &packet);
+			m_packets.push_back(packet);
+		}
+	}
+}
 
-	glUseProgram(m_program);
+static int AttributeLocation(const std::string& semantic)
+{
+	std::string name = semantic;
+	for (size_t i = 0; i < name.size(); ++i)
+	{
+		name[i] = tolower(name[i]);
+	}
 
-	unsigned int scene = (m_model.defaultScene < 0) ? 0 : m_model.defaultScene;
+	for (int i = 0; i < NUM_ATTRIBUTES; ++i)
+	{
+		if (name == attribute_names[i])
+			return i;
+	}
+
+	return -1;
+}
 
-	if (m_model.scenes.size() >= scene)
+// positions, when not 0, replaces the POSITION attribute with tightly
+// packed world space positions from the skinning pass
+void GltfScene::BuildPacket(const tinygltf::Primitive* primitive, GLuint positions, GltfDrawPacket* packet)
+{
+	packet->mode = (primitive->mode < 0) ? GL_TRIANGLES : primitive->mode;
+	packet->count = 0;
+	packet->indexType = 0;
+	packet->indexOffset = 0;
+	packet->texture = 0;
+	packet->colorFactor = glm::vec4(1.0f);
+
+	if (primitive->material >= 0)
 	{
-		for (size_t i = 0; i < m_model.scenes[scene].nodes.size(); ++i)
+		tinygltf::Material* material = &m_model.materials[primitive->material];
+
+		tinygltf::ParameterMap::const_iterator factor = material->values.find("baseColorFactor");
+		if (factor != material->values.end() &&
+		    factor->second.number_array.size() == 4)
 		{
-			int nodeId = m_model.scenes[scene].nodes[i];
-			DrawNode(&m_model.nodes[nodeId], view_project);
+			const std::vector<double>* color = &factor->second.number_array;
+			packet->colorFactor = glm::vec4((*color)[0], (*color)[1],
+							(*color)[2], (*color)[3]);
 		}
-	}
+
+		tinygltf::ParameterMap::const_iterator texParam = material->values.find("baseColorTexture");
+		if (texParam != material->values.end())
+		{
+			int texIdx = texParam->second.TextureIndex();
+			if (texIdx >= 0 &&
+			    texIdx < m_textures.size())
+			{
+				packet->texture = m_textures[texIdx];
+			}
+
+			//todo tex coord match?
+		}
+	}
+
+	glGenVertexArrays(1, &packet->vao);
+	glBindVertexArray(packet->vao);
+
+	for (std::map<std::string, int>::const_iterator it = primitive->attributes.begin(); it != primitive->attributes.end(); ++it)
+	{
+		const tinygltf::Accessor* accessor = &m_model.accessors[it->second];
+
+		// every attribute has the same count, use whichever comes first
+		if (packet->count == 0)
+			packet->count = accessor->count;
+
+		int location = AttributeLocation(it->first);
+		if (location == -1) {
+			//fprintf(stderr, "[WARN] draw has unused attribute: %s\n", it->first.c_str());
+			continue;
+		}
+
+		if (location == 0 && positions != 0)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, positions);
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+			continue;
+		}
+
+		if (accessor->bufferView < 0)
+			continue;
+
+		const tinygltf::BufferView* bufferView = &m_model.bufferViews[accessor->bufferView];
+		const GLBufferState* state = &m_glBuffers[accessor->bufferView];
+
+		if (state->target != GL_ARRAY_BUFFER)
+			continue;
+
+		glBindBuffer(GL_ARRAY_BUFFER, state->buffer);
+
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location,
+				      tinygltf::GetTypeSizeInBytes(static_cast<uint32_t>(accessor->type)),
+				      accessor->componentType,
+				      accessor->normalized ? GL_TRUE : GL_FALSE,
+				      bufferView->byteStride,
+				      reinterpret_cast<const void*>(state->offset + accessor->byteOffset));
+	}
+
+	if (primitive->indices >= 0)
+	{
+		const tinygltf::Accessor* accessor = &m_model.accessors[primitive->indices];
+		const GLBufferState* state = &m_glBuffers[accessor->bufferView];
+		if (state->target != GL_ELEMENT_ARRAY_BUFFER)
+			fprintf(stderr, "[WARN] Buffer used for indicies that isn't marked as element array buffer target\n");
+
+		// element buffer binding is VAO state
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state->buffer);
+
+		packet->count = accessor->count;
+		packet->indexType = accessor->componentType;
+		packet->indexOffset = state->offset + accessor->byteOffset;
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void GltfScene::FlattenNodes()
+{
+	m_nodeIndex.assign(m_model.nodes.size(), -1);
+
+	unsigned int scene = (m_model.defaultScene < 0) ? 0 : m_model.defaultScene;
+
+	if (scene >= m_model.scenes.size())
+		return;
+
+	// breadth first, each level is appended after the one holding its parents
+	for (size_t i = 0; i < m_model.scenes[scene].nodes.size(); ++i)
+	{
+		AddNode(m_model.scenes[scene].nodes[i], -1);
+	}
+
+	for (size_t i = 0; i < m_nodes.parent.size(); ++i)
+	{
+		const tinygltf::Node* node = &m_model.nodes[m_nodeIds[i]];
+
+		for (size_t j = 0; j < node->children.size(); ++j)
+		{
+			AddNode(node->children[j], i);
+		}
+	}
+}
+
+void GltfScene::AddNode(int nodeId, int32_t parent)
+{
+	if (nodeId < 0 || static_cast<size_t>(nodeId) >= m_model.nodes.size())
+	{
+		fprintf(stderr, "[ERROR] Node ID out of bound %d [bounds %zu]\n",
+			nodeId, m_model.nodes.size());
+		return;
+	}
+
+	const tinygltf::Node* node = &m_model.nodes[nodeId];
+
+	glm::vec3 translation = glm::vec3(0.0f);
+	glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec3 scale = glm::vec3(1.0f);
+	glm::mat4 local = glm::mat4(1.0f);
+	bool hasMatrix = (node->matrix.size() == 16);
+
+	if (hasMatrix)
+	{
+		local = glm::make_mat4(node->matrix.data());
+	}
+	else
+	{
+		if (node->translation.size() == 3)
+			translation = glm::vec3(node->translation[0],
+						node->translation[1],
+						node->translation[2]);
+		if (node->rotation.size() == 4)
+			rotation = glm::quat(node->rotation[3],
+					     node->rotation[0],
+					     node->rotation[1],
+					     node->rotation[2]);
+		if (node->scale.size() == 3)
+			scale = glm::vec3(node->scale[0],
+					  node->scale[1],
+					  node->scale[2]);
+	}
+
+	m_nodeIndex[nodeId] = m_nodeIds.size();
+	m_nodeIds.push_back(nodeId);
+	m_nodes.parent.push_back(parent);
+	m_nodes.mesh.push_back(node->mesh);
+	m_nodes.skin.push_back(node->skin);
+	m_nodes.hasMatrix.push_back(hasMatrix);
+	m_nodes.translation.push_back(translation);
+	m_nodes.rotation.push_back(rotation);
+	m_nodes.scale.push_back(scale);
+	m_nodes.local.push_back(local);
+	m_nodes.world.push_back(local);
+	m_nodes.dirty.push_back(!hasMatrix);
+}
+
+// Place copies of the rest pose on a grid centred on the origin
+void GltfScene::BuildInstances(uint32_t count)
+{
+	if (count == 0)
+		count = 1;
+
+	GltfInstance rest;
+	rest.placement = glm::mat4(1.0f);
+	rest.moved = true;
+	rest.nodes = m_nodes;
+	rest.worldChanged.resize(m_nodes.parent.size());
+	rest.animationTime = 0.0f;
+	rest.jointMatrices.resize(m_skins.size());
+	rest.changed = false;
+	rest.skinsDirty = false;
+	rest.softSkinsDirty = false;
+
+	for (size_t i = 0; i < m_skins.size(); ++i)
+	{
+		rest.jointMatrices[i].assign(m_skins[i].joints.size(), glm::mat4(1.0f));
+	}
+
+	EvaluateNodes(&rest);
+
+	float spacing = InstanceSpacing(&rest.nodes);
+	uint32_t columns = ceilf(sqrtf(count));
+	uint32_t rows = (count + columns - 1) / columns;
+
+	m_instances.assign(count, rest);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		GltfInstance* instance = &m_instances[i];
+		float x = (i % columns) - (columns - 1) * 0.5f;
+		float z = (i / columns) - (rows - 1) * 0.5f;
+
+		instance->placement = glm::translate(glm::vec3(x * spacing, 0.0f, z * spacing));
+		instance->moved = true;
+		EvaluateNodes(instance);
+		UpdateSkins(instance);
+
+		instance->jointUbos.resize(m_skins.size());
+		glGenBuffers(instance->jointUbos.size(), instance->jointUbos.data());
+
+		for (size_t j = 0; j < instance->jointUbos.size(); ++j)
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, instance->jointUbos[j]);
+			glBufferData(GL_UNIFORM_BUFFER,
+				     MAX_JOINTS * sizeof(glm::mat4),
+				     nullptr,
+				     GL_DYNAMIC_DRAW);
+		}
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Grid spacing that keeps the rest pose bounds of neighbours apart
+float GltfScene::InstanceSpacing(const GltfNodeList* pNodes)
+{
+	glm::vec3 lower = glm::vec3(INFINITY);
+	glm::vec3 upper = glm::vec3(-INFINITY);
+
+	for (size_t i = 0; i < pNodes->mesh.size(); ++i)
+	{
+		if (pNodes->mesh[i] < 0)
+			continue;
+
+		// skinned vertices are placed by their joints, not the node
+		glm::mat4 world = (pNodes->skin[i] < 0) ? pNodes->world[i] : glm::mat4(1.0f);
+		const tinygltf::Mesh* mesh = &m_model.meshes[pNodes->mesh[i]];
+
+		for (size_t j = 0; j < mesh->primitives.size(); ++j)
+		{
+			std::map<std::string, int>::const_iterator position = mesh->primitives[j].attributes.find("POSITION");
+			if (position == mesh->primitives[j].attributes.end())
+				continue;
+
+			const tinygltf::Accessor* accessor = &m_model.accessors[position->second];
+			if (accessor->minValues.size() != 3 || accessor->maxValues.size() != 3)
+				continue;
+
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				glm::vec4 point = world * glm::vec4(
+					(corner & 1) ? accessor->maxValues[0] : accessor->minValues[0],
+					(corner & 2) ? accessor->maxValues[1] : accessor->minValues[1],
+					(corner & 4) ? accessor->maxValues[2] : accessor->minValues[2],
+					1.0f);
+
+				lower = glm::min(lower, glm::vec3(point));
+				upper = glm::max(upper, glm::vec3(point));
+			}
+		}
+	}
+
+	if (lower.x > upper.x)
+		return 1.0f;
+
+	return std::max(upper.x - lower.x, upper.z - lower.z) * 1.25f;
+}
+
+// Rebuild dirty locals and the worlds below them, returns whether any
+// world transform changed. Only touches the instance, safe on any thread.
+bool GltfScene::EvaluateNodes(GltfInstance* pInstance)
+{
+	GltfNodeList* nodes = &pInstance->nodes;
+	bool changed = false;
+	size_t count = nodes->parent.size();
+
+	// animated rigs touch most nodes, compose them all in one batch
+	if (std::find(nodes->dirty.begin(), nodes->dirty.end(), true) != nodes->dirty.end())
+	{
+		pInstance->composed.resize(count);
+		ComposeTRSBatch(count,
+				nodes->translation.data(),
+				nodes->rotation.data(),
+				nodes->scale.data(),
+				pInstance->composed.data());
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		int32_t parent = nodes->parent[i];
+		bool update = nodes->dirty[i] ||
+			((parent >= 0) ? pInstance->worldChanged[parent] : pInstance->moved);
+
+		if (nodes->dirty[i])
+		{
+			nodes->local[i] = pInstance->composed[i];
+			nodes->dirty[i] = false;
+		}
+
+		if (update)
+		{
+			nodes->world[i] = (parent >= 0)
+				? nodes->world[parent] * nodes->local[i]
+				: pInstance->placement * nodes->local[i];
+			changed = true;
+		}
+
+		pInstance->worldChanged[i] = update;
+	}
+
+	pInstance->moved = false;
+
+	return changed;
+}
+
+// Start of an accessor's elements and the distance between them
+const unsigned char* GltfScene::AccessorData(const tinygltf::Accessor* accessor, size_t* pStride)
+{
+	const tinygltf::BufferView* bufferView = &m_model.bufferViews[accessor->bufferView];
+
+	*pStride = bufferView->byteStride;
+	if (*pStride == 0)
+	{
+		*pStride = tinygltf::GetComponentSizeInBytes(accessor->componentType)
+			* tinygltf::GetTypeSizeInBytes(accessor->type);
+	}
+
+	return m_bufferData[bufferView->buffer] + bufferView->byteOffset + accessor->byteOffset;
+}
+
+void GltfScene::BuildSkins()
+{
+	m_skins.resize(m_model.skins.size());
+
+	for (size_t i = 0; i < m_model.skins.size(); ++i)
+	{
+		const tinygltf::Skin* skin = &m_model.skins[i];
+		GltfSkin* state = &m_skins[i];
+		size_t count = skin->joints.size();
+
+		if (count > MAX_JOINTS)
+		{
+			fprintf(stderr, "[WARN] skin %zu has %zu joints, only %d are used\n",
+				i, count, MAX_JOINTS);
+			count = MAX_JOINTS;
+		}
+
+		state->joints.resize(count);
+		state->inverseBind.assign(count, glm::mat4(1.0f));
+
+		for (size_t j = 0; j < count; ++j)
+		{
+			int nodeId = skin->joints[j];
+			state->joints[j] = (nodeId >= 0 && static_cast<size_t>(nodeId) < m_nodeIndex.size())
+				? m_nodeIndex[nodeId] : -1;
+		}
+
+		if (skin->inverseBindMatrices >= 0)
+		{
+			const tinygltf::Accessor* accessor = &m_model.accessors[skin->inverseBindMatrices];
+			size_t stride;
+			const unsigned char* pData = AccessorData(accessor, &stride);
+
+			for (size_t j = 0; j < count && j < accessor->count; ++j)
+			{
+				memcpy(glm::value_ptr(state->inverseBind[j]),
+				       pData + j * stride,
+				       sizeof(glm::mat4));
+			}
+		}
+	}
+}
+
+void GltfScene::UpdateSkins(GltfInstance* pInstance)
+{
+	for (size_t i = 0; i < m_skins.size(); ++i)
+	{
+		const GltfSkin* skin = &m_skins[i];
+		glm::mat4* jointMatrices = pInstance->jointMatrices[i].data();
+
+		for (size_t j = 0; j < skin->joints.size(); ++j)
+		{
+			int32_t joint = skin->joints[j];
+			jointMatrices[j] = (joint >= 0)
+				? pInstance->nodes.world[joint] * skin->inverseBind[j]
+				: pInstance->placement * skin->inverseBind[j];
+		}
+	}
+
+	pInstance->skinsDirty = true;
+	pInstance->softSkinsDirty = true;
+}
+
+void GltfScene::BuildSkinnedMeshes()
+{
+	GLResult result = GLResult::Success;
+	GLuint vs;
+	const char* varyings[] = { "skinned_position" };
+
+	result = CompileShader(skin_vs_src, GL_VERTEX_SHADER, &vs);
+	if (result == GLResult::Success)
+	{
+		result = LinkFeedbackProgram(vs, varyings, 1, &m_skinProgram);
+		glDeleteShader(vs);
+	}
+
+	if (result == GLResult::Success)
+	{
+		GLuint joints_block = glGetUniformBlockIndex(m_skinProgram, "Joints");
+		glUniformBlockBinding(m_skinProgram, joints_block, JOINTS_BINDING);
+	}
+
+	for (size_t i = 0; i < m_nodes.mesh.size(); ++i)
+	{
+		int32_t meshId = m_nodes.mesh[i];
+		if (meshId < 0 || m_nodes.skin[i] < 0)
+			continue;
+
+		const tinygltf::Mesh* mesh = &m_model.meshes[meshId];
+		GltfSkinnedMesh skinned;
+		skinned.mesh = meshId;
+		skinned.skin = m_nodes.skin[i];
+		skinned.first = m_skinTargets.size();
+		skinned.count = mesh->primitives.size();
+
+		for (size_t j = 0; j < mesh->primitives.size(); ++j)
+		{
+			const tinygltf::Primitive* primitive = &mesh->primitives[j];
+			GltfSkinTarget target;
+
+			target.sourceVao = m_packets[m_meshPackets[meshId].first + j].vao;
+			target.vertexCount = 0;
+
+			std::map<std::string, int>::const_iterator position = primitive->attributes.find("POSITION");
+			if (position != primitive->attributes.end())
+				target.vertexCount = m_model.accessors[position->second].count;
+
+			for (size_t k = 0; k < m_instances.size(); ++k)
+			{
+				GltfInstance* instance = &m_instances[k];
+				GLuint positions;
+
+				glGenBuffers(1, &positions);
+				glBindBuffer(GL_ARRAY_BUFFER, positions);
+				glBufferData(GL_ARRAY_BUFFER,
+					     target.vertexCount * sizeof(glm::vec3),
+					     nullptr,
+					     GL_DYNAMIC_COPY);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+				GltfDrawPacket packet;
+				BuildPacket(primitive, positions, &packet);
+
+				instance->skinnedPositions.push_back(positions);
+				instance->skinnedPackets.push_back(packet);
+			}
+
+			m_skinTargets.push_back(target);
+		}
+
+		m_skinnedMeshes.push_back(skinned);
+	}
+}
+
+// Called before drawing, so joints are uploaded and vertices skinned once
+// a frame however many views draw
+void GltfScene::SkinMeshes()
+{
+	PROFILE_ZONE("GltfScene::SkinMeshes");
+
+	bool program = (m_skinProgram != 0 && m_skinnedMeshes.empty() == false);
+
+	if (program)
+	{
+		glUseProgram(m_skinProgram);
+		glEnable(GL_RASTERIZER_DISCARD);
+	}
+
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		GltfInstance* instance = &m_instances[i];
+		if (instance->skinsDirty == false)
+			continue;
+
+		for (size_t j = 0; j < m_skins.size(); ++j)
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, instance->jointUbos[j]);
+			glBufferSubData(GL_UNIFORM_BUFFER,
+					0,
+					instance->jointMatrices[j].size() * sizeof(glm::mat4),
+					instance->jointMatrices[j].data());
+		}
+
+		for (size_t j = 0; program && j < m_skinnedMeshes.size(); ++j)
+		{
+			const GltfSkinnedMesh* mesh = &m_skinnedMeshes[j];
+
+			glBindBufferBase(GL_UNIFORM_BUFFER, JOINTS_BINDING, instance->jointUbos[mesh->skin]);
+
+			for (uint32_t k = mesh->first; k < mesh->first + mesh->count; ++k)
+			{
+				const GltfSkinTarget* target = &m_skinTargets[k];
+
+				// one point per vertex, in vertex order
+				glBindVertexArray(target->sourceVao);
+				glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, instance->skinnedPositions[k]);
+				glBeginTransformFeedback(GL_POINTS);
+				glDrawArrays(GL_POINTS, 0, target->vertexCount);
+				glEndTransformFeedback();
+				m_drawCalls++;
+			}
+		}
+
+		instance->skinsDirty = false;
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	if (program)
+	{
+		glDisable(GL_RASTERIZER_DISCARD);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		glBindVertexArray(0);
+	}
+}
+
+void GltfScene::BuildAnimations()
+{
+	for (size_t i = 0; i < m_model.animations.size(); ++i)
+	{
+		AnimationClip clip;
+		if (clip.Build(m_model, m_model.animations[i], m_bufferData, m_nodeIndex) == GLResult::Success)
+			m_animations.push_back(clip);
+	}
+}
+
+void GltfScene::NextAnimation()
+{
+	if (m_ready == false || m_animations.empty())
+		return;
+
+	m_animation++;
+	if (m_animation >= static_cast<int>(m_animations.size()))
+		m_animation = -1;
+
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		GltfInstance* instance = &m_instances[i];
+
+		// out of phase so a crowd does not move in lockstep
+		instance->animationTime = 0.0f;
+		if (m_animation >= 0)
+		{
+			instance->animationTime = m_animations[m_animation].Duration() * i / m_instances.size();
+			instance->cursors.assign(m_animations[m_animation].SamplerCount(), 0);
+		}
+	}
+
+	if (m_animation >= 0)
+	{
+		fprintf(stderr, "animation %s\n", m_animations[m_animation].Name().c_str());
+	}
+	else
+	{
+		fprintf(stderr, "animation off\n");
+	}
+}
+
+// Runs on a worker, writes nothing outside the instance
+void GltfScene::StepInstance(GltfInstance* pInstance, uint32_t stepMs)
+{
+	if (m_animation >= 0)
+	{
+		const AnimationClip* clip = &m_animations[m_animation];
+
+		pInstance->animationTime += stepMs / 1000.0f;
+		if (clip->Duration() > 0.0f)
+			pInstance->animationTime = fmodf(pInstance->animationTime, clip->Duration());
+
+		clip->Evaluate(pInstance->animationTime,
+			       pInstance->cursors.data(),
+			       &pInstance->animationScratch,
+			       &pInstance->nodes);
+	}
+
+	pInstance->changed = EvaluateNodes(pInstance);
+	if (pInstance->changed)
+		UpdateSkins(pInstance);
+}
+
+void GltfScene::Step(uint32_t stepMs)
+{
+	PROFILE_ZONE("GltfScene::Step");
+
+	if (m_ready == false)
+		return;
+
+	m_pJobs->ParallelFor(m_instances.size(), [this, stepMs](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			StepInstance(&m_instances[i], stepMs);
+		}
+	});
+
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		if (m_instances[i].changed)
+		{
+			m_generation++;
+			break;
+		}
+	}
+}
+
+void GltfScene::DrawPackets(const GltfProgram* program, const GltfDrawPacket* pPackets, uint32_t count, glm::mat4 transform)
+{
+	glUniformMatrix4fv(program->world,
+			   1,
+			   GL_FALSE,
+			   glm::value_ptr(transform));
+
+	glActiveTexture(GL_TEXTURE1);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const GltfDrawPacket* packet = &pPackets[i];
+
+		glUniform4fv(program->colorFactor, 1, glm::value_ptr(packet->colorFactor));
+		glBindTexture(GL_TEXTURE_2D, packet->texture);
+
+		glBindVertexArray(packet->vao);
+		if (packet->indexType == 0)
+		{
+			glDrawArrays(packet->mode, 0, packet->count);
+		}
+		else
+		{
+			glDrawElements(packet->mode,
+				       packet->count,
+				       packet->indexType,
+				       reinterpret_cast<const void*>(packet->indexOffset));
+		}
+	}
+
+	glBindVertexArray(0);
+	m_drawCalls += count;
+}
+
+void GltfScene::Render(Camera* pCamera)
+{
+	PROFILE_ZONE("GltfScene::Render");
+
+	glClearColor(0.2, 0.2, 0.2, 0.2);
+	glEnable(GL_DEPTH_TEST);
+	glCullFace(GL_BACK);
+
+	glClear(GL_COLOR_BUFFER_BIT |
+		GL_DEPTH_BUFFER_BIT);
+
+
+	if (m_ready == false)
+		return;
+
+	glm::mat4 view_project = pCamera->Projection() * pCamera->View();
+
+	SkinMeshes();
+	DrawScene(&m_program, view_project);
+}
+
+bool GltfScene::RenderLayered()
+{
+	PROFILE_ZONE("GltfScene::RenderLayered");
+
+	if (m_ready == false)
+		return true;
+
+	glEnable(GL_DEPTH_TEST);
+	glCullFace(GL_BACK);
+
+	SkinMeshes();
+	DrawScene(&m_layeredProgram, glm::mat4(1.0f));
+
+	return true;
+}
+
+void GltfScene::DrawScene(const GltfProgram* program, glm::mat4 transform)
+{
+	PROFILE_ZONE("GltfScene::DrawScene");
+
+	glUseProgram(program->program);
+
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		const GltfInstance* instance = &m_instances[i];
+
+		for (size_t j = 0; j < instance->nodes.mesh.size(); ++j)
+		{
+			if (instance->nodes.mesh[j] < 0 || instance->nodes.skin[j] >= 0)
+				continue;
+
+			const GltfMeshPackets* mesh = &m_meshPackets[instance->nodes.mesh[j]];
+			DrawPackets(program, m_packets.data() + mesh->first, mesh->count,
+				    transform * instance->nodes.world[j]);
+		}
+
+		// skinned positions are already in world space
+		for (size_t j = 0; j < m_skinnedMeshes.size(); ++j)
+		{
+			const GltfSkinnedMesh* mesh = &m_skinnedMeshes[j];
+			DrawPackets(program, instance->skinnedPackets.data() + mesh->first, mesh->count,
+				    transform);
+		}
+	}
+}
+
+// count elements of components floats from an accessor, components it
+// lacks read as GL's attribute defaults (0, 0, 0, 1)
+void GltfScene::ReadAccessor(int accessor, uint32_t count, uint32_t components, float* pOut)
+{
+	const tinygltf::Accessor* source = &m_model.accessors[accessor];
+	size_t stride = 0;
+	const unsigned char* pData = (source->bufferView >= 0) ? AccessorData(source, &stride) : nullptr;
+	uint32_t available = tinygltf::GetTypeSizeInBytes(source->type);
+	size_t size = tinygltf::GetComponentSizeInBytes(source->componentType);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		for (uint32_t c = 0; c < components; ++c)
+		{
+			float value = (c == 3) ? 1.0f : 0.0f;
+			if (pData != nullptr && i < source->count && c < available)
+				value = ReadComponent(pData + i * stride + c * size, source->componentType, source->normalized);
+
+			pOut[i * components + c] = value;
+		}
+	}
+}
+
+static uint32_t ReadIndex(const unsigned char* pData, int componentType)
+{
+	switch (componentType)
+	{
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return *pData;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+	{
+		uint16_t value;
+		memcpy(&value, pData, sizeof(value));
+		return value;
+	}
+	default:
+	{
+		uint32_t value;
+		memcpy(&value, pData, sizeof(value));
+		return value;
+	}
+	}
+}
+
+void GltfScene::BuildSoftPrimitive(const tinygltf::Primitive* primitive, GltfSoftPrimitive* pSoft)
+{
+	pSoft->texture = -1;
+
+	std::map<std::string, int>::const_iterator position = primitive->attributes.find("POSITION");
+	if (position == primitive->attributes.end())
+		return;
+
+	uint32_t count = m_model.accessors[position->second].count;
+	if (count == 0)
+		return;
+
+	pSoft->positions.resize(count);
+	ReadAccessor(position->second, count, 3, glm::value_ptr(pSoft->positions[0]));
+
+	std::map<std::string, int>::const_iterator texcoord = primitive->attributes.find("TEXCOORD_0");
+	if (texcoord != primitive->attributes.end())
+	{
+		pSoft->texcoords.resize(count);
+		ReadAccessor(texcoord->second, count, 2, glm::value_ptr(pSoft->texcoords[0]));
+	}
+
+	std::map<std::string, int>::const_iterator color = primitive->attributes.find("COLOR_0");
+	if (color != primitive->attributes.end())
+	{
+		pSoft->colors.resize(count);
+		ReadAccessor(color->second, count, 4, glm::value_ptr(pSoft->colors[0]));
+	}
+
+	std::map<std::string, int>::const_iterator joints = primitive->attributes.find("JOINTS_0");
+	std::map<std::string, int>::const_iterator weights = primitive->attributes.find("WEIGHTS_0");
+	if (joints != primitive->attributes.end() && weights != primitive->attributes.end())
+	{
+		pSoft->joints.resize(count);
+		pSoft->weights.resize(count);
+		ReadAccessor(joints->second, count, 4, glm::value_ptr(pSoft->joints[0]));
+		ReadAccessor(weights->second, count, 4, glm::value_ptr(pSoft->weights[0]));
+	}
+
+	// same material lookup as BuildPacket
+	if (primitive->material >= 0)
+	{
+		const tinygltf::Material* material = &m_model.materials[primitive->material];
+		tinygltf::ParameterMap::const_iterator texParam = material->values.find("baseColorTexture");
+		if (texParam != material->values.end())
+		{
+			int texIdx = texParam->second.TextureIndex();
+			if (texIdx >= 0 && static_cast<size_t>(texIdx) < m_textures.size())
+				pSoft->texture = texIdx;
+		}
+	}
+
+	std::vector<uint32_t> order;
+	if (primitive->indices >= 0)
+	{
+		const tinygltf::Accessor* accessor = &m_model.accessors[primitive->indices];
+		size_t stride;
+		const unsigned char* pData = AccessorData(accessor, &stride);
+
+		order.resize(accessor->count);
+		for (size_t i = 0; i < accessor->count; ++i)
+		{
+			order[i] = ReadIndex(pData + i * stride, accessor->componentType);
+		}
+	}
+	else
+	{
+		order.resize(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			order[i] = i;
+		}
+	}
+
+	int mode = (primitive->mode < 0) ? TINYGLTF_MODE_TRIANGLES : primitive->mode;
+	switch (mode)
+	{
+	case TINYGLTF_MODE_TRIANGLES:
+		pSoft->indices.assign(order.begin(), order.begin() + order.size() / 3 * 3);
+		break;
+	case TINYGLTF_MODE_TRIANGLE_STRIP:
+		for (size_t i = 2; i < order.size(); ++i)
+		{
+			bool odd = (i & 1) != 0;
+			pSoft->indices.push_back(order[i - (odd ? 1 : 2)]);
+			pSoft->indices.push_back(order[i - (odd ? 2 : 1)]);
+			pSoft->indices.push_back(order[i]);
+		}
+		break;
+	case TINYGLTF_MODE_TRIANGLE_FAN:
+		for (size_t i = 2; i < order.size(); ++i)
+		{
+			pSoft->indices.push_back(order[0]);
+			pSoft->indices.push_back(order[i - 1]);
+			pSoft->indices.push_back(order[i]);
+		}
+		break;
+	}
+}
+
+void GltfScene::BuildSoftPrimitives()
+{
+	std::vector<const tinygltf::Primitive*> primitives;
+	for (size_t i = 0; i < m_model.meshes.size(); ++i)
+	{
+		for (size_t j = 0; j < m_model.meshes[i].primitives.size(); ++j)
+		{
+			primitives.push_back(&m_model.meshes[i].primitives[j]);
+		}
+	}
+
+	m_softPrimitives.resize(primitives.size());
+	m_pJobs->ParallelFor(primitives.size(), [this, &primitives](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			BuildSoftPrimitive(primitives[i], &m_softPrimitives[i]);
+		}
+	});
+}
+
+// Level 0 of every texture's image, copied before the decoded and baked
+// images are released. Textures sharing an image share nothing here.
+void GltfScene::CopySoftTextures()
+{
+	m_softTextures.resize(m_model.textures.size());
+	m_softPixels.resize(m_model.textures.size());
+
+	for (size_t i = 0; i < m_model.textures.size(); ++i)
+	{
+		int source = m_model.textures[i].source;
+
+		// images that failed to decode sample (0, 0, 0, 1), as no texture does
+		m_softTextures[i].width = 0;
+		m_softTextures[i].height = 0;
+		m_softTextures[i].pPixels = nullptr;
+
+		if (source < 0 ||
+		    static_cast<size_t>(source) >= m_images.size() ||
+		    m_images[source].levelData.empty())
+			continue;
+
+		const GltfImageData* image = &m_images[source];
+		const unsigned char* pPixels = image->levelData[0];
+		m_softPixels[i].assign(pPixels, pPixels + 4 * static_cast<size_t>(image->width) * image->height);
+
+		m_softTextures[i].width = image->width;
+		m_softTextures[i].height = image->height;
+		m_softTextures[i].pPixels = m_softPixels[i].data();
+	}
+}
+
+// Same blend as skin_vs_src, joints past the skin are left out
+void GltfScene::SkinSoftware()
+{
+	m_pJobs->ParallelFor(m_instances.size(), [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			GltfInstance* instance = &m_instances[i];
+			if (instance->softSkinsDirty == false)
+				continue;
+
+			instance->softPositions.resize(m_skinTargets.size());
+
+			for (size_t j = 0; j < m_skinnedMeshes.size(); ++j)
+			{
+				const GltfSkinnedMesh* mesh = &m_skinnedMeshes[j];
+				const std::vector<glm::mat4>* jointMatrices = &instance->jointMatrices[mesh->skin];
+
+				for (uint32_t k = 0; k < mesh->count; ++k)
+				{
+					const GltfSoftPrimitive* primitive = &m_softPrimitives[m_meshPackets[mesh->mesh].first + k];
+					std::vector<glm::vec3>* positions = &instance->softPositions[mesh->first + k];
+
+					if (primitive->weights.empty())
+					{
+						*positions = primitive->positions;
+						continue;
+					}
+
+					positions->resize(primitive->positions.size());
+
+					for (size_t v = 0; v < primitive->positions.size(); ++v)
+					{
+						glm::mat4 skin(0.0f);
+						for (int c = 0; c < 4; ++c)
+						{
+							uint32_t joint = static_cast<uint32_t>(primitive->joints[v][c]);
+							if (joint < jointMatrices->size())
+								skin += primitive->weights[v][c] * (*jointMatrices)[joint];
+						}
+
+						(*positions)[v] = glm::vec3(skin * glm::vec4(primitive->positions[v], 1.0f));
+					}
+				}
+			}
+
+			instance->softSkinsDirty = false;
+		}
+	});
+}
+
+bool GltfScene::RenderSoftware(SoftRasterizer* pRaster)
+{
+	PROFILE_ZONE("GltfScene::RenderSoftware");
+
+	if (m_ready == false)
+		return true;
+
+	if (m_softPrimitives.empty())
+		BuildSoftPrimitives();
+
+	SkinSoftware();
+
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		const GltfInstance* instance = &m_instances[i];
+
+		for (size_t j = 0; j < instance->nodes.mesh.size(); ++j)
+		{
+			int32_t mesh = instance->nodes.mesh[j];
+			if (mesh < 0 || instance->nodes.skin[j] >= 0)
+				continue;
+
+			for (uint32_t k = 0; k < m_meshPackets[mesh].count; ++k)
+			{
+				const GltfSoftPrimitive* primitive = &m_softPrimitives[m_meshPackets[mesh].first + k];
+				if (primitive->indices.empty())
+					continue;
+
+				SoftDraw draw;
+				draw.world = instance->nodes.world[j];
+				draw.pPositions = primitive->positions.data();
+				draw.pTexcoords = primitive->texcoords.empty() ? nullptr : primitive->texcoords.data();
+				draw.pColors = primitive->colors.empty() ? nullptr : primitive->colors.data();
+				draw.vertexCount = primitive->positions.size();
+				draw.pIndices = primitive->indices.data();
+				draw.indexCount = primitive->indices.size();
+				if (primitive->texture >= 0 &&
+				    static_cast<size_t>(primitive->texture) < m_softTextures.size() &&
+				    m_softTextures[primitive->texture].pPixels != nullptr)
+					draw.pTexture = &m_softTextures[primitive->texture];
+
+				pRaster->Draw(draw);
+				m_drawCalls++;
+			}
+		}
+
+		// skinned positions are already in world space
+		for (size_t j = 0; j < m_skinnedMeshes.size(); ++j)
+		{
+			const GltfSkinnedMesh* mesh = &m_skinnedMeshes[j];
+
+			for (uint32_t k = 0; k < mesh->count; ++k)
+			{
+				const GltfSoftPrimitive* primitive = &m_softPrimitives[m_meshPackets[mesh->mesh].first + k];
+				const std::vector<glm::vec3>* positions = &instance->softPositions[mesh->first + k];
+				if (primitive->indices.empty() || positions->empty())
+					continue;
+
+				SoftDraw draw;
+				draw.pPositions = positions->data();
+				draw.pTexcoords = primitive->texcoords.empty() ? nullptr : primitive->texcoords.data();
+				draw.pColors = primitive->colors.empty() ? nullptr : primitive->colors.data();
+				draw.vertexCount = positions->size();
+				draw.pIndices = primitive->indices.data();
+				draw.indexCount = primitive->indices.size();
+				if (primitive->texture >= 0 &&
+				    static_cast<size_t>(primitive->texture) < m_softTextures.size() &&
+				    m_softTextures[primitive->texture].pPixels != nullptr)
+					draw.pTexture = &m_softTextures[primitive->texture];
+
+				pRaster->Draw(draw);
+				m_drawCalls++;
+			}
+		}
+	}
+
+	return true;
 }
@@ -1,27 +1,75 @@
 #ifndef CUBE_GLTFSCENE_H
 #define CUBE_GLTFSCENE_H
 
+#include <atomic>
+#include <string>
 #include <vector>
 
 #include <GL/glew.h>
 #define GLM_FORCE_RADIANS 
 #include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <tiny_gltf.h>
 
 #include "Scene.h"
 #include "Camera.h"
 #include "glutils.h"
+#include "MappedFile.h"
+#include "AnimationClip.h"
+#include "JobSystem.h"
+#include "SceneBake.h"
+#include "SoftRasterizer.h"
+
+// glTF attribute semantics, lowercased, at the location each program binds them
+#define NUM_ATTRIBUTES 8
+static const char* const attribute_names[NUM_ATTRIBUTES] = {
+	"position",
+	"normal",
+	"tangent",
+	"texcoord_0",
+	"texcoord_1",
+	"color_0",
+	"joints_0",
+	"weights_0",
+};
+
+// joint matrices of the skin being applied, sized to MAX_JOINTS
+#define MAX_JOINTS 64
+#define JOINTS_BINDING 1
+
+// macro values spliced into shader source
+#define SHADER_STRING2(x) #x
+#define SHADER_STRING(x) SHADER_STRING2(x)
+
+// Skinning pre-pass, world space positions are captured with transform
+// feedback and drawn by every view as static geometry
+static const char skin_vs_src[] =
+"#version 330\n\
+layout(location = 0) in vec3 position;\n\
+layout(location = 6) in vec4 joints_0;\n\
+layout(location = 7) in vec4 weights_0;\n\
+layout(std140) uniform Joints {\n\
+    mat4 joint_matrix[" SHADER_STRING(MAX_JOINTS) "];\n\
+};\n\
+out vec3 skinned_position;\n\
+void main() {\n\
+    mat4 skin = weights_0.x * joint_matrix[int(joints_0.x)] +\n\
+                weights_0.y * joint_matrix[int(joints_0.y)] +\n\
+                weights_0.z * joint_matrix[int(joints_0.z)] +\n\
+                weights_0.w * joint_matrix[int(joints_0.w)];\n\
+    skinned_position = (skin * vec4(position, 1.0)).xyz;\n\
+}";
 
 static const char vs_src[] =
 "#version 330\n\
-in vec3 position;\n\
-in vec3 normal;\n\
-in vec4 tangent;\n\
-in vec2 texcoord_0;\n\
-in vec2 texcoord_1;\n\
-in vec4 color_0;\n\
-in vec4 joints_0;\n\
-in vec4 weights_0;\n\
+layout(location = 0) in vec3 position;\n\
+layout(location = 1) in vec3 normal;\n\
+layout(location = 2) in vec4 tangent;\n\
+layout(location = 3) in vec2 texcoord_0;\n\
+layout(location = 4) in vec2 texcoord_1;\n\
+layout(location = 5) in vec4 color_0;\n\
+layout(location = 6) in vec4 joints_0;\n\
+layout(location = 7) in vec4 weights_0;\n\
 uniform mat4 world;\n\
 out vec2 texcoord;\n\
 out vec4 color;\n\
@@ -31,6 +79,26 @@ void main() {\n\
     gl_Position = world * vec4(position, 1.0);\n\
 }";
 
+// world is the model transform only, faces are projected in the geometry shader
+static const char layered_vs_src[] =
+"#version 330\n\
+layout(location = 0) in vec3 position;\n\
+layout(location = 1) in vec3 normal;\n\
+layout(location = 2) in vec4 tangent;\n\
+layout(location = 3) in vec2 texcoord_0;\n\
+layout(location = 4) in vec2 texcoord_1;\n\
+layout(location = 5) in vec4 color_0;\n\
+layout(location = 6) in vec4 joints_0;\n\
+layout(location = 7) in vec4 weights_0;\n\
+uniform mat4 world;\n\
+out vec2 v_texcoord;\n\
+out vec4 v_color;\n\
+void main() {\n\
+    v_color = color_0;\n\
+    v_texcoord = texcoord_0;\n\
+    gl_Position = world * vec4(position, 1.0);\n\
+}";
+
 static const char fs_src[] =
 "#version 330\n\
 in vec4 color;\n\
@@ -43,34 +111,274 @@ void main() {\n\
 }";
 
 
+// Where a bufferView was packed, views not used for drawing have no buffer
 struct GLBufferState
 {
 	GLuint buffer;
 	GLenum target;
+	size_t offset;
+};
+
+// binary glTF container, see the glTF 2.0 spec GLB file format
+#define GLB_MAGIC 0x46546C67		// "glTF"
+#define GLB_HEADER_SIZE 12
+#define GLB_CHUNK_HEADER_SIZE 8
+#define GLB_CHUNK_BIN 0x004E4942	// "BIN"
+
+// bufferView offsets in the arenas keep this alignment
+#define BUFFER_ARENA_ALIGNMENT 16
+
+// largest single buffer upload while loading, keeps each main thread job short
+#define UPLOAD_CHUNK_SIZE (1 << 20)
+
+// mip levels with more pixels than this are built in background jobs of
+// about this many pixels each
+#define MIP_TILE_PIXELS (512 * 512)
+
+// A linked program and the uniform locations drawing needs
+struct GltfProgram
+{
+	GLuint program;
+	GLint world;
+	GLint colorFactor;
+	GLint colorTexture;
+};
+
+// One primitive resolved at load, drawing it is bind and draw
+struct GltfDrawPacket
+{
+	GLuint vao;
+	GLenum mode;
+	GLsizei count;
+	GLenum indexType;	// 0 for non-indexed draws
+	size_t indexOffset;
+	GLuint texture;		// 0 when the material has no base color texture
+	glm::vec4 colorFactor;
+};
+
+// Range of m_packets drawn for a mesh
+struct GltfMeshPackets
+{
+	uint32_t first;
+	uint32_t count;
+};
+
+// Default scene's node tree flattened so every parent comes before its
+// children, world transforms are evaluated in one pass over the arrays
+struct GltfNodeList
+{
+	std::vector<int32_t> parent;		// index in this list, -1 for roots
+	std::vector<int32_t> mesh;		// -1 for nodes without one
+	std::vector<int32_t> skin;		// -1 for nodes without one
+	std::vector<uint8_t> hasMatrix;		// local is fixed, TRS is unused
+	std::vector<glm::vec3> translation;
+	std::vector<glm::quat> rotation;
+	std::vector<glm::vec3> scale;
+	std::vector<glm::mat4> local;
+	std::vector<glm::mat4> world;
+	std::vector<uint8_t> dirty;		// local TRS changed since last evaluate
+};
+
+// Skin joints resolved to flattened nodes
+struct GltfSkin
+{
+	std::vector<int32_t> joints;
+	std::vector<glm::mat4> inverseBind;
+};
+
+// One skinned primitive, each instance captures its positions into its
+// own buffer drawn by the packet at the same index in skinnedPackets
+struct GltfSkinTarget
+{
+	GLuint sourceVao;	// bind pose packet, read by the skinning pass
+	GLsizei vertexCount;
+};
+
+// Skinned node and its range of m_skinTargets
+struct GltfSkinnedMesh
+{
+	int32_t mesh;
+	int32_t skin;
+	uint32_t first;
+	uint32_t count;
+};
+
+// CPU copy of a primitive for the software rasterizer, attributes decoded
+// to float and strips and fans expanded to a triangle list. Points and
+// lines have no indices and are not drawn.
+struct GltfSoftPrimitive
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> texcoords;	// empty without TEXCOORD_0
+	std::vector<glm::vec4> colors;		// empty without COLOR_0
+	std::vector<glm::vec4> joints;		// empty unless skinned
+	std::vector<glm::vec4> weights;
+	std::vector<uint32_t> indices;
+	int32_t texture;			// base color texture, -1 for none
+};
+
+// An image decoded to RGBA8 on the job system instead of inside tinygltf,
+// or read from a baked file. Level 0 first and the rest only when a
+// texture samples mipmaps.
+struct GltfImageData
+{
+	std::vector<unsigned char> encoded;	// as stored in the file, dropped once decoded
+	bool mipmapped;
+	uint32_t width;
+	uint32_t height;
+	std::vector<std::vector<unsigned char> > levels;	// decoded here, empty when baked
+	std::vector<const unsigned char*> levelData;		// into levels or the baked file
+};
+
+// One copy of the model in the scene. Step animates every instance on the
+// job system, the GL thread only uploads and draws what they produced.
+struct GltfInstance
+{
+	glm::mat4 placement;			// applied above the root nodes
+	bool moved;				// placement changed since the last evaluate
+
+	GltfNodeList nodes;
+	std::vector<uint8_t> worldChanged;	// scratch for EvaluateNodes
+	std::vector<glm::mat4> composed;	// scratch for EvaluateNodes
+
+	float animationTime;
+	std::vector<uint32_t> cursors;		// per sampler of the playing clip
+	AnimationScratch animationScratch;
+
+	// joint matrices are world space since glTF ignores the transform of
+	// a skinned mesh's node, per skin
+	std::vector<std::vector<glm::mat4> > jointMatrices;
+	std::vector<GLuint> jointUbos;
+	bool changed;				// set by the last Step
+	bool skinsDirty;			// joint matrices changed since the last skinning pass
+
+	std::vector<GLuint> skinnedPositions;	// per m_skinTargets
+	std::vector<GltfDrawPacket> skinnedPackets;
+
+	bool softSkinsDirty;			// joint matrices changed since the last CPU skinning
+	std::vector<std::vector<glm::vec3> > softPositions;	// per m_skinTargets, skinned on the CPU
 };
 
 class GltfScene : public Scene
 {
 public:
-	GltfScene(const char* pFileName);
+	// Returns at once, the file is parsed on pJobs and uploaded by
+	// JobQueue::Main jobs, IsReady once the last of them ran. Instances
+	// are laid out on a grid around the origin and animated on pJobs.
+	// .gltf and .glb files are baked into pCacheDir on first load and
+	// loaded from there afterwards, baked files can also be loaded directly.
+	GltfScene(const char* pFileName, JobSystem* pJobs, uint32_t instances = 1,
+		  const char* pCacheDir = nullptr);
 	~GltfScene();
 	void Step(uint32_t stepMs);
 	void Render(Camera* pCamera);
+	bool RenderLayered();
+	bool RenderSoftware(SoftRasterizer* pRaster);
+	bool IsReady() const { return m_ready; }
+
+	// Keep level 0 of every decoded image for RenderSoftware, so it never
+	// reads textures back from GL. Main thread, before the first frame.
+	void KeepSoftTextures() { m_keepSoftTextures = true; }
+
+	// Block until loading succeeded or failed, running its main thread
+	// jobs meanwhile. Main thread only.
+	void WaitUntilLoaded();
+
+	// Cycle through the model's animations, then none
+	void NextAnimation();
 
 private:
-	GLResult Init(const char* pFileName);
-	void DrawMesh(const tinygltf::Mesh* mesh, glm::mat4 transform);
-	void DrawNode(tinygltf::Node* node, glm::mat4 parent_transform);
+	void Init(const char* pFileName, uint32_t instances);
+	void LoadJob(const std::string& fileName, uint32_t instances);
+	void FinishLoad(uint32_t instances);
+	GLResult Load(const char* pFileName);
+	GLResult LoadBake(uint64_t sourceHash);
+	void WriteCache();
+	void MapBuffers(bool binary);
+	void LayoutBuffers(size_t* pVertexSize, size_t* pIndexSize);
+	void CreateArenas(size_t vertexSize, size_t indexSize);
+	void UploadBufferRange(size_t view, size_t offset, size_t size);
+	void UploadArenaRange(GLenum target, size_t offset, size_t size);
+	static bool DeferImage(tinygltf::Image* image, const int imageIndex,
+			       std::string* err, std::string* warn,
+			       int reqWidth, int reqHeight,
+			       const unsigned char* bytes, int size, void* pUser);
+	void DecodeImage(size_t image, const JobHandle& done);
+	void UploadTexture(size_t texture);
+	GLResult InitProgram(const char* vs, const char* gs, GltfProgram* pProgram);
+	void BuildPackets();
+	void BuildPacket(const tinygltf::Primitive* primitive, GLuint positions, GltfDrawPacket* packet);
+	void DrawScene(const GltfProgram* program, glm::mat4 transform);
+	void DrawPackets(const GltfProgram* program, const GltfDrawPacket* pPackets, uint32_t count, glm::mat4 transform);
+	void FlattenNodes();
+	void AddNode(int nodeId, int32_t parent);
+	void BuildInstances(uint32_t count);
+	float InstanceSpacing(const GltfNodeList* pNodes);
+	bool EvaluateNodes(GltfInstance* pInstance);
+	void BuildAnimations();
+	void BuildSkins();
+	void BuildSkinnedMeshes();
+	void UpdateSkins(GltfInstance* pInstance);
+	void StepInstance(GltfInstance* pInstance, uint32_t stepMs);
+	void SkinMeshes();
+	const unsigned char* AccessorData(const tinygltf::Accessor* accessor, size_t* pStride);
+	void ReadAccessor(int accessor, uint32_t count, uint32_t components, float* pOut);
+	void BuildSoftPrimitive(const tinygltf::Primitive* primitive, GltfSoftPrimitive* pSoft);
+	void BuildSoftPrimitives();
+	void CopySoftTextures();
+	void SkinSoftware();
 
 	tinygltf::Model m_model;
+
+	JobHandle m_loadJob;		// parse and CPU tables, queues the uploads
+	JobHandle m_finishJob;		// last upload job, 0 when loading failed early
+	JobHandle m_releaseJob;		// frees the decoded images after finish and the cache write
+	GLResult m_loadResult;
+
+	std::string m_cacheDir;			// empty to never bake
+	uint64_t m_sourceHash;			// of the source file, when baking it
+	bool m_baked;				// loaded from a baked file
+	std::vector<size_t> m_bufferSizes;	// per buffer, when baked
+	std::atomic<bool> m_ready;	// set on the GL thread, read by Step jobs
+
+	// .glb files stay mapped, the BIN chunk backs the first buffer
+	MappedFile m_file;
+	std::vector<const unsigned char*> m_bufferData;	// per buffer
 	
-	// material?
-	GLuint m_program;
-	GLuint m_vao;
+	GltfProgram m_program;
+	GltfProgram m_layeredProgram;
+
+	std::vector<GltfDrawPacket> m_packets;
+	std::vector<GltfMeshPackets> m_meshPackets;
+
+	GltfNodeList m_nodes;			// rest pose every instance starts from
+	std::vector<int32_t> m_nodeIds;		// tinygltf node of each flattened node
+	std::vector<int32_t> m_nodeIndex;	// flattened index of each tinygltf node, -1 if unused
+
+	JobSystem* m_pJobs;
+	std::vector<GltfInstance> m_instances;
 
-	// per mesh
-	std::vector<GLBufferState> m_glBuffers;
+	std::vector<AnimationClip> m_animations;
+	int m_animation;			// playing clip, -1 for none
+
+	std::vector<GltfSkin> m_skins;
+
+	GLuint m_skinProgram;
+	std::vector<GltfSkinnedMesh> m_skinnedMeshes;
+	std::vector<GltfSkinTarget> m_skinTargets;
+
+	// vertex and index data of every bufferView, packed into two buffers
+	GLuint m_vertexBuffer;
+	GLuint m_indexBuffer;
+	std::vector<GLBufferState> m_glBuffers;	// per bufferView
 	std::vector<GLuint> m_textures;
+	std::vector<GltfImageData> m_images;	// per tinygltf image
+
+	// software rendering, built the first time it draws
+	std::vector<GltfSoftPrimitive> m_softPrimitives;	// parallel to m_packets
+	bool m_keepSoftTextures;
+	std::vector<SoftTexture> m_softTextures;		// per texture, kept from m_images
+	std::vector<std::vector<unsigned char> > m_softPixels;
 };
 
 #endif // CUBE_GLTFSCENE_H
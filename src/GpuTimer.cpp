@@ -0,0 +1,59 @@
+#include "GpuTimer.h"
+
+GpuTimer::GpuTimer()
+{
+	glGenQueries(GPU_TIMER_RING, m_queries);
+	m_head = 0;
+	m_pending = 0;
+	m_active = false;
+}
+
+GpuTimer::~GpuTimer()
+{
+	glDeleteQueries(GPU_TIMER_RING, m_queries);
+}
+
+void GpuTimer::Begin()
+{
+	// ring full, drop this measurement rather than reuse a query in flight
+	if (m_pending == GPU_TIMER_RING)
+		return;
+
+	glBeginQuery(GL_TIME_ELAPSED, m_queries[m_head]);
+	m_active = true;
+}
+
+void GpuTimer::End(uint32_t tag)
+{
+	if (m_active == false)
+		return;
+
+	glEndQuery(GL_TIME_ELAPSED);
+	m_tags[m_head] = tag;
+	m_head = (m_head + 1) % GPU_TIMER_RING;
+	m_pending++;
+	m_active = false;
+}
+
+bool GpuTimer::Poll(float *pMs, uint32_t *pTag)
+{
+	if (m_pending == 0)
+		return false;
+
+	uint32_t oldest = (m_head + GPU_TIMER_RING - m_pending) % GPU_TIMER_RING;
+
+	GLint available = GL_FALSE;
+	glGetQueryObjectiv(m_queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available == GL_FALSE)
+		return false;
+
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(m_queries[oldest], GL_QUERY_RESULT, &elapsed);
+	m_pending--;
+
+	*pMs = static_cast<float>(elapsed) / 1000000.0f;
+	if (pTag != nullptr)
+		*pTag = m_tags[oldest];
+
+	return true;
+}
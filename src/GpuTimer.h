@@ -0,0 +1,31 @@
+#ifndef CUBE_GPUTIMER_H
+#define CUBE_GPUTIMER_H
+
+#include <stdint.h>
+#include <GL/glew.h>
+
+// queries in flight, results are read back this many Begin/End pairs later
+#define GPU_TIMER_RING 4
+
+// GL_TIME_ELAPSED measurement that never waits on the GPU. Only one timer
+// may be between Begin and End at a time.
+class GpuTimer
+{
+public:
+	GpuTimer();
+	~GpuTimer();
+	void Begin();
+	void End(uint32_t tag = 0);
+
+	// Oldest finished measurement and the tag it was ended with
+	bool Poll(float *pMs, uint32_t *pTag = nullptr);
+
+private:
+	GLuint m_queries[GPU_TIMER_RING];
+	uint32_t m_tags[GPU_TIMER_RING];
+	uint32_t m_head;	// next query to start
+	uint32_t m_pending;	// started and not yet read back
+	bool m_active;
+};
+
+#endif // CUBE_GPUTIMER_H
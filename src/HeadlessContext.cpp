@@ -0,0 +1,205 @@
+#include "HeadlessContext.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <EGL/eglext.h>
+#include <stb_image_write.h>
+
+HeadlessContext::HeadlessContext()
+{
+	m_display = EGL_NO_DISPLAY;
+	m_context = EGL_NO_CONTEXT;
+	m_fbo = 0;
+	m_color = 0;
+	m_depth = 0;
+	m_width = 0;
+	m_height = 0;
+}
+
+HeadlessContext::~HeadlessContext()
+{
+	Destroy();
+}
+
+static bool HasExtension(const char* pExtensions, const char* pName)
+{
+	size_t length = strlen(pName);
+
+	for (const char* p = pExtensions; p != nullptr && (p = strstr(p, pName)) != nullptr; p += length)
+	{
+		if ((p == pExtensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+			return true;
+	}
+
+	return false;
+}
+
+GLResult HeadlessContext::Create(uint32_t width, uint32_t height)
+{
+	Destroy();
+
+	m_width = width;
+	m_height = height;
+
+	// surfaceless needs neither a display server nor a GPU, fall back to
+	// the default display for EGL implementations without it
+	const char* pClientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+	if (getPlatformDisplay != nullptr && HasExtension(pClientExtensions, "EGL_MESA_platform_surfaceless"))
+		m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+
+	if (m_display == EGL_NO_DISPLAY)
+		m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (m_display == EGL_NO_DISPLAY || eglInitialize(m_display, &major, &minor) == EGL_FALSE)
+	{
+		fprintf(stderr, "[ERROR] Could not initialize an EGL display: %x\n", eglGetError());
+		m_display = EGL_NO_DISPLAY;
+		return GLResult::Failed;
+	}
+
+	if (HasExtension(eglQueryString(m_display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context") == false)
+	{
+		fprintf(stderr, "[ERROR] EGL %d.%d has no EGL_KHR_surfaceless_context\n", major, minor);
+		return GLResult::Failed;
+	}
+
+	const EGLint configAttributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint configs = 0;
+	if (eglChooseConfig(m_display, configAttributes, &config, 1, &configs) == EGL_FALSE || configs == 0)
+	{
+		fprintf(stderr, "[ERROR] No EGL config renders OpenGL\n");
+		return GLResult::Failed;
+	}
+
+	eglBindAPI(EGL_OPENGL_API);
+
+	const EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+
+	m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, contextAttributes);
+	if (m_context == EGL_NO_CONTEXT)
+	{
+		fprintf(stderr, "[ERROR] Unable to create OpenGL 3.3 core context: %x\n", eglGetError());
+		return GLResult::Failed;
+	}
+
+	if (eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context) == EGL_FALSE)
+	{
+		fprintf(stderr, "[ERROR] Unable to make the EGL context current: %x\n", eglGetError());
+		return GLResult::Failed;
+	}
+
+	// core profile has no extension string for GLEW to check entry points
+	// against. A GLX build of GLEW loads them and then fails on the missing
+	// X display, which is fine here.
+	glewExperimental = GL_TRUE;
+	GLenum glew = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	if (glew == GLEW_ERROR_NO_GLX_DISPLAY)
+		glew = GLEW_OK;
+#endif
+	if (glew != GLEW_OK)
+	{
+		fprintf(stderr, "[ERROR] glewInit failed: %d\n", glew);
+		return GLResult::Failed;
+	}
+
+	// glewInit can leave an error behind on core contexts
+	glGetError();
+
+	return CreateFramebuffer();
+}
+
+GLResult HeadlessContext::CreateFramebuffer()
+{
+	glGenRenderbuffers(1, &m_color);
+	glBindRenderbuffer(GL_RENDERBUFFER, m_color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_width, m_height);
+
+	glGenRenderbuffers(1, &m_depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, m_width, m_height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &m_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+
+	GLResult result = GLResult::Success;
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		fprintf(stderr, "[ERROR] Offscreen framebuffer %ux%u incomplete\n", m_width, m_height);
+		result = GLResult::Failed;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return result;
+}
+
+void HeadlessContext::Destroy()
+{
+	// objects only exist once GLEW loaded the entry points
+	if (m_fbo != 0)
+	{
+		glDeleteFramebuffers(1, &m_fbo);
+		glDeleteRenderbuffers(1, &m_color);
+		glDeleteRenderbuffers(1, &m_depth);
+	}
+
+	if (m_context != EGL_NO_CONTEXT)
+	{
+		eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(m_display, m_context);
+	}
+
+	if (m_display != EGL_NO_DISPLAY)
+		eglTerminate(m_display);
+
+	m_display = EGL_NO_DISPLAY;
+	m_context = EGL_NO_CONTEXT;
+	m_fbo = 0;
+	m_color = 0;
+	m_depth = 0;
+}
+
+GLResult HeadlessContext::SaveFrame(const char* pFileName)
+{
+	std::vector<unsigned char> pixels(3 * static_cast<size_t>(m_width) * m_height);
+
+	// alpha is whatever the scenes left in it, drop it
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	// GL rows start at the bottom
+	stbi_flip_vertically_on_write(1);
+	if (stbi_write_png(pFileName, m_width, m_height, 3, pixels.data(), 3 * m_width) == 0)
+	{
+		fprintf(stderr, "[ERROR] Could not write %s\n", pFileName);
+		return GLResult::Failed;
+	}
+
+	return GLResult::Success;
+}
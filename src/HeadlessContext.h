@@ -0,0 +1,44 @@
+#ifndef CUBE_HEADLESSCONTEXT_H
+#define CUBE_HEADLESSCONTEXT_H
+
+#include <stdint.h>
+
+#include <EGL/egl.h>
+
+#include "glutils.h"
+
+// GL 3.3 core context with no window or display server, drawing into an
+// offscreen framebuffer. Uses EGL's surfaceless platform, which Mesa runs on
+// llvmpipe when there is no GPU.
+class HeadlessContext
+{
+public:
+	HeadlessContext();
+	~HeadlessContext();
+
+	// Make the context current and initialize GLEW on it
+	GLResult Create(uint32_t width, uint32_t height);
+	void Destroy();
+
+	GLuint Framebuffer() const { return m_fbo; }
+	uint32_t Width() const { return m_width; }
+	uint32_t Height() const { return m_height; }
+
+	// Write what the framebuffer holds to a PNG file
+	GLResult SaveFrame(const char* pFileName);
+
+private:
+	HeadlessContext(const HeadlessContext&);
+	HeadlessContext& operator=(const HeadlessContext&);
+
+	GLResult CreateFramebuffer();
+
+	EGLDisplay m_display;
+	EGLContext m_context;
+	GLuint m_fbo;
+	GLuint m_color;
+	GLuint m_depth;
+	uint32_t m_width, m_height;
+};
+
+#endif // CUBE_HEADLESSCONTEXT_H
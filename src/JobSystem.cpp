@@ -0,0 +1,277 @@
+#include "JobSystem.h"
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+// chunks handed out per thread by ParallelFor, more evens out uneven items
+#define CHUNKS_PER_THREAD 4
+
+// deque of the calling thread, threads outside the pool share the main one
+static thread_local uint32_t t_deque = 0;
+
+JobSystem::JobSystem(uint32_t threads)
+{
+	m_mainThread = std::this_thread::get_id();
+	m_queued = 0;
+	m_quit = false;
+
+	if (threads == 0)
+	{
+		uint32_t cores = std::thread::hardware_concurrency();
+		threads = (cores > 1) ? cores - 1 : 1;
+	}
+
+	for (uint32_t i = 0; i <= threads; ++i)
+	{
+		m_deques.push_back(std::unique_ptr<JobDeque>(new JobDeque()));
+	}
+
+	for (uint32_t i = 0; i < threads; ++i)
+	{
+		m_threads.push_back(std::thread(&JobSystem::WorkerMain, this, i + 1));
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); ++i)
+	{
+		m_threads[i].join();
+	}
+}
+
+JobHandle JobSystem::Create(const std::function<void()>& fn, JobQueue queue)
+{
+	JobHandle job = std::make_shared<Job>();
+	job->fn = fn;
+	job->queue = queue;
+	job->waiting = 1;
+	job->done = false;
+	return job;
+}
+
+void JobSystem::AddDependency(const JobHandle& job, const JobHandle& dependency)
+{
+	std::lock_guard<std::mutex> lock(dependency->mutex);
+	if (dependency->done)
+		return;
+
+	job->waiting++;
+	dependency->dependents.push_back(job);
+}
+
+void JobSystem::Submit(const JobHandle& job)
+{
+	Release(job);
+}
+
+JobHandle JobSystem::Run(const std::function<void()>& fn, JobQueue queue)
+{
+	JobHandle job = Create(fn, queue);
+	Submit(job);
+	return job;
+}
+
+void JobSystem::Wait(const JobHandle& job)
+{
+	bool main = (job->queue == JobQueue::Main) && IsMainThread();
+
+	while (job->done == false)
+	{
+		if (main && RunMainJob())
+			continue;
+
+		if (RunOne() == false)
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::ParallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& fn)
+{
+	if (count == 0)
+		return;
+
+	if (m_threads.empty() || count == 1)
+	{
+		fn(0, count);
+		return;
+	}
+
+	size_t chunks = std::min(count, (m_threads.size() + 1) * CHUNKS_PER_THREAD);
+	std::vector<JobHandle> jobs(chunks);
+
+	for (size_t i = 0; i < chunks; ++i)
+	{
+		size_t begin = count * i / chunks;
+		size_t end = count * (i + 1) / chunks;
+
+		jobs[i] = Run([&fn, begin, end]() { fn(begin, end); });
+	}
+
+	for (size_t i = 0; i < chunks; ++i)
+	{
+		Wait(jobs[i]);
+	}
+}
+
+void JobSystem::RunMainThreadJobs(float budgetMs)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	while (RunMainJob())
+	{
+		std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if (budgetMs > 0.0f && elapsed.count() >= budgetMs)
+			break;
+	}
+}
+
+void JobSystem::WorkerMain(uint32_t index)
+{
+	t_deque = index;
+
+	char name[32];
+	snprintf(name, sizeof(name), "Worker %u", index);
+	ProfileThreadName(name);
+
+	for (;;)
+	{
+		// frame work first, then loading
+		if (RunOne() || RunBackgroundJob())
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		while (m_quit == false && m_queued == 0)
+		{
+			m_wake.wait(lock);
+		}
+
+		if (m_quit)
+			return;
+	}
+}
+
+// Newest job of our own deque, else the oldest of another thread's
+bool JobSystem::RunOne()
+{
+	JobHandle job;
+	uint32_t count = m_deques.size();
+
+	for (uint32_t i = 0; i < count && !job; ++i)
+	{
+		JobDeque* deque = m_deques[(t_deque + i) % count].get();
+		std::lock_guard<std::mutex> lock(deque->mutex);
+
+		if (deque->jobs.empty())
+			continue;
+
+		if (i == 0)
+		{
+			job = deque->jobs.back();
+			deque->jobs.pop_back();
+		}
+		else
+		{
+			job = deque->jobs.front();
+			deque->jobs.pop_front();
+		}
+	}
+
+	if (!job)
+		return false;
+
+	m_queued--;
+	Execute(job);
+	return true;
+}
+
+bool JobSystem::RunMainJob()
+{
+	JobHandle job;
+	{
+		std::lock_guard<std::mutex> lock(m_mainJobs.mutex);
+		if (m_mainJobs.jobs.empty())
+			return false;
+
+		job = m_mainJobs.jobs.front();
+		m_mainJobs.jobs.pop_front();
+	}
+
+	Execute(job);
+	return true;
+}
+
+bool JobSystem::RunBackgroundJob()
+{
+	JobHandle job;
+	{
+		std::lock_guard<std::mutex> lock(m_backgroundJobs.mutex);
+		if (m_backgroundJobs.jobs.empty())
+			return false;
+
+		job = m_backgroundJobs.jobs.front();
+		m_backgroundJobs.jobs.pop_front();
+	}
+
+	m_queued--;
+	Execute(job);
+	return true;
+}
+
+void JobSystem::Execute(const JobHandle& job)
+{
+	{
+		PROFILE_ZONE("Job");
+		job->fn();
+	}
+	job->fn = nullptr;
+
+	std::vector<JobHandle> dependents;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		dependents.swap(job->dependents);
+	}
+
+	for (size_t i = 0; i < dependents.size(); ++i)
+	{
+		Release(dependents[i]);
+	}
+}
+
+void JobSystem::Release(const JobHandle& job)
+{
+	if (--job->waiting == 0)
+		Enqueue(job);
+}
+
+void JobSystem::Enqueue(const JobHandle& job)
+{
+	JobDeque* deque = m_deques[t_deque].get();
+	if (job->queue == JobQueue::Main)
+		deque = &m_mainJobs;
+	else if (job->queue == JobQueue::Background)
+		deque = &m_backgroundJobs;
+
+	{
+		std::lock_guard<std::mutex> lock(deque->mutex);
+		deque->jobs.push_back(job);
+	}
+
+	if (job->queue == JobQueue::Main)
+		return;
+
+	m_queued++;
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+	}
+	m_wake.notify_one();
+}
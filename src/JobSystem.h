@@ -0,0 +1,104 @@
+#ifndef CUBE_JOBSYSTEM_H
+#define CUBE_JOBSYSTEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class JobQueue {
+	Any,		// worker deques, never touches GL
+	Main,		// run by the thread that created the JobSystem, may use GL
+	Background,	// long jobs such as loading, only started by idle workers
+			// so no frame's Wait ends up behind one
+};
+
+struct Job
+{
+	std::function<void()> fn;
+	JobQueue queue;
+	std::atomic<int> waiting;	// Submit plus unfinished dependencies
+	std::atomic<bool> done;
+	std::mutex mutex;		// guards dependents against done
+	std::vector<std::shared_ptr<Job> > dependents;
+};
+
+typedef std::shared_ptr<Job> JobHandle;
+
+// Owner pushes and pops the back, other threads steal from the front
+struct JobDeque
+{
+	std::mutex mutex;
+	std::deque<JobHandle> jobs;
+};
+
+// Work-stealing scheduler shared by loading, scene updates and rendering
+// preparation, one deque per thread so parallel work from all of them
+// shares the cores instead of oversubscribing them. Waiting threads run
+// other jobs rather than block.
+class JobSystem
+{
+public:
+	// 0 starts one worker per core besides the creating thread, and
+	// always at least one so JobQueue::Background jobs make progress
+	JobSystem(uint32_t threads = 0);
+	// Outstanding jobs must have been waited for
+	~JobSystem();
+
+	JobHandle Create(const std::function<void()>& fn, JobQueue queue = JobQueue::Any);
+	// job starts only once dependency has finished, call before submitting job
+	void AddDependency(const JobHandle& job, const JobHandle& dependency);
+	void Submit(const JobHandle& job);
+	JobHandle Run(const std::function<void()>& fn, JobQueue queue = JobQueue::Any);
+	bool IsDone(const JobHandle& job) const { return job->done; }
+
+	// Help with other jobs until job is done. The main thread only runs
+	// JobQueue::Main jobs while waiting for one, so a wait for worker jobs
+	// doesn't eat into RunMainThreadJobs' budget. No thread runs
+	// JobQueue::Background jobs while waiting, so jobs must not wait for
+	// them; chain them with AddDependency instead.
+	void Wait(const JobHandle& job);
+
+	// Run fn over [0, count) in chunks spread over every thread, returns
+	// once all chunks are done. May be nested inside jobs.
+	void ParallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& fn);
+
+	// Run queued JobQueue::Main jobs, once a frame from the GL thread. Stops
+	// starting new ones after budgetMs, 0 runs them all.
+	void RunMainThreadJobs(float budgetMs = 0.0f);
+
+	uint32_t ThreadCount() const { return m_threads.size(); }
+	bool IsMainThread() const { return std::this_thread::get_id() == m_mainThread; }
+
+private:
+	JobSystem(const JobSystem&);
+	JobSystem& operator=(const JobSystem&);
+
+	void WorkerMain(uint32_t index);
+	bool RunOne();
+	bool RunMainJob();
+	bool RunBackgroundJob();
+	void Execute(const JobHandle& job);
+	void Release(const JobHandle& job);
+	void Enqueue(const JobHandle& job);
+
+	std::vector<std::thread> m_threads;
+	std::vector<std::unique_ptr<JobDeque> > m_deques;	// 0 is the main thread's
+	JobDeque m_mainJobs;
+	JobDeque m_backgroundJobs;	// shared by the workers, oldest first
+	std::thread::id m_mainThread;
+
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+	std::atomic<uint32_t> m_queued;		// jobs sitting in m_deques and m_backgroundJobs
+	bool m_quit;
+};
+
+#endif // CUBE_JOBSYSTEM_H
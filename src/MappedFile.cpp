@@ -0,0 +1,72 @@
+#include "MappedFile.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile()
+{
+	m_pData = nullptr;
+	m_size = 0;
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+GLResult MappedFile::Open(const char* pFileName)
+{
+	Close();
+
+	int fd = open(pFileName, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "[ERROR] Could not open %s: %s\n",
+			pFileName, strerror(errno));
+		return GLResult::Failed;
+	}
+
+	GLResult result = GLResult::Success;
+	struct stat info;
+
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		fprintf(stderr, "[ERROR] Could not stat %s or file is empty\n", pFileName);
+		result = GLResult::Failed;
+	}
+
+	if (result == GLResult::Success)
+	{
+		void* pData = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (pData == MAP_FAILED)
+		{
+			fprintf(stderr, "[ERROR] Could not map %s: %s\n",
+				pFileName, strerror(errno));
+			result = GLResult::Failed;
+		}
+		else
+		{
+			m_pData = static_cast<unsigned char*>(pData);
+			m_size = info.st_size;
+		}
+	}
+
+	// the mapping holds its own reference to the file
+	close(fd);
+
+	return result;
+}
+
+void MappedFile::Close()
+{
+	if (m_pData != nullptr)
+		munmap(m_pData, m_size);
+
+	m_pData = nullptr;
+	m_size = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef CUBE_MAPPEDFILE_H
+#define CUBE_MAPPEDFILE_H
+
+#include <stddef.h>
+
+#include "glutils.h"
+
+// Read-only mapping of a whole file, pages are loaded on first touch
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	GLResult Open(const char* pFileName);
+	void Close();
+
+	const unsigned char* Data() const { return m_pData; }
+	size_t Size() const { return m_size; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	unsigned char* m_pData;
+	size_t m_size;
+};
+
+#endif // CUBE_MAPPEDFILE_H
@@ -0,0 +1,117 @@
+#include "MipKernels.h"
+
+#include "AnimKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MIP_KERNELS_X86
+#include <emmintrin.h>
+#define TARGET_SSE __attribute__((target("sse2")))
+#endif
+
+uint32_t MipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+
+	while (width > 1 || height > 1)
+	{
+		width = MipSize(width);
+		height = MipSize(height);
+		levels++;
+	}
+
+	return levels;
+}
+
+// Destination pixels [begin, end) of one row, sources are clamped so 1 wide
+// levels repeat their only column
+static void DownsampleRowScalar(const unsigned char* pRow0,
+				const unsigned char* pRow1,
+				uint32_t srcWidth,
+				unsigned char* pDst,
+				uint32_t begin,
+				uint32_t end)
+{
+	for (uint32_t x = begin; x < end; ++x)
+	{
+		uint32_t x0 = 2 * x;
+		uint32_t x1 = (x0 + 1 < srcWidth) ? x0 + 1 : x0;
+
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			uint32_t sum = pRow0[4 * x0 + c] + pRow0[4 * x1 + c] +
+				pRow1[4 * x0 + c] + pRow1[4 * x1 + c];
+			pDst[4 * x + c] = (sum + 2) >> 2;
+		}
+	}
+}
+
+#ifdef MIP_KERNELS_X86
+
+// 4 destination pixels at a time from 8 source pixels of each row, returns
+// how many were written
+TARGET_SSE static uint32_t DownsampleRowSSE(const unsigned char* pRow0,
+					    const unsigned char* pRow1,
+					    unsigned char* pDst,
+					    uint32_t count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(2);
+	uint32_t x = 0;
+
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow0 + 8 * x));
+		__m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow0 + 8 * x + 16));
+		__m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow1 + 8 * x));
+		__m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow1 + 8 * x + 16));
+
+		// vertical pairs widened to 16 bits, two pixels per register
+		__m128i v01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i v23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i v45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i v67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+		// then horizontal pairs
+		__m128i s01 = _mm_add_epi16(_mm_unpacklo_epi64(v01, v23), _mm_unpackhi_epi64(v01, v23));
+		__m128i s23 = _mm_add_epi16(_mm_unpacklo_epi64(v45, v67), _mm_unpackhi_epi64(v45, v67));
+
+		s01 = _mm_srli_epi16(_mm_add_epi16(s01, round), 2);
+		s23 = _mm_srli_epi16(_mm_add_epi16(s23, round), 2);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + 4 * x), _mm_packus_epi16(s01, s23));
+	}
+
+	return x;
+}
+
+#endif // MIP_KERNELS_X86
+
+void DownsampleRGBA8(const unsigned char* pSrc,
+		     uint32_t srcWidth,
+		     uint32_t srcHeight,
+		     unsigned char* pDst,
+		     uint32_t rowBegin,
+		     uint32_t rowEnd)
+{
+	uint32_t dstWidth = MipSize(srcWidth);
+	size_t srcPitch = 4 * static_cast<size_t>(srcWidth);
+	size_t dstPitch = 4 * static_cast<size_t>(dstWidth);
+
+	for (uint32_t y = rowBegin; y < rowEnd; ++y)
+	{
+		uint32_t y0 = 2 * y;
+		uint32_t y1 = (y0 + 1 < srcHeight) ? y0 + 1 : y0;
+		const unsigned char* pRow0 = pSrc + y0 * srcPitch;
+		const unsigned char* pRow1 = pSrc + y1 * srcPitch;
+		unsigned char* pRow = pDst + y * dstPitch;
+		uint32_t x = 0;
+
+#ifdef MIP_KERNELS_X86
+		// both source columns exist for every pixel once the source is 2 wide
+		if (srcWidth > 1 && GetSimdLevel() != SimdLevel::Scalar)
+			x = DownsampleRowSSE(pRow0, pRow1, pRow, dstWidth);
+#endif
+
+		DownsampleRowScalar(pRow0, pRow1, srcWidth, pRow, x, dstWidth);
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef CUBE_MIPKERNELS_H
+#define CUBE_MIPKERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CPU mip chain building for RGBA8 images, 2x2 box filter like
+// glGenerateMipmap, SSE2 when GetSimdLevel() allows it.
+
+// Levels from width x height down to 1x1, inclusive
+uint32_t MipLevelCount(uint32_t width, uint32_t height);
+
+// Size of the level below one of size
+inline uint32_t MipSize(uint32_t size) { return (size > 1) ? size / 2 : 1; }
+
+// Rows [rowBegin, rowEnd) of the level below pSrc, so large levels can be
+// split between threads
+void DownsampleRGBA8(const unsigned char* pSrc,
+		     uint32_t srcWidth,
+		     uint32_t srcHeight,
+		     unsigned char* pDst,
+		     uint32_t rowBegin,
+		     uint32_t rowEnd);
+
+#endif // CUBE_MIPKERNELS_H
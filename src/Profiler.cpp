@@ -0,0 +1,203 @@
+#include "Profiler.h"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+struct ProfileEvent
+{
+	const char* pName;
+	uint64_t startNs;
+	uint64_t endNs;
+};
+
+// Written only by its thread, head is published after the event so a
+// reader sees whole events up to it
+struct ProfileThread
+{
+	ProfileEvent events[PROFILE_RING];
+	std::atomic<uint64_t> head;	// events ever recorded
+	uint32_t id;
+	char name[32];
+};
+
+// Threads are never unregistered, a trace may still read them after exit
+static std::mutex s_threadsMutex;
+static std::vector<ProfileThread*> s_threads;
+static thread_local ProfileThread* t_thread = nullptr;
+
+// Frame starts, frame n is kept at n % PROFILE_FRAMES
+static uint64_t s_frameStarts[PROFILE_FRAMES];
+static uint32_t s_framesKept = 0;
+static uint32_t s_lastFrame = 0;
+
+static ProfileThread* ThisThread()
+{
+	if (t_thread != nullptr)
+		return t_thread;
+
+	ProfileThread* thread = new ProfileThread();
+	thread->head = 0;
+	thread->name[0] = '\0';
+
+	std::lock_guard<std::mutex> lock(s_threadsMutex);
+	thread->id = s_threads.size() + 1;
+	s_threads.push_back(thread);
+	t_thread = thread;
+
+	return thread;
+}
+
+void ProfileRecord(const char* pName, uint64_t startNs, uint64_t endNs)
+{
+	ProfileThread* thread = ThisThread();
+	uint64_t head = thread->head.load(std::memory_order_relaxed);
+
+	ProfileEvent* event = &thread->events[head % PROFILE_RING];
+	event->pName = pName;
+	event->startNs = startNs;
+	event->endNs = endNs;
+
+	thread->head.store(head + 1, std::memory_order_release);
+}
+
+void ProfileThreadName(const char* pName)
+{
+#ifndef CUBE_NO_PROFILE
+	ProfileThread* thread = ThisThread();
+
+	std::lock_guard<std::mutex> lock(s_threadsMutex);
+	snprintf(thread->name, sizeof(thread->name), "%s", pName);
+#endif // CUBE_NO_PROFILE
+}
+
+void ProfileFrame(uint32_t frame)
+{
+	s_frameStarts[frame % PROFILE_FRAMES] = ProfileNow();
+	s_lastFrame = frame;
+	if (s_framesKept < PROFILE_FRAMES)
+		s_framesKept++;
+}
+
+static bool IsFrameKept(uint32_t frame)
+{
+	return s_framesKept > 0 && frame <= s_lastFrame && s_lastFrame - frame < s_framesKept;
+}
+
+// Events of thread that were not overwritten while they were copied
+static void CopyEvents(ProfileThread* thread, std::vector<ProfileEvent>* pEvents)
+{
+	uint64_t head = thread->head.load(std::memory_order_acquire);
+	uint64_t first = (head > PROFILE_RING) ? head - PROFILE_RING : 0;
+
+	std::vector<ProfileEvent> events;
+	for (uint64_t i = first; i < head; ++i)
+	{
+		events.push_back(thread->events[i % PROFILE_RING]);
+	}
+
+	// the writer may be filling slot after, and has filled those before it
+	uint64_t after = thread->head.load(std::memory_order_acquire);
+	uint64_t safe = (after >= PROFILE_RING) ? after - PROFILE_RING + 1 : 0;
+
+	pEvents->clear();
+	for (uint64_t i = first; i < head; ++i)
+	{
+		if (i >= safe)
+			pEvents->push_back(events[i - first]);
+	}
+}
+
+GLResult WriteProfileTrace(const char* pFileName, uint32_t first, uint32_t last)
+{
+#ifdef CUBE_NO_PROFILE
+	fprintf(stderr, "[WARN] Profiling is compiled out, %s has no zones\n", pFileName);
+#endif // CUBE_NO_PROFILE
+
+	uint32_t asked = first;
+
+	// clamp to the frames still kept
+	if (last > s_lastFrame)
+		last = s_lastFrame;
+	if (s_framesKept > 0 && first < s_lastFrame + 1 - s_framesKept)
+		first = s_lastFrame + 1 - s_framesKept;
+
+	if (IsFrameKept(first) == false || first > last)
+	{
+		fprintf(stderr, "[ERROR] Frame %u is no longer kept or not reached, no trace written\n", asked);
+		return GLResult::Failed;
+	}
+
+	uint64_t beginNs = s_frameStarts[first % PROFILE_FRAMES];
+	uint64_t endNs = (last < s_lastFrame) ? s_frameStarts[(last + 1) % PROFILE_FRAMES] : ProfileNow();
+
+	FILE* pFile = fopen(pFileName, "w");
+	if (pFile == nullptr)
+	{
+		fprintf(stderr, "[ERROR] Could not write %s\n", pFileName);
+		return GLResult::Failed;
+	}
+
+	std::vector<ProfileThread*> threads;
+	{
+		std::lock_guard<std::mutex> lock(s_threadsMutex);
+		threads = s_threads;
+	}
+
+	// times are in microseconds from the start of the first frame
+	fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(pFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"cube_render\"}}");
+
+	std::vector<ProfileEvent> events;
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		ProfileThread* thread = threads[i];
+
+		{
+			std::lock_guard<std::mutex> lock(s_threadsMutex);
+			if (thread->name[0] != '\0')
+				fprintf(pFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+					thread->id, thread->name);
+		}
+		fprintf(pFile, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+			thread->id, thread->id);
+
+		// zone names are string literals, nothing to escape
+		CopyEvents(thread, &events);
+		for (size_t j = 0; j < events.size(); ++j)
+		{
+			const ProfileEvent* event = &events[j];
+			if (event->endNs <= beginNs || event->startNs >= endNs)
+				continue;
+
+			uint64_t start = (event->startNs > beginNs) ? event->startNs : beginNs;
+			uint64_t end = (event->endNs < endNs) ? event->endNs : endNs;
+			fprintf(pFile, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				event->pName, thread->id,
+				(start - beginNs) / 1000.0,
+				(end - start) / 1000.0);
+		}
+	}
+
+	// frame boundaries across every thread
+	for (uint32_t frame = first; frame <= last; ++frame)
+	{
+		fprintf(pFile, ",\n{\"name\":\"Frame %u\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+			frame, ThisThread()->id,
+			(s_frameStarts[frame % PROFILE_FRAMES] - beginNs) / 1000.0);
+	}
+
+	fprintf(pFile, "\n]}\n");
+
+	bool failed = (ferror(pFile) != 0);
+	if (fclose(pFile) != 0 || failed)
+	{
+		fprintf(stderr, "[ERROR] Could not write %s\n", pFileName);
+		return GLResult::Failed;
+	}
+
+	fprintf(stderr, "Wrote frames %u-%u to %s\n", first, last, pFileName);
+	return GLResult::Success;
+}
@@ -0,0 +1,61 @@
+#ifndef CUBE_PROFILER_H
+#define CUBE_PROFILER_H
+
+#include <stdint.h>
+
+#include <chrono>
+
+#include "glutils.h"
+
+// zones kept per thread, older ones are overwritten
+#define PROFILE_RING 65536
+// frame starts kept, the oldest frame a trace can begin at
+#define PROFILE_FRAMES 4096
+// frames written by a trace requested without a window, e.g. from a key
+#define PROFILE_TRACE_FRAMES 120
+
+// CPU timeline of named zones, written as Chrome trace JSON that
+// chrome://tracing and Perfetto open. Every thread records into a ring of
+// its own without locking. Building with -DCUBE_NO_PROFILE compiles the
+// zones out, traces are then empty.
+
+static inline uint64_t ProfileNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// pName must outlive the trace, zone names are string literals
+void ProfileRecord(const char* pName, uint64_t startNs, uint64_t endNs);
+// Shown for the calling thread, copied
+void ProfileThreadName(const char* pName);
+// Start of frame, from the thread that writes traces. Frames count up by
+// one from 0.
+void ProfileFrame(uint32_t frame);
+
+// Zones that overlap frames first to last, last may be the current frame.
+// The window is clamped to the frames still kept.
+GLResult WriteProfileTrace(const char* pFileName, uint32_t first, uint32_t last);
+
+class ProfileZone
+{
+public:
+	ProfileZone(const char* pName) : m_pName(pName), m_start(ProfileNow()) {}
+	~ProfileZone() { ProfileRecord(m_pName, m_start, ProfileNow()); }
+
+private:
+	const char* m_pName;
+	uint64_t m_start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+#ifndef CUBE_NO_PROFILE
+// Time the rest of the enclosing scope
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name) do {} while (0)
+#endif // CUBE_NO_PROFILE
+
+#endif // CUBE_PROFILER_H
@@ -3,12 +3,74 @@
 
 #include "Camera.h"
 
+#define NUM_SIDES 6
+
+// Uniform block binding point for the per-face view-projections used by
+// layered rendering (layout std140, mat4 view_projection[NUM_SIDES] followed
+// by int face_mask, one bit per face that should be drawn).
+#define CUBE_FACES_BINDING 0
+
+// Geometry shader of every scene's layered path, so the CubeFaces block
+// has one layout. Vertex shaders write v_texcoord and v_color.
+static const char layered_gs_src[] =
+"#version 330\n\
+layout(triangles) in;\n\
+layout(triangle_strip, max_vertices = 18) out;\n\
+layout(std140) uniform CubeFaces {\n\
+    mat4 view_projection[6];\n\
+    int face_mask;\n\
+};\n\
+in vec2 v_texcoord[];\n\
+in vec4 v_color[];\n\
+out vec2 texcoord;\n\
+out vec4 color;\n\
+void main() {\n\
+    for (int face = 0; face < 6; ++face) {\n\
+        if ((face_mask & (1 << face)) == 0)\n\
+            continue;\n\
+        gl_Layer = face;\n\
+        for (int i = 0; i < 3; ++i) {\n\
+            texcoord = v_texcoord[i];\n\
+            color = v_color[i];\n\
+            gl_Position = view_projection[face] * gl_in[i].gl_Position;\n\
+            EmitVertex();\n\
+        }\n\
+        EndPrimitive();\n\
+    }\n\
+}";
+
+class SoftRasterizer;
+
 class Scene
 {
 public:
+	Scene() : m_generation(0), m_drawCalls(0) {};
 	virtual ~Scene() {};
 	virtual void Step(uint32_t stepMs) = 0;
 	virtual void Render(Camera *pCamera) = 0;
+
+	// Render every face of the bound layered framebuffer in one traversal,
+	// reading face transforms from the CUBE_FACES_BINDING block. The caller
+	// clears. Returns false if the scene has no layered path.
+	virtual bool RenderLayered() { return false; }
+
+	// Queue the scene's world space geometry on the CPU rasterizer, which
+	// draws it into every face. Returns false if the scene has no CPU path.
+	virtual bool RenderSoftware(SoftRasterizer *pRaster) { return false; }
+
+	// False while content is still loading, renderers show something else
+	virtual bool IsReady() const { return true; }
+
+	// Content generation, bumped whenever a render of the scene would differ
+	uint64_t Generation() const { return m_generation; }
+	bool ChangedSince(uint64_t generation) const { return m_generation != generation; }
+
+	// Draws issued so far, GL and software, for benchmarks
+	uint64_t DrawCalls() const { return m_drawCalls; }
+
+protected:
+	uint64_t m_generation;
+	uint64_t m_drawCalls;
 };
 
 #endif // CUBE_SCENE_H
@@ -0,0 +1,809 @@
+#include "SceneBake.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "MipKernels.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+struct BakeHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;
+	uint64_t bufferOffset[BAKE_BUFFER_COUNT];
+	uint64_t bufferSize[BAKE_BUFFER_COUNT];
+	uint64_t tablesOffset;
+	uint64_t tablesSize;
+};
+
+static size_t Align(size_t value)
+{
+	return (value + BAKE_ALIGNMENT - 1) & ~static_cast<size_t>(BAKE_ALIGNMENT - 1);
+}
+
+bool MipmapFilter(int minFilter)
+{
+	return (minFilter == GL_NEAREST_MIPMAP_NEAREST) ||
+		(minFilter == GL_NEAREST_MIPMAP_LINEAR) ||
+		(minFilter == GL_LINEAR_MIPMAP_NEAREST) ||
+		(minFilter == GL_LINEAR_MIPMAP_LINEAR);
+}
+
+bool ImageMipmapped(const tinygltf::Model& model, size_t image)
+{
+	for (size_t i = 0; i < model.textures.size(); ++i)
+	{
+		const tinygltf::Texture* texture = &model.textures[i];
+
+		if (texture->source == static_cast<int>(image) &&
+		    texture->sampler >= 0 &&
+		    MipmapFilter(model.samplers[texture->sampler].minFilter))
+			return true;
+	}
+
+	return false;
+}
+
+static void InferTarget(GLenum* pTarget, GLenum target)
+{
+	if (*pTarget == 0)
+	{
+		*pTarget = target;
+	}
+	else if (*pTarget != target)
+	{
+		fprintf(stderr, "[WARN] bufferView used as both vertex and index data, keeping %x\n",
+			*pTarget);
+	}
+}
+
+void InferViewTargets(const tinygltf::Model& model, std::vector<GLenum>* pTargets)
+{
+	pTargets->resize(model.bufferViews.size());
+
+	for (size_t i = 0; i < model.bufferViews.size(); ++i)
+	{
+		(*pTargets)[i] = model.bufferViews[i].target;
+	}
+
+	for (size_t i = 0; i < model.meshes.size(); ++i)
+	{
+		const tinygltf::Mesh* mesh = &model.meshes[i];
+
+		for (size_t j = 0; j < mesh->primitives.size(); ++j)
+		{
+			const tinygltf::Primitive* primitive = &mesh->primitives[j];
+
+			for (std::map<std::string, int>::const_iterator it = primitive->attributes.begin(); it != primitive->attributes.end(); ++it)
+			{
+				int view = model.accessors[it->second].bufferView;
+				if (view >= 0)
+					InferTarget(&(*pTargets)[view], GL_ARRAY_BUFFER);
+			}
+
+			if (primitive->indices >= 0)
+			{
+				int view = model.accessors[primitive->indices].bufferView;
+				if (view >= 0)
+					InferTarget(&(*pTargets)[view], GL_ELEMENT_ARRAY_BUFFER);
+			}
+		}
+	}
+}
+
+float ReadComponent(const unsigned char* pData, int componentType, bool normalized)
+{
+	switch (componentType)
+	{
+	case TINYGLTF_COMPONENT_TYPE_BYTE:
+	{
+		int8_t value;
+		memcpy(&value, pData, sizeof(value));
+		return normalized ? std::max(value / 127.0f, -1.0f) : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return normalized ? *pData / 255.0f : *pData;
+	case TINYGLTF_COMPONENT_TYPE_SHORT:
+	{
+		int16_t value;
+		memcpy(&value, pData, sizeof(value));
+		return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+	{
+		uint16_t value;
+		memcpy(&value, pData, sizeof(value));
+		return normalized ? value / 65535.0f : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+	{
+		uint32_t value;
+		memcpy(&value, pData, sizeof(value));
+		return static_cast<float>(value);
+	}
+	case TINYGLTF_COMPONENT_TYPE_FLOAT:
+	{
+		float value;
+		memcpy(&value, pData, sizeof(value));
+		return value;
+	}
+	}
+
+	return 0.0f;
+}
+
+uint64_t HashBytes(const unsigned char* pData, size_t size)
+{
+	uint64_t hash = FNV_OFFSET_BASIS;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash = (hash ^ pData[i]) * FNV_PRIME;
+	}
+
+	return hash;
+}
+
+// Model tables are a flat stream of these, strings and arrays count first
+class BakeWriter
+{
+public:
+	void U8(uint8_t value) { Bytes(&value, sizeof(value)); }
+	void U32(uint32_t value) { Bytes(&value, sizeof(value)); }
+	void I32(int32_t value) { Bytes(&value, sizeof(value)); }
+	void U64(uint64_t value) { Bytes(&value, sizeof(value)); }
+	void F64(double value) { Bytes(&value, sizeof(value)); }
+
+	void String(const std::string& value)
+	{
+		U32(value.size());
+		Bytes(value.data(), value.size());
+	}
+
+	void Doubles(const std::vector<double>& values)
+	{
+		U32(values.size());
+		Bytes(values.data(), values.size() * sizeof(double));
+	}
+
+	void Ints(const std::vector<int>& values)
+	{
+		U32(values.size());
+		Bytes(values.data(), values.size() * sizeof(int));
+	}
+
+	const std::vector<unsigned char>& Data() const { return m_data; }
+
+private:
+	void Bytes(const void* pData, size_t size)
+	{
+		const unsigned char* pBytes = static_cast<const unsigned char*>(pData);
+		m_data.insert(m_data.end(), pBytes, pBytes + size);
+	}
+
+	std::vector<unsigned char> m_data;
+};
+
+// Reads past the end return zeros and leave Failed() set
+class BakeReader
+{
+public:
+	BakeReader(const unsigned char* pData, size_t size) :
+		m_pData(pData), m_size(size), m_offset(0), m_failed(false) {}
+
+	uint8_t U8() { uint8_t value = 0; Bytes(&value, sizeof(value)); return value; }
+	uint32_t U32() { uint32_t value = 0; Bytes(&value, sizeof(value)); return value; }
+	int32_t I32() { int32_t value = 0; Bytes(&value, sizeof(value)); return value; }
+	uint64_t U64() { uint64_t value = 0; Bytes(&value, sizeof(value)); return value; }
+
+	// element counts are checked against what's left before allocating
+	uint32_t Count(size_t elementSize)
+	{
+		uint32_t count = U32();
+		if (static_cast<uint64_t>(count) * elementSize > m_size - m_offset)
+		{
+			m_failed = true;
+			return 0;
+		}
+		return count;
+	}
+
+	std::string String()
+	{
+		uint32_t size = Count(1);
+		std::string value(reinterpret_cast<const char*>(m_pData + m_offset), size);
+		m_offset += size;
+		return value;
+	}
+
+	std::vector<double> Doubles()
+	{
+		std::vector<double> values(Count(sizeof(double)));
+		Bytes(values.data(), values.size() * sizeof(double));
+		return values;
+	}
+
+	std::vector<int> Ints()
+	{
+		std::vector<int> values(Count(sizeof(int)));
+		Bytes(values.data(), values.size() * sizeof(int));
+		return values;
+	}
+
+	bool Failed() const { return m_failed; }
+
+private:
+	void Bytes(void* pData, size_t size)
+	{
+		if (size > m_size - m_offset)
+		{
+			m_failed = true;
+			return;
+		}
+		memcpy(pData, m_pData + m_offset, size);
+		m_offset += size;
+	}
+
+	const unsigned char* m_pData;
+	size_t m_size;
+	size_t m_offset;
+	bool m_failed;
+};
+
+static void WriteTables(BakeWriter* pOut,
+			const tinygltf::Model& model,
+			const std::vector<int>& viewBuffer,
+			const std::vector<size_t>& viewOffset,
+			const std::vector<size_t>& viewLength,
+			const std::vector<BakeImage>& images,
+			const std::vector<std::vector<uint64_t> >& levelOffsets)
+{
+	pOut->U32(model.accessors.size());
+	for (size_t i = 0; i < model.accessors.size(); ++i)
+	{
+		const tinygltf::Accessor* accessor = &model.accessors[i];
+		pOut->I32(accessor->bufferView);
+		pOut->U64(accessor->byteOffset);
+		pOut->U8(accessor->normalized);
+		pOut->I32(accessor->componentType);
+		pOut->U64(accessor->count);
+		pOut->I32(accessor->type);
+		pOut->Doubles(accessor->minValues);
+		pOut->Doubles(accessor->maxValues);
+	}
+
+	pOut->U32(model.bufferViews.size());
+	for (size_t i = 0; i < model.bufferViews.size(); ++i)
+	{
+		const tinygltf::BufferView* bufferView = &model.bufferViews[i];
+		pOut->I32(viewBuffer[i]);
+		pOut->U64(viewOffset[i]);
+		pOut->U64(viewLength[i]);
+		pOut->U64(bufferView->byteStride);
+		pOut->I32(bufferView->target);
+	}
+
+	pOut->U32(model.meshes.size());
+	for (size_t i = 0; i < model.meshes.size(); ++i)
+	{
+		const tinygltf::Mesh* mesh = &model.meshes[i];
+		pOut->String(mesh->name);
+		pOut->U32(mesh->primitives.size());
+
+		for (size_t j = 0; j < mesh->primitives.size(); ++j)
+		{
+			const tinygltf::Primitive* primitive = &mesh->primitives[j];
+			pOut->U32(primitive->attributes.size());
+
+			for (std::map<std::string, int>::const_iterator it = primitive->attributes.begin(); it != primitive->attributes.end(); ++it)
+			{
+				pOut->String(it->first);
+				pOut->I32(it->second);
+			}
+
+			pOut->I32(primitive->material);
+			pOut->I32(primitive->indices);
+			pOut->I32(primitive->mode);
+		}
+	}
+
+	// only what drawing reads, the base color
+	pOut->U32(model.materials.size());
+	for (size_t i = 0; i < model.materials.size(); ++i)
+	{
+		const tinygltf::Material* material = &model.materials[i];
+		int texture = -1;
+		std::vector<double> factor;
+
+		tinygltf::ParameterMap::const_iterator it = material->values.find("baseColorTexture");
+		if (it != material->values.end())
+			texture = it->second.TextureIndex();
+
+		it = material->values.find("baseColorFactor");
+		if (it != material->values.end())
+			factor = it->second.number_array;
+
+		pOut->String(material->name);
+		pOut->I32(texture);
+		pOut->Doubles(factor);
+	}
+
+	pOut->U32(model.textures.size());
+	for (size_t i = 0; i < model.textures.size(); ++i)
+	{
+		pOut->I32(model.textures[i].source);
+		pOut->I32(model.textures[i].sampler);
+	}
+
+	pOut->U32(model.samplers.size());
+	for (size_t i = 0; i < model.samplers.size(); ++i)
+	{
+		const tinygltf::Sampler* sampler = &model.samplers[i];
+		pOut->I32(sampler->minFilter);
+		pOut->I32(sampler->magFilter);
+		pOut->I32(sampler->wrapS);
+		pOut->I32(sampler->wrapT);
+	}
+
+	pOut->U32(model.images.size());
+	for (size_t i = 0; i < model.images.size(); ++i)
+	{
+		bool decoded = (i < images.size() && images[i].levels.empty() == false);
+		pOut->U32(decoded ? images[i].width : 0);
+		pOut->U32(decoded ? images[i].height : 0);
+		pOut->U8(decoded ? images[i].mipmapped : 0);
+		pOut->U32(decoded ? levelOffsets[i].size() : 0);
+
+		for (size_t level = 0; decoded && level < levelOffsets[i].size(); ++level)
+		{
+			pOut->U64(levelOffsets[i][level]);
+		}
+	}
+
+	pOut->U32(model.nodes.size());
+	for (size_t i = 0; i < model.nodes.size(); ++i)
+	{
+		const tinygltf::Node* node = &model.nodes[i];
+		pOut->String(node->name);
+		pOut->I32(node->mesh);
+		pOut->I32(node->skin);
+		pOut->Ints(node->children);
+		pOut->Doubles(node->rotation);
+		pOut->Doubles(node->scale);
+		pOut->Doubles(node->translation);
+		pOut->Doubles(node->matrix);
+	}
+
+	pOut->U32(model.scenes.size());
+	for (size_t i = 0; i < model.scenes.size(); ++i)
+	{
+		pOut->String(model.scenes[i].name);
+		pOut->Ints(model.scenes[i].nodes);
+	}
+	pOut->I32(model.defaultScene);
+
+	pOut->U32(model.skins.size());
+	for (size_t i = 0; i < model.skins.size(); ++i)
+	{
+		const tinygltf::Skin* skin = &model.skins[i];
+		pOut->String(skin->name);
+		pOut->I32(skin->inverseBindMatrices);
+		pOut->I32(skin->skeleton);
+		pOut->Ints(skin->joints);
+	}
+
+	pOut->U32(model.animations.size());
+	for (size_t i = 0; i < model.animations.size(); ++i)
+	{
+		const tinygltf::Animation* animation = &model.animations[i];
+		pOut->String(animation->name);
+
+		pOut->U32(animation->channels.size());
+		for (size_t j = 0; j < animation->channels.size(); ++j)
+		{
+			pOut->I32(animation->channels[j].sampler);
+			pOut->I32(animation->channels[j].target_node);
+			pOut->String(animation->channels[j].target_path);
+		}
+
+		pOut->U32(animation->samplers.size());
+		for (size_t j = 0; j < animation->samplers.size(); ++j)
+		{
+			pOut->I32(animation->samplers[j].input);
+			pOut->I32(animation->samplers[j].output);
+			pOut->String(animation->samplers[j].interpolation);
+		}
+	}
+}
+
+// Zero pad from *pPosition up to offset, then write
+static bool WriteAt(FILE* pFile, size_t* pPosition, size_t offset, const void* pData, size_t size)
+{
+	static const unsigned char zeros[BAKE_ALIGNMENT] = {};
+
+	while (*pPosition < offset)
+	{
+		size_t pad = offset - *pPosition;
+		if (pad > sizeof(zeros))
+			pad = sizeof(zeros);
+		if (fwrite(zeros, 1, pad, pFile) != pad)
+			return false;
+		*pPosition += pad;
+	}
+
+	if (size > 0 && fwrite(pData, 1, size, pFile) != size)
+		return false;
+
+	*pPosition += size;
+	return true;
+}
+
+GLResult WriteBake(const char* pFileName,
+		   uint64_t sourceHash,
+		   const tinygltf::Model& model,
+		   const std::vector<const unsigned char*>& bufferData,
+		   const std::vector<GLenum>& viewTargets,
+		   const std::vector<BakeImage>& images)
+{
+	size_t views = model.bufferViews.size();
+	std::vector<int> viewBuffer(views, BAKE_DATA_BUFFER);
+	std::vector<size_t> viewOffset(views, 0);
+	std::vector<size_t> viewLength(views, 0);
+	size_t bufferSize[BAKE_BUFFER_COUNT] = {};
+
+	// encoded images are replaced by their decoded levels
+	std::vector<bool> imageView(views, false);
+	for (size_t i = 0; i < model.images.size(); ++i)
+	{
+		int view = model.images[i].bufferView;
+		if (view >= 0 && static_cast<size_t>(view) < views)
+			imageView[view] = true;
+	}
+
+	for (size_t i = 0; i < views; ++i)
+	{
+		if (imageView[i])
+			continue;
+
+		if (viewTargets[i] == GL_ARRAY_BUFFER)
+			viewBuffer[i] = BAKE_VERTEX_BUFFER;
+		else if (viewTargets[i] == GL_ELEMENT_ARRAY_BUFFER)
+			viewBuffer[i] = BAKE_INDEX_BUFFER;
+
+		size_t* size = &bufferSize[viewBuffer[i]];
+		viewOffset[i] = Align(*size);
+		viewLength[i] = model.bufferViews[i].byteLength;
+		*size = viewOffset[i] + viewLength[i];
+	}
+
+	BakeHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = BAKE_MAGIC;
+	header.version = BAKE_VERSION;
+	header.sourceHash = sourceHash;
+
+	size_t cursor = sizeof(header);
+	for (int i = 0; i < BAKE_BUFFER_COUNT; ++i)
+	{
+		header.bufferOffset[i] = Align(cursor);
+		header.bufferSize[i] = bufferSize[i];
+		cursor = header.bufferOffset[i] + bufferSize[i];
+	}
+
+	std::vector<std::vector<uint64_t> > levelOffsets(images.size());
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		uint32_t width = images[i].width;
+		uint32_t height = images[i].height;
+
+		for (size_t level = 0; level < images[i].levels.size(); ++level)
+		{
+			levelOffsets[i].push_back(Align(cursor));
+			cursor = levelOffsets[i].back() + 4 * static_cast<size_t>(width) * height;
+			width = MipSize(width);
+			height = MipSize(height);
+		}
+	}
+
+	BakeWriter tables;
+	WriteTables(&tables, model, viewBuffer, viewOffset, viewLength, images, levelOffsets);
+	header.tablesOffset = Align(cursor);
+	header.tablesSize = tables.Data().size();
+
+	FILE* pFile = fopen(pFileName, "wb");
+	if (pFile == nullptr)
+	{
+		fprintf(stderr, "[ERROR] Could not create %s\n", pFileName);
+		return GLResult::Failed;
+	}
+
+	size_t position = 0;
+	bool ok = WriteAt(pFile, &position, 0, &header, sizeof(header));
+
+	for (int id = 0; id < BAKE_BUFFER_COUNT; ++id)
+	{
+		for (size_t i = 0; ok && i < views; ++i)
+		{
+			if (viewBuffer[i] != id || viewLength[i] == 0)
+				continue;
+
+			const tinygltf::BufferView* bufferView = &model.bufferViews[i];
+			ok = WriteAt(pFile, &position,
+				     header.bufferOffset[id] + viewOffset[i],
+				     bufferData[bufferView->buffer] + bufferView->byteOffset,
+				     viewLength[i]);
+		}
+	}
+
+	for (size_t i = 0; ok && i < images.size(); ++i)
+	{
+		uint32_t width = images[i].width;
+		uint32_t height = images[i].height;
+
+		for (size_t level = 0; ok && level < images[i].levels.size(); ++level)
+		{
+			ok = WriteAt(pFile, &position, levelOffsets[i][level],
+				     images[i].levels[level],
+				     4 * static_cast<size_t>(width) * height);
+			width = MipSize(width);
+			height = MipSize(height);
+		}
+	}
+
+	if (ok)
+		ok = WriteAt(pFile, &position, header.tablesOffset, tables.Data().data(), tables.Data().size());
+
+	if (fclose(pFile) != 0)
+		ok = false;
+
+	if (ok == false)
+	{
+		fprintf(stderr, "[ERROR] Could not write %s\n", pFileName);
+		remove(pFileName);
+		return GLResult::Failed;
+	}
+
+	return GLResult::Success;
+}
+
+static bool ReadTables(BakeReader* pIn, size_t fileSize, tinygltf::Model* pModel, std::vector<BakeImage>* pImages, const unsigned char* pData)
+{
+	pModel->accessors.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->accessors.size(); ++i)
+	{
+		tinygltf::Accessor* accessor = &pModel->accessors[i];
+		accessor->bufferView = pIn->I32();
+		accessor->byteOffset = pIn->U64();
+		accessor->normalized = pIn->U8() != 0;
+		accessor->componentType = pIn->I32();
+		accessor->count = pIn->U64();
+		accessor->type = pIn->I32();
+		accessor->minValues = pIn->Doubles();
+		accessor->maxValues = pIn->Doubles();
+	}
+
+	pModel->bufferViews.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->bufferViews.size(); ++i)
+	{
+		tinygltf::BufferView* bufferView = &pModel->bufferViews[i];
+		bufferView->buffer = pIn->I32();
+		bufferView->byteOffset = pIn->U64();
+		bufferView->byteLength = pIn->U64();
+		bufferView->byteStride = pIn->U64();
+		bufferView->target = pIn->I32();
+	}
+
+	pModel->meshes.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->meshes.size(); ++i)
+	{
+		tinygltf::Mesh* mesh = &pModel->meshes[i];
+		mesh->name = pIn->String();
+		mesh->primitives.resize(pIn->Count(1));
+
+		for (size_t j = 0; j < mesh->primitives.size(); ++j)
+		{
+			tinygltf::Primitive* primitive = &mesh->primitives[j];
+			uint32_t attributes = pIn->Count(1);
+
+			for (uint32_t k = 0; k < attributes; ++k)
+			{
+				std::string semantic = pIn->String();
+				primitive->attributes[semantic] = pIn->I32();
+			}
+
+			primitive->material = pIn->I32();
+			primitive->indices = pIn->I32();
+			primitive->mode = pIn->I32();
+		}
+	}
+
+	pModel->materials.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->materials.size(); ++i)
+	{
+		tinygltf::Material* material = &pModel->materials[i];
+		material->name = pIn->String();
+
+		int texture = pIn->I32();
+		if (texture >= 0)
+			material->values["baseColorTexture"].json_double_value["index"] = texture;
+
+		std::vector<double> factor = pIn->Doubles();
+		if (factor.empty() == false)
+			material->values["baseColorFactor"].number_array = factor;
+	}
+
+	pModel->textures.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->textures.size(); ++i)
+	{
+		pModel->textures[i].source = pIn->I32();
+		pModel->textures[i].sampler = pIn->I32();
+	}
+
+	pModel->samplers.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->samplers.size(); ++i)
+	{
+		tinygltf::Sampler* sampler = &pModel->samplers[i];
+		sampler->minFilter = pIn->I32();
+		sampler->magFilter = pIn->I32();
+		sampler->wrapS = pIn->I32();
+		sampler->wrapT = pIn->I32();
+	}
+
+	pModel->images.resize(pIn->Count(1));
+	pImages->resize(pModel->images.size());
+	for (size_t i = 0; i < pImages->size(); ++i)
+	{
+		BakeImage* image = &(*pImages)[i];
+		image->width = pIn->U32();
+		image->height = pIn->U32();
+		image->mipmapped = pIn->U8() != 0;
+		image->levels.resize(pIn->Count(sizeof(uint64_t)));
+
+		uint32_t width = image->width;
+		uint32_t height = image->height;
+
+		for (size_t level = 0; level < image->levels.size(); ++level)
+		{
+			uint64_t offset = pIn->U64();
+			uint64_t size = 4 * static_cast<uint64_t>(width) * height;
+
+			if (offset > fileSize || size > fileSize - offset)
+				return false;
+
+			image->levels[level] = pData + offset;
+			width = MipSize(width);
+			height = MipSize(height);
+		}
+
+		pModel->images[i].width = image->width;
+		pModel->images[i].height = image->height;
+		pModel->images[i].component = 4;
+		pModel->images[i].bits = 8;
+		pModel->images[i].pixel_type = GL_UNSIGNED_BYTE;
+	}
+
+	pModel->nodes.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->nodes.size(); ++i)
+	{
+		tinygltf::Node* node = &pModel->nodes[i];
+		node->name = pIn->String();
+		node->mesh = pIn->I32();
+		node->skin = pIn->I32();
+		node->children = pIn->Ints();
+		node->rotation = pIn->Doubles();
+		node->scale = pIn->Doubles();
+		node->translation = pIn->Doubles();
+		node->matrix = pIn->Doubles();
+	}
+
+	pModel->scenes.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->scenes.size(); ++i)
+	{
+		pModel->scenes[i].name = pIn->String();
+		pModel->scenes[i].nodes = pIn->Ints();
+	}
+	pModel->defaultScene = pIn->I32();
+
+	pModel->skins.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->skins.size(); ++i)
+	{
+		tinygltf::Skin* skin = &pModel->skins[i];
+		skin->name = pIn->String();
+		skin->inverseBindMatrices = pIn->I32();
+		skin->skeleton = pIn->I32();
+		skin->joints = pIn->Ints();
+	}
+
+	pModel->animations.resize(pIn->Count(1));
+	for (size_t i = 0; i < pModel->animations.size(); ++i)
+	{
+		tinygltf::Animation* animation = &pModel->animations[i];
+		animation->name = pIn->String();
+
+		animation->channels.resize(pIn->Count(1));
+		for (size_t j = 0; j < animation->channels.size(); ++j)
+		{
+			animation->channels[j].sampler = pIn->I32();
+			animation->channels[j].target_node = pIn->I32();
+			animation->channels[j].target_path = pIn->String();
+		}
+
+		animation->samplers.resize(pIn->Count(1));
+		for (size_t j = 0; j < animation->samplers.size(); ++j)
+		{
+			animation->samplers[j].input = pIn->I32();
+			animation->samplers[j].output = pIn->I32();
+			animation->samplers[j].interpolation = pIn->String();
+		}
+	}
+
+	return pIn->Failed() == false;
+}
+
+GLResult ReadBake(const unsigned char* pData,
+		  size_t size,
+		  uint64_t sourceHash,
+		  tinygltf::Model* pModel,
+		  std::vector<const unsigned char*>* pBufferData,
+		  std::vector<size_t>* pBufferSizes,
+		  std::vector<BakeImage>* pImages)
+{
+	BakeHeader header;
+
+	if (size < sizeof(header))
+		return GLResult::Failed;
+
+	memcpy(&header, pData, sizeof(header));
+
+	if (header.magic != BAKE_MAGIC || header.version != BAKE_VERSION)
+		return GLResult::Failed;
+
+	if (sourceHash != 0 && header.sourceHash != sourceHash)
+		return GLResult::Failed;
+
+	for (int i = 0; i < BAKE_BUFFER_COUNT; ++i)
+	{
+		if (header.bufferOffset[i] > size || header.bufferSize[i] > size - header.bufferOffset[i])
+			return GLResult::Failed;
+	}
+
+	if (header.tablesOffset > size || header.tablesSize > size - header.tablesOffset)
+		return GLResult::Failed;
+
+	BakeReader tables(pData + header.tablesOffset, header.tablesSize);
+	if (ReadTables(&tables, size, pModel, pImages, pData) == false)
+	{
+		fprintf(stderr, "[ERROR] Baked scene tables are truncated\n");
+		return GLResult::Failed;
+	}
+
+	pModel->buffers.resize(BAKE_BUFFER_COUNT);
+	pBufferData->resize(BAKE_BUFFER_COUNT);
+	pBufferSizes->resize(BAKE_BUFFER_COUNT);
+
+	for (int i = 0; i < BAKE_BUFFER_COUNT; ++i)
+	{
+		(*pBufferData)[i] = pData + header.bufferOffset[i];
+		(*pBufferSizes)[i] = header.bufferSize[i];
+	}
+
+	// views must stay inside their buffer, accessors are trusted like tinygltf's
+	for (size_t i = 0; i < pModel->bufferViews.size(); ++i)
+	{
+		const tinygltf::BufferView* bufferView = &pModel->bufferViews[i];
+
+		if (bufferView->buffer < 0 || bufferView->buffer >= BAKE_BUFFER_COUNT ||
+		    bufferView->byteOffset > header.bufferSize[bufferView->buffer] ||
+		    bufferView->byteLength > header.bufferSize[bufferView->buffer] - bufferView->byteOffset)
+		{
+			fprintf(stderr, "[ERROR] Baked bufferView %zu is out of bounds\n", i);
+			return GLResult::Failed;
+		}
+	}
+
+	return GLResult::Success;
+}
@@ -0,0 +1,77 @@
+#ifndef CUBE_SCENEBAKE_H
+#define CUBE_SCENEBAKE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <tiny_gltf.h>
+
+#include "glutils.h"
+
+// Baked scene file, a glTF model in the form GltfScene uploads from. The
+// file is used in place from a mapping: buffers are the vertex arena, the
+// index arena and every other bufferView, followed by decoded texture
+// levels and then the model tables. Little endian, blobs 16 byte aligned.
+#define BAKE_MAGIC 0x4B414243		// "CBAK"
+#define BAKE_VERSION 1
+#define BAKE_ALIGNMENT 16
+
+// Buffers of a baked model, drawable bufferViews sit at their arena offset
+#define BAKE_VERTEX_BUFFER 0
+#define BAKE_INDEX_BUFFER 1
+#define BAKE_DATA_BUFFER 2
+#define BAKE_BUFFER_COUNT 3
+
+// Decoded RGBA8 image, level 0 first. One level unless a texture samples
+// mipmaps from it.
+struct BakeImage
+{
+	uint32_t width;
+	uint32_t height;
+	bool mipmapped;
+	std::vector<const unsigned char*> levels;
+};
+
+// Loader rules shared by GltfScene and cube_bake
+
+// True for the minification filters that sample mip levels
+bool MipmapFilter(int minFilter);
+
+// Whether any texture samples image with a mipmap filter
+bool ImageMipmapped(const tinygltf::Model& model, size_t image);
+
+// GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER or 0 for each bufferView, from
+// its target or, as most exporters leave that unset, from how primitives
+// use it
+void InferViewTargets(const tinygltf::Model& model, std::vector<GLenum>* pTargets);
+
+// One accessor component as float, normalized integers mapped to [0, 1]
+// or [-1, 1] as GL does
+float ReadComponent(const unsigned char* pData, int componentType, bool normalized);
+
+// FNV-1a of a whole file, the key baked files are stored and checked under
+uint64_t HashBytes(const unsigned char* pData, size_t size);
+
+// Write model with its bufferViews packed into the baked buffers. viewTargets
+// is GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER or 0 per bufferView, bufferData
+// points at the bytes of each model buffer.
+GLResult WriteBake(const char* pFileName,
+		   uint64_t sourceHash,
+		   const tinygltf::Model& model,
+		   const std::vector<const unsigned char*>& bufferData,
+		   const std::vector<GLenum>& viewTargets,
+		   const std::vector<BakeImage>& images);
+
+// Restore the model tables of a baked file. Buffers are left empty, pBufferData
+// and the image levels point into pData, which must outlive them. A
+// sourceHash of 0 accepts a bake of any source.
+GLResult ReadBake(const unsigned char* pData,
+		  size_t size,
+		  uint64_t sourceHash,
+		  tinygltf::Model* pModel,
+		  std::vector<const unsigned char*>* pBufferData,
+		  std::vector<size_t>* pBufferSizes,
+		  std::vector<BakeImage>* pImages);
+
+#endif // CUBE_SCENEBAKE_H
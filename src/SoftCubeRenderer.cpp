@@ -0,0 +1,67 @@
+#include "SoftCubeRenderer.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include <stb_image_write.h>
+
+// glClearColor(0.2, 0.2, 0.2, 0.2) of the GL face passes, as RGBA8
+#define FACE_CLEAR_COLOR 0x33333333
+
+SoftCubeRenderer::SoftCubeRenderer(JobSystem* pJobs, uint32_t faceSize) :
+	m_raster(pJobs),
+	m_pPlaceholder(nullptr)
+{
+	for (uint32_t i = 0; i < NUM_SIDES; ++i)
+	{
+		m_faces[i].Resize(faceSize, faceSize);
+	}
+}
+
+bool SoftCubeRenderer::Render(Scene* pTargetScene, const glm::mat4* pFaceViewProjections)
+{
+	Scene* scene = pTargetScene;
+	if (scene->IsReady() == false && m_pPlaceholder != nullptr)
+		scene = m_pPlaceholder;
+
+	bool drawn = scene->RenderSoftware(&m_raster);
+
+	// still clears the faces when there is nothing to draw
+	m_raster.Render(m_faces, pFaceViewProjections, NUM_SIDES, FACE_CLEAR_COLOR);
+
+	return drawn;
+}
+
+GLResult SoftCubeRenderer::SaveFaces(const char* pFileName)
+{
+	uint32_t size = m_faces[0].width;
+	uint32_t width = size * NUM_SIDES;
+	std::vector<unsigned char> pixels(3 * static_cast<size_t>(width) * size);
+
+	// alpha is whatever the scenes left in it, drop it
+	for (uint32_t i = 0; i < NUM_SIDES; ++i)
+	{
+		for (uint32_t y = 0; y < size; ++y)
+		{
+			const uint32_t* source = &m_faces[i].color[static_cast<size_t>(y) * size];
+			unsigned char* out = &pixels[3 * (static_cast<size_t>(y) * width + i * size)];
+
+			for (uint32_t x = 0; x < size; ++x)
+			{
+				out[3 * x + 0] = source[x] & 0xff;
+				out[3 * x + 1] = (source[x] >> 8) & 0xff;
+				out[3 * x + 2] = (source[x] >> 16) & 0xff;
+			}
+		}
+	}
+
+	// faces are stored bottom row first, like GL
+	stbi_flip_vertically_on_write(1);
+	if (stbi_write_png(pFileName, width, size, 3, pixels.data(), 3 * width) == 0)
+	{
+		fprintf(stderr, "[ERROR] Could not write %s\n", pFileName);
+		return GLResult::Failed;
+	}
+
+	return GLResult::Success;
+}
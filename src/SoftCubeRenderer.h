@@ -0,0 +1,40 @@
+#ifndef CUBE_SOFTCUBERENDERER_H
+#define CUBE_SOFTCUBERENDERER_H
+
+#include <stdint.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+#include "JobSystem.h"
+#include "SoftRasterizer.h"
+#include "glutils.h"
+
+// Cube faces drawn by the CPU rasterizer into memory, the GPU free
+// counterpart of CubeRenderer's face passes. Faces are laid out like
+// CubeRenderer's, -X +X +Y -Y +Z -Z.
+class SoftCubeRenderer
+{
+public:
+	SoftCubeRenderer(JobSystem* pJobs, uint32_t faceSize);
+
+	// Drawn instead of a target scene that is not IsReady, may be nullptr
+	void SetPlaceholder(Scene* pScene) { m_pPlaceholder = pScene; }
+
+	// Draw every face of the scene, pFaceViewProjections holds NUM_SIDES
+	// transforms. Returns false if neither scene has a CPU path.
+	bool Render(Scene* pTargetScene, const glm::mat4* pFaceViewProjections);
+
+	const SoftTarget& Face(uint32_t face) const { return m_faces[face]; }
+
+	// Faces side by side in one PNG, top row first
+	GLResult SaveFaces(const char* pFileName);
+
+private:
+	SoftRasterizer m_raster;
+	SoftTarget m_faces[NUM_SIDES];
+	Scene* m_pPlaceholder;
+};
+
+#endif // CUBE_SOFTCUBERENDERER_H
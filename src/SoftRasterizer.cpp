@@ -0,0 +1,649 @@
+#include "SoftRasterizer.h"
+
+#include <math.h>
+#include <algorithm>
+
+#include "AnimKernels.h"
+#include "Profiler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SOFT_RASTER_X86
+#include <emmintrin.h>
+#define TARGET_SSE __attribute__((target("sse2")))
+#endif
+
+// u, v, r, g, b, a carried through clipping
+#define CLIP_ATTRIBUTES 6
+// a triangle clipped by the 6 frustum planes
+#define CLIP_MAX_VERTICES 9
+
+struct ClipVertex
+{
+	glm::vec4 position;
+	float attributes[CLIP_ATTRIBUTES];
+};
+
+struct ScreenVertex
+{
+	float x, y, z, invW;
+	float attributes[CLIP_ATTRIBUTES];
+};
+
+void SoftTarget::Resize(uint32_t targetWidth, uint32_t targetHeight)
+{
+	width = targetWidth;
+	height = targetHeight;
+	color.assign(static_cast<size_t>(width) * height, 0);
+	depth.assign(static_cast<size_t>(width) * height, 1.0f);
+}
+
+SoftRasterizer::SoftRasterizer(JobSystem* pJobs)
+{
+	m_pJobs = pJobs;
+}
+
+void SoftRasterizer::Draw(const SoftDraw& draw)
+{
+	if (draw.pPositions == nullptr || draw.vertexCount == 0)
+		return;
+
+	m_draws.push_back(draw);
+}
+
+// Signed distance to each frustum plane, -w <= x, y, z <= w inside
+static float PlaneDistance(const glm::vec4& p, int plane)
+{
+	switch (plane)
+	{
+	case 0: return p.w + p.x;
+	case 1: return p.w - p.x;
+	case 2: return p.w + p.y;
+	case 3: return p.w - p.y;
+	case 4: return p.w + p.z;
+	default: return p.w - p.z;
+	}
+}
+
+// Bit per plane the point is outside of
+static uint32_t Outcode(const glm::vec4& p)
+{
+	uint32_t code = 0;
+
+	for (int plane = 0; plane < 6; ++plane)
+	{
+		if (PlaneDistance(p, plane) < 0.0f)
+			code |= 1 << plane;
+	}
+
+	return code;
+}
+
+// Sutherland-Hodgman against the planes in mask, returns the vertex count
+static uint32_t ClipPolygon(ClipVertex* pVertices, uint32_t count, uint32_t mask)
+{
+	ClipVertex clipped[CLIP_MAX_VERTICES];
+
+	for (int plane = 0; plane < 6 && count >= 3; ++plane)
+	{
+		if ((mask & (1 << plane)) == 0)
+			continue;
+
+		uint32_t out = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const ClipVertex* a = &pVertices[i];
+			const ClipVertex* b = &pVertices[(i + 1) % count];
+			float da = PlaneDistance(a->position, plane);
+			float db = PlaneDistance(b->position, plane);
+
+			if (da >= 0.0f)
+				clipped[out++] = *a;
+
+			if ((da >= 0.0f) != (db >= 0.0f))
+			{
+				float t = da / (da - db);
+				ClipVertex* v = &clipped[out++];
+				v->position = a->position + (b->position - a->position) * t;
+				for (int k = 0; k < CLIP_ATTRIBUTES; ++k)
+				{
+					v->attributes[k] = a->attributes[k] + (b->attributes[k] - a->attributes[k]) * t;
+				}
+			}
+		}
+
+		std::copy(clipped, clipped + out, pVertices);
+		count = out;
+	}
+
+	return (count >= 3) ? count : 0;
+}
+
+static bool Project(const ClipVertex* pVertex, const SoftTarget* pTarget, ScreenVertex* pOut)
+{
+	if (pVertex->position.w <= 0.0f)
+		return false;
+
+	float invW = 1.0f / pVertex->position.w;
+	pOut->x = (pVertex->position.x * invW * 0.5f + 0.5f) * pTarget->width;
+	pOut->y = (pVertex->position.y * invW * 0.5f + 0.5f) * pTarget->height;
+	pOut->z = pVertex->position.z * invW * 0.5f + 0.5f;
+	pOut->invW = invW;
+
+	for (int k = 0; k < CLIP_ATTRIBUTES; ++k)
+	{
+		pOut->attributes[k] = pVertex->attributes[k] * invW;
+	}
+
+	return true;
+}
+
+// Edge functions and attribute planes, either winding is drawn
+static bool SetupTriangle(const ScreenVertex* v0,
+			  const ScreenVertex* v1,
+			  const ScreenVertex* v2,
+			  const SoftTarget* pTarget,
+			  const SoftTexture* pTexture,
+			  SoftTriangle* pTriangle)
+{
+	float area = (v1->x - v0->x) * (v2->y - v0->y) - (v2->x - v0->x) * (v1->y - v0->y);
+
+	if (area == 0.0f || isfinite(area) == false)
+		return false;
+
+	if (area < 0.0f)
+	{
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	const ScreenVertex* v[3] = {v0, v1, v2};
+	float minX = std::min(v0->x, std::min(v1->x, v2->x));
+	float maxX = std::max(v0->x, std::max(v1->x, v2->x));
+	float minY = std::min(v0->y, std::min(v1->y, v2->y));
+	float maxY = std::max(v0->y, std::max(v1->y, v2->y));
+
+	pTriangle->minX = std::max(0, static_cast<int32_t>(floorf(minX)));
+	pTriangle->minY = std::max(0, static_cast<int32_t>(floorf(minY)));
+	pTriangle->maxX = std::min(static_cast<int32_t>(pTarget->width) - 1, static_cast<int32_t>(ceilf(maxX)));
+	pTriangle->maxY = std::min(static_cast<int32_t>(pTarget->height) - 1, static_cast<int32_t>(ceilf(maxY)));
+
+	if (pTriangle->minX > pTriangle->maxX || pTriangle->minY > pTriangle->maxY)
+		return false;
+
+	// edge i is opposite vertex i, so it is also that vertex's barycentric
+	// weight times area. Of the two triangles sharing an edge exactly one
+	// sees it as top-left and owns the pixels on it.
+	pTriangle->topLeft = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		const ScreenVertex* a = v[(i + 1) % 3];
+		const ScreenVertex* b = v[(i + 2) % 3];
+		float* edge = pTriangle->edge[i];
+
+		edge[0] = a->y - b->y;
+		edge[1] = b->x - a->x;
+		edge[2] = a->x * b->y - b->x * a->y;
+
+		if (edge[0] > 0.0f || (edge[0] == 0.0f && edge[1] > 0.0f))
+			pTriangle->topLeft |= 1 << i;
+	}
+
+	for (int p = 0; p < SOFT_PLANES; ++p)
+	{
+		float value[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			if (p == SOFT_PLANE_Z)
+				value[i] = v[i]->z;
+			else if (p == SOFT_PLANE_INV_W)
+				value[i] = v[i]->invW;
+			else
+				value[i] = v[i]->attributes[p - SOFT_PLANE_U];
+		}
+
+		for (int k = 0; k < 3; ++k)
+		{
+			pTriangle->plane[p][k] = (value[0] * pTriangle->edge[0][k] +
+						  value[1] * pTriangle->edge[1][k] +
+						  value[2] * pTriangle->edge[2][k]) / area;
+		}
+	}
+
+	pTriangle->pTexture = pTexture;
+
+	return true;
+}
+
+void SoftRasterizer::TransformBatch(const Batch& batch, const glm::mat4* pViewProjections, uint32_t count)
+{
+	const SoftDraw* draw = &m_draws[batch.draw];
+	glm::vec4* clip = m_clip[batch.draw].data();
+
+	for (uint32_t t = 0; t < count; ++t)
+	{
+		glm::mat4 transform = pViewProjections[t] * draw->world;
+		glm::vec4* out = clip + static_cast<size_t>(t) * draw->vertexCount;
+
+		for (uint32_t i = batch.begin; i < batch.end; ++i)
+		{
+			out[i] = transform * glm::vec4(draw->pPositions[i], 1.0f);
+		}
+	}
+}
+
+void SoftRasterizer::BinBatch(const Batch& batch, const SoftTarget* pTargets, SoftBin* pBin)
+{
+	const SoftDraw* draw = &m_draws[batch.draw];
+	const SoftTarget* target = &pTargets[batch.target];
+	const glm::vec4* clip = m_clip[batch.draw].data() + static_cast<size_t>(batch.target) * draw->vertexCount;
+
+	pBin->target = batch.target;
+	pBin->triangles.clear();
+
+	for (uint32_t t = batch.begin; t < batch.end; ++t)
+	{
+		uint32_t index[3];
+		bool valid = true;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			index[k] = (draw->pIndices != nullptr) ? draw->pIndices[t * 3 + k] : t * 3 + k;
+			valid = valid && (index[k] < draw->vertexCount);
+		}
+
+		if (valid == false)
+			continue;
+
+		uint32_t codes[3] = {Outcode(clip[index[0]]), Outcode(clip[index[1]]), Outcode(clip[index[2]])};
+		if ((codes[0] & codes[1] & codes[2]) != 0)
+			continue;
+
+		ClipVertex polygon[CLIP_MAX_VERTICES];
+		for (int k = 0; k < 3; ++k)
+		{
+			ClipVertex* vertex = &polygon[k];
+			glm::vec2 uv = (draw->pTexcoords != nullptr) ? draw->pTexcoords[index[k]] : glm::vec2(0.0f);
+			glm::vec4 color = (draw->pColors != nullptr) ? draw->pColors[index[k]] : draw->color;
+
+			vertex->position = clip[index[k]];
+			vertex->attributes[0] = uv.x;
+			vertex->attributes[1] = uv.y;
+			vertex->attributes[2] = color.r;
+			vertex->attributes[3] = color.g;
+			vertex->attributes[4] = color.b;
+			vertex->attributes[5] = color.a;
+		}
+
+		uint32_t count = 3;
+		uint32_t crossed = codes[0] | codes[1] | codes[2];
+		if (crossed != 0)
+			count = ClipPolygon(polygon, count, crossed);
+
+		ScreenVertex screen[CLIP_MAX_VERTICES];
+		for (uint32_t k = 0; k < count; ++k)
+		{
+			if (Project(&polygon[k], target, &screen[k]) == false)
+				count = 0;
+		}
+
+		for (uint32_t k = 1; k + 1 < count; ++k)
+		{
+			SoftTriangle triangle;
+			if (SetupTriangle(&screen[0], &screen[k], &screen[k + 1], target, draw->pTexture, &triangle))
+				pBin->triangles.push_back(triangle);
+		}
+	}
+
+	// counting sort of the triangles by the tiles their bounds touch
+	uint32_t tilesX = (target->width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+	uint32_t tilesY = (target->height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+
+	pBin->tileStart.assign(tilesX * tilesY + 1, 0);
+
+	for (size_t i = 0; i < pBin->triangles.size(); ++i)
+	{
+		const SoftTriangle* triangle = &pBin->triangles[i];
+
+		for (int32_t ty = triangle->minY / SOFT_TILE_SIZE; ty <= triangle->maxY / SOFT_TILE_SIZE; ++ty)
+		{
+			for (int32_t tx = triangle->minX / SOFT_TILE_SIZE; tx <= triangle->maxX / SOFT_TILE_SIZE; ++tx)
+			{
+				++pBin->tileStart[ty * tilesX + tx + 1];
+			}
+		}
+	}
+
+	for (size_t i = 1; i < pBin->tileStart.size(); ++i)
+	{
+		pBin->tileStart[i] += pBin->tileStart[i - 1];
+	}
+
+	std::vector<uint32_t> cursor(pBin->tileStart.begin(), pBin->tileStart.end() - 1);
+	pBin->entries.resize(pBin->tileStart.back());
+
+	for (size_t i = 0; i < pBin->triangles.size(); ++i)
+	{
+		const SoftTriangle* triangle = &pBin->triangles[i];
+
+		for (int32_t ty = triangle->minY / SOFT_TILE_SIZE; ty <= triangle->maxY / SOFT_TILE_SIZE; ++ty)
+		{
+			for (int32_t tx = triangle->minX / SOFT_TILE_SIZE; tx <= triangle->maxX / SOFT_TILE_SIZE; ++tx)
+			{
+				pBin->entries[cursor[ty * tilesX + tx]++] = i;
+			}
+		}
+	}
+}
+
+static inline float Plane(const float* pPlane, float x, float y)
+{
+	return pPlane[0] * x + pPlane[1] * y + pPlane[2];
+}
+
+static inline glm::vec4 Texel(const SoftTexture* pTexture, uint32_t x, uint32_t y)
+{
+	const unsigned char* p = pTexture->pPixels + 4 * (static_cast<size_t>(y) * pTexture->width + x);
+	return glm::vec4(p[0], p[1], p[2], p[3]) * (1.0f / 255.0f);
+}
+
+// Bilinear with GL_REPEAT, texel centers at half coordinates
+static glm::vec4 SampleTexture(const SoftTexture* pTexture, float u, float v)
+{
+	if (isfinite(u) == false || isfinite(v) == false)
+		u = v = 0.0f;
+
+	float x = (u - floorf(u)) * pTexture->width - 0.5f;
+	float y = (v - floorf(v)) * pTexture->height - 0.5f;
+	float fx = floorf(x);
+	float fy = floorf(y);
+	float tx = x - fx;
+	float ty = y - fy;
+
+	uint32_t x0 = (fx < 0.0f) ? pTexture->width - 1 : static_cast<uint32_t>(fx);
+	uint32_t y0 = (fy < 0.0f) ? pTexture->height - 1 : static_cast<uint32_t>(fy);
+	uint32_t x1 = (x0 + 1 < pTexture->width) ? x0 + 1 : 0;
+	uint32_t y1 = (y0 + 1 < pTexture->height) ? y0 + 1 : 0;
+
+	glm::vec4 top = glm::mix(Texel(pTexture, x0, y0), Texel(pTexture, x1, y0), tx);
+	glm::vec4 bottom = glm::mix(Texel(pTexture, x0, y1), Texel(pTexture, x1, y1), tx);
+
+	return glm::mix(top, bottom, ty);
+}
+
+static inline uint32_t PackColor(const glm::vec4& color)
+{
+	glm::vec4 c = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+
+	return static_cast<uint32_t>(c.r) |
+		(static_cast<uint32_t>(c.g) << 8) |
+		(static_cast<uint32_t>(c.b) << 16) |
+		(static_cast<uint32_t>(c.a) << 24);
+}
+
+// Perspective correct attributes at a pixel center, color plus texture
+static uint32_t Shade(const SoftTriangle* pTriangle, float x, float y)
+{
+	float w = 1.0f / Plane(pTriangle->plane[SOFT_PLANE_INV_W], x, y);
+	glm::vec4 color(Plane(pTriangle->plane[SOFT_PLANE_R], x, y) * w,
+			Plane(pTriangle->plane[SOFT_PLANE_G], x, y) * w,
+			Plane(pTriangle->plane[SOFT_PLANE_B], x, y) * w,
+			Plane(pTriangle->plane[SOFT_PLANE_A], x, y) * w);
+
+	if (pTriangle->pTexture != nullptr)
+	{
+		color += SampleTexture(pTriangle->pTexture,
+				       Plane(pTriangle->plane[SOFT_PLANE_U], x, y) * w,
+				       Plane(pTriangle->plane[SOFT_PLANE_V], x, y) * w);
+	}
+	else
+	{
+		color.a += 1.0f;
+	}
+
+	return PackColor(color);
+}
+
+static inline void RasterPixel(const SoftTriangle* pTriangle, uint32_t* pColor, float* pDepth, int32_t x, float py)
+{
+	float px = x + 0.5f;
+
+	for (int e = 0; e < 3; ++e)
+	{
+		const float* edge = pTriangle->edge[e];
+		float value = edge[0] * px + edge[1] * py + edge[2];
+
+		if (value < 0.0f || (value == 0.0f && (pTriangle->topLeft & (1 << e)) == 0))
+			return;
+	}
+
+	float z = Plane(pTriangle->plane[SOFT_PLANE_Z], px, py);
+	if ((z < pDepth[x]) == false)
+		return;
+
+	pDepth[x] = z;
+	pColor[x] = Shade(pTriangle, px, py);
+}
+
+// Pixels [x0, x1) x [y0, y1), all inside the tile being drawn
+static void RasterScalar(const SoftTriangle* pTriangle, SoftTarget* pTarget, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+	for (int32_t y = y0; y < y1; ++y)
+	{
+		uint32_t* color = &pTarget->color[static_cast<size_t>(y) * pTarget->width];
+		float* depth = &pTarget->depth[static_cast<size_t>(y) * pTarget->width];
+		float py = y + 0.5f;
+
+		for (int32_t x = x0; x < x1; ++x)
+		{
+			RasterPixel(pTriangle, color, depth, x, py);
+		}
+	}
+}
+
+#ifdef SOFT_RASTER_X86
+
+// Same expressions as RasterPixel, so both paths produce identical images.
+// Whole quads only, the rest of a row goes through RasterPixel.
+TARGET_SSE static void RasterSSE(const SoftTriangle* pTriangle, SoftTarget* pTarget, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+	const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	const float* zPlane = pTriangle->plane[SOFT_PLANE_Z];
+
+	__m128 a[3], c[3], topLeft[3];
+	for (int e = 0; e < 3; ++e)
+	{
+		a[e] = _mm_set1_ps(pTriangle->edge[e][0]);
+		c[e] = _mm_set1_ps(pTriangle->edge[e][2]);
+		topLeft[e] = (pTriangle->topLeft & (1 << e)) ? all : zero;
+	}
+
+	__m128 za = _mm_set1_ps(zPlane[0]);
+	__m128 zc = _mm_set1_ps(zPlane[2]);
+
+	for (int32_t y = y0; y < y1; ++y)
+	{
+		uint32_t* color = &pTarget->color[static_cast<size_t>(y) * pTarget->width];
+		float* depth = &pTarget->depth[static_cast<size_t>(y) * pTarget->width];
+		float py = y + 0.5f;
+
+		__m128 by[3];
+		for (int e = 0; e < 3; ++e)
+		{
+			by[e] = _mm_set1_ps(pTriangle->edge[e][1] * py);
+		}
+		__m128 zby = _mm_set1_ps(zPlane[1] * py);
+
+		int32_t x = x0;
+		for (; x + 4 <= x1; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+			__m128 inside = all;
+
+			for (int e = 0; e < 3; ++e)
+			{
+				__m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[e], px), by[e]), c[e]);
+				__m128 edgeInside = _mm_or_ps(_mm_cmpgt_ps(value, zero),
+							      _mm_and_ps(_mm_cmpeq_ps(value, zero), topLeft[e]));
+				inside = _mm_and_ps(inside, edgeInside);
+			}
+
+			if (_mm_movemask_ps(inside) == 0)
+				continue;
+
+			__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(za, px), zby), zc);
+			__m128 stored = _mm_loadu_ps(depth + x);
+			__m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(z, stored));
+			int bits = _mm_movemask_ps(pass);
+
+			if (bits == 0)
+				continue;
+
+			_mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, stored)));
+
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				if (bits & (1 << lane))
+					color[x + lane] = Shade(pTriangle, x + lane + 0.5f, py);
+			}
+		}
+
+		for (; x < x1; ++x)
+		{
+			RasterPixel(pTriangle, color, depth, x, py);
+		}
+	}
+}
+
+#endif // SOFT_RASTER_X86
+
+void SoftRasterizer::RasterTile(SoftTarget* pTarget, uint32_t target, uint32_t tile, uint32_t clearColor)
+{
+	uint32_t tilesX = (pTarget->width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+	int32_t x0 = (tile % tilesX) * SOFT_TILE_SIZE;
+	int32_t y0 = (tile / tilesX) * SOFT_TILE_SIZE;
+	int32_t x1 = std::min(x0 + SOFT_TILE_SIZE, static_cast<int32_t>(pTarget->width));
+	int32_t y1 = std::min(y0 + SOFT_TILE_SIZE, static_cast<int32_t>(pTarget->height));
+
+	for (int32_t y = y0; y < y1; ++y)
+	{
+		size_t row = static_cast<size_t>(y) * pTarget->width;
+		std::fill(pTarget->color.begin() + row + x0, pTarget->color.begin() + row + x1, clearColor);
+		std::fill(pTarget->depth.begin() + row + x0, pTarget->depth.begin() + row + x1, 1.0f);
+	}
+
+#ifdef SOFT_RASTER_X86
+	bool simd = (GetSimdLevel() != SimdLevel::Scalar);
+#endif
+
+	const std::vector<uint32_t>* bins = &m_targetBins[target];
+
+	for (size_t i = 0; i < bins->size(); ++i)
+	{
+		const SoftBin* bin = &m_bins[(*bins)[i]];
+
+		for (uint32_t e = bin->tileStart[tile]; e < bin->tileStart[tile + 1]; ++e)
+		{
+			const SoftTriangle* triangle = &bin->triangles[bin->entries[e]];
+			int32_t rx0 = std::max(x0, triangle->minX);
+			int32_t ry0 = std::max(y0, triangle->minY);
+			int32_t rx1 = std::min(x1, triangle->maxX + 1);
+			int32_t ry1 = std::min(y1, triangle->maxY + 1);
+
+#ifdef SOFT_RASTER_X86
+			if (simd)
+			{
+				RasterSSE(triangle, pTarget, rx0, ry0, rx1, ry1);
+				continue;
+			}
+#endif
+			RasterScalar(triangle, pTarget, rx0, ry0, rx1, ry1);
+		}
+	}
+}
+
+void SoftRasterizer::Render(SoftTarget* pTargets, const glm::mat4* pViewProjections, uint32_t count, uint32_t clearColor)
+{
+	PROFILE_ZONE("SoftRasterizer::Render");
+
+	// vertices of every target at once, in batches across the draws
+	m_clip.resize(m_draws.size());
+	m_batches.clear();
+
+	for (uint32_t d = 0; d < m_draws.size(); ++d)
+	{
+		uint32_t vertices = m_draws[d].vertexCount;
+		m_clip[d].resize(static_cast<size_t>(vertices) * count);
+
+		for (uint32_t begin = 0; begin < vertices; begin += SOFT_VERTEX_BATCH)
+		{
+			Batch batch = {d, 0, begin, std::min(begin + SOFT_VERTEX_BATCH, vertices)};
+			m_batches.push_back(batch);
+		}
+	}
+
+	m_pJobs->ParallelFor(m_batches.size(), [this, pViewProjections, count](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			TransformBatch(m_batches[i], pViewProjections, count);
+		}
+	});
+
+	// draw then target order, so each target's bins are in draw order
+	m_batches.clear();
+
+	for (uint32_t d = 0; d < m_draws.size(); ++d)
+	{
+		const SoftDraw* draw = &m_draws[d];
+		uint32_t triangles = ((draw->pIndices != nullptr) ? draw->indexCount : draw->vertexCount) / 3;
+
+		for (uint32_t t = 0; t < count; ++t)
+		{
+			for (uint32_t begin = 0; begin < triangles; begin += SOFT_BIN_TRIANGLES)
+			{
+				Batch batch = {d, t, begin, std::min(begin + SOFT_BIN_TRIANGLES, triangles)};
+				m_batches.push_back(batch);
+			}
+		}
+	}
+
+	if (m_bins.size() < m_batches.size())
+		m_bins.resize(m_batches.size());
+
+	m_pJobs->ParallelFor(m_batches.size(), [this, pTargets](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			BinBatch(m_batches[i], pTargets, &m_bins[i]);
+		}
+	});
+
+	m_targetBins.resize(count);
+	for (uint32_t t = 0; t < count; ++t)
+	{
+		m_targetBins[t].clear();
+	}
+	for (uint32_t i = 0; i < m_batches.size(); ++i)
+	{
+		m_targetBins[m_batches[i].target].push_back(i);
+	}
+
+	// every tile of every target is independent
+	std::vector<uint32_t> firstTile(count + 1, 0);
+	for (uint32_t t = 0; t < count; ++t)
+	{
+		uint32_t tilesX = (pTargets[t].width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+		uint32_t tilesY = (pTargets[t].height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+		firstTile[t + 1] = firstTile[t] + tilesX * tilesY;
+	}
+
+	m_pJobs->ParallelFor(firstTile[count], [this, pTargets, &firstTile, clearColor](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			uint32_t t = std::upper_bound(firstTile.begin(), firstTile.end(), i) - firstTile.begin() - 1;
+			RasterTile(&pTargets[t], t, i - firstTile[t], clearColor);
+		}
+	});
+
+	m_draws.clear();
+}
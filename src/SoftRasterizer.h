@@ -0,0 +1,140 @@
+#ifndef CUBE_SOFTRASTERIZER_H
+#define CUBE_SOFTRASTERIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "JobSystem.h"
+
+// Tiled triangle rasterizer on the CPU. Draws are queued in world space
+// and Render draws all of them into several targets at once: vertices are
+// transformed and triangles clipped and binned to tiles in parallel
+// batches, then every tile of every target is rasterized on its own, its
+// triangles in draw order. Edge functions and the depth test run 4 pixels
+// at a time with SSE2 when GetSimdLevel() allows it.
+//
+// Shading matches the GL scene programs, vertex color plus a bilinear,
+// repeating sample of level 0 of the texture, depth test GL_LESS and no
+// culling. Targets are stored bottom row first, like GL.
+
+#define SOFT_TILE_SIZE 64
+#define SOFT_VERTEX_BATCH 4096		// vertices per transform job
+#define SOFT_BIN_TRIANGLES 2048		// triangles per binning job
+
+// RGBA8, rows top to bottom as uploaded to GL
+struct SoftTexture
+{
+	uint32_t width;
+	uint32_t height;
+	const unsigned char* pPixels;
+};
+
+// Indexed triangle list. Arrays hold vertexCount tightly packed elements
+// and must stay valid until Render returns.
+struct SoftDraw
+{
+	glm::mat4 world;
+	const glm::vec3* pPositions;
+	const glm::vec2* pTexcoords;	// nullptr samples (0, 0)
+	const glm::vec4* pColors;	// nullptr uses color
+	glm::vec4 color;
+	uint32_t vertexCount;
+	const uint32_t* pIndices;	// nullptr draws vertices in order
+	uint32_t indexCount;
+	const SoftTexture* pTexture;	// nullptr adds (0, 0, 0, 1) like an unbound sampler
+
+	SoftDraw() :
+		world(1.0f),
+		pPositions(nullptr),
+		pTexcoords(nullptr),
+		pColors(nullptr),
+		color(0.0f, 0.0f, 0.0f, 1.0f),
+		vertexCount(0),
+		pIndices(nullptr),
+		indexCount(0),
+		pTexture(nullptr) {}
+};
+
+// Color is RGBA8 with red in the lowest byte, depth is window z
+struct SoftTarget
+{
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint32_t> color;
+	std::vector<float> depth;
+
+	SoftTarget() : width(0), height(0) {}
+	void Resize(uint32_t width, uint32_t height);
+};
+
+// Screen space triangle, ready to rasterize
+#define SOFT_PLANE_Z 0
+#define SOFT_PLANE_INV_W 1
+#define SOFT_PLANE_U 2		// attributes are interpolated over w
+#define SOFT_PLANE_V 3
+#define SOFT_PLANE_R 4
+#define SOFT_PLANE_G 5
+#define SOFT_PLANE_B 6
+#define SOFT_PLANE_A 7
+#define SOFT_PLANES 8
+
+struct SoftTriangle
+{
+	float edge[3][3];		// a x + b y + c, positive inside
+	uint32_t topLeft;		// bit per edge whose pixels on the line are inside
+	float plane[SOFT_PLANES][3];	// a x + b y + c
+	int32_t minX, minY, maxX, maxY;	// inclusive, within the target
+	const SoftTexture* pTexture;
+};
+
+// Triangles one binning job set up, grouped by the tiles they touch
+struct SoftBin
+{
+	uint32_t target;
+	std::vector<SoftTriangle> triangles;
+	std::vector<uint32_t> tileStart;	// per tile of the target, and one past the end
+	std::vector<uint32_t> entries;		// triangle indices, by tile
+};
+
+class SoftRasterizer
+{
+public:
+	SoftRasterizer(JobSystem* pJobs);
+
+	void Draw(const SoftDraw& draw);
+
+	// Clear the targets and draw every queued draw into each, seen through
+	// its view-projection. The queue is empty afterwards.
+	void Render(SoftTarget* pTargets, const glm::mat4* pViewProjections, uint32_t count, uint32_t clearColor);
+
+	size_t DrawCount() const { return m_draws.size(); }
+
+private:
+	// Range of one draw processed by one job
+	struct Batch
+	{
+		uint32_t draw;
+		uint32_t target;
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	void TransformBatch(const Batch& batch, const glm::mat4* pViewProjections, uint32_t count);
+	void BinBatch(const Batch& batch, const SoftTarget* pTargets, SoftBin* pBin);
+	void RasterTile(SoftTarget* pTarget, uint32_t target, uint32_t tile, uint32_t clearColor);
+
+	JobSystem* m_pJobs;
+	std::vector<SoftDraw> m_draws;
+
+	// reused between renders
+	std::vector<std::vector<glm::vec4> > m_clip;	// per draw, count targets of vertexCount
+	std::vector<Batch> m_batches;
+	std::vector<SoftBin> m_bins;
+	std::vector<std::vector<uint32_t> > m_targetBins;	// bins of each target, in draw order
+};
+
+#endif // CUBE_SOFTRASTERIZER_H
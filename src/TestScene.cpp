@@ -1,4 +1,6 @@
 #include "TestScene.h"
+#include "SoftRasterizer.h"
+#include "Profiler.h"
 
 #include <math.h>
 #include <glm/gtc/matrix_transform.hpp>
@@ -59,7 +61,7 @@ static GLuint indices[] = {0, 1, 2,
 
 static const char vs_src[] =
 "#version 330\n\
-in vec3 position;\n\
+layout(location = 0) in vec3 position;\n\
 out vec4 color;\n\
 uniform mat4 world;\n\
 void main() {\n\
@@ -67,6 +69,18 @@ void main() {\n\
     gl_Position = world * vec4(position, 1.0);\n\
 }";
 
+static const char layered_vs_src[] =
+"#version 330\n\
+layout(location = 0) in vec3 position;\n\
+out vec2 v_texcoord;\n\
+out vec4 v_color;\n\
+uniform mat4 world;\n\
+void main() {\n\
+    v_texcoord = vec2(0.0);\n\
+    v_color = vec4(clamp(position + 0.5f, 0.0, 1.0), 1.0);\n\
+    gl_Position = world * vec4(position, 1.0);\n\
+}";
+
 static const char fs_src[] =
 "#version 330\n\
 in  vec4 color;\n\
@@ -78,11 +92,18 @@ void main() {\n\
 TestScene::TestScene() : m_t(0)
 {
 	Init();
+
+	const glm::vec3* positions = reinterpret_cast<const glm::vec3*>(vertices);
+	for (size_t i = 0; i < sizeof(vertices) / (3 * sizeof(vertices[0])); ++i)
+	{
+		m_colors.push_back(glm::vec4(glm::clamp(positions[i] + 0.5f, 0.0f, 1.0f), 1.0f));
+	}
 }
 
 TestScene::~TestScene()
 {
 	glDeleteProgram(m_program);
+	glDeleteProgram(m_layeredProgram);
 	glDeleteBuffers(1, &m_vbo);
 	glDeleteBuffers(1, &m_ibo);
 	glDeleteVertexArrays(1, &m_vao);
@@ -104,6 +125,24 @@ GLResult TestScene::Init()
 	glBindFragDataLocation(m_program,
 			       0,
 			       "out_color");
+
+	GLuint gs;
+
+	result = CompileShader(layered_vs_src, GL_VERTEX_SHADER, &vs);
+	result = CompileShader(layered_gs_src, GL_GEOMETRY_SHADER, &gs);
+	result = CompileShader(fs_src, GL_FRAGMENT_SHADER, &fs);
+	result = LinkProgram(vs, gs, fs, &m_layeredProgram);
+
+	glDeleteShader(vs);
+	glDeleteShader(gs);
+	glDeleteShader(fs);
+
+	glBindFragDataLocation(m_layeredProgram,
+			       0,
+			       "out_color");
+
+	GLuint faces_block = glGetUniformBlockIndex(m_layeredProgram, "CubeFaces");
+	glUniformBlockBinding(m_layeredProgram, faces_block, CUBE_FACES_BINDING);
 	
 	glGenVertexArrays(1, &m_vao);
 	glBindVertexArray(m_vao);
@@ -145,10 +184,13 @@ void TestScene::Step(uint32_t stepMs)
 {
 	m_t += static_cast<float>(stepMs) / 400.0;
         m_cubePosition = glm::vec3(sin(m_t), sin(m_t*2.0) + 1.5f, -5.0f);
+	m_generation++;
 }
 
 void TestScene::Render(Camera *pCamera)
 {
+	PROFILE_ZONE("TestScene::Render");
+
 	GLint world_uniform = glGetUniformLocation(m_program, "world");
 	if (world_uniform == -1) {
 		fprintf(stderr, "[ERROR] could not get uniform location");
@@ -177,4 +219,50 @@ void TestScene::Render(Camera *pCamera)
 		       GL_UNSIGNED_INT,
 		       nullptr);
 	glBindVertexArray(0);
+	m_drawCalls++;
+}
+
+bool TestScene::RenderLayered()
+{
+	GLint world_uniform = glGetUniformLocation(m_layeredProgram, "world");
+	if (world_uniform == -1) {
+		fprintf(stderr, "[ERROR] could not get uniform location");
+	}
+
+	glEnable(GL_DEPTH_TEST);
+	glCullFace(GL_BACK);
+
+	glm::mat4 model = glm::translate(m_cubePosition);
+
+	glUseProgram(m_layeredProgram);
+	glUniformMatrix4fv(world_uniform,
+			   1,
+			   GL_FALSE,
+			   glm::value_ptr(model));
+
+	glBindVertexArray(m_vao);
+	glDrawElements(GL_TRIANGLES,
+		       36,
+		       GL_UNSIGNED_INT,
+		       nullptr);
+	glBindVertexArray(0);
+	m_drawCalls++;
+
+	return true;
+}
+
+bool TestScene::RenderSoftware(SoftRasterizer *pRaster)
+{
+	SoftDraw draw;
+	draw.world = glm::translate(m_cubePosition);
+	draw.pPositions = reinterpret_cast<const glm::vec3*>(vertices);
+	draw.pColors = m_colors.data();
+	draw.vertexCount = m_colors.size();
+	draw.pIndices = indices;
+	draw.indexCount = sizeof(indices) / sizeof(indices[0]);
+
+	pRaster->Draw(draw);
+	m_drawCalls++;
+
+	return true;
 }
@@ -4,6 +4,7 @@
 #include <GL/glew.h>
 #define GLM_FORCE_RADIANS 
 #include <glm/glm.hpp>
+#include <vector>
 
 #include "Scene.h"
 #include "Camera.h"
@@ -16,15 +17,19 @@ public:
 	~TestScene();
 	void Step(uint32_t stepMs);
 	void Render(Camera *pCamera);
+	bool RenderLayered();
+	bool RenderSoftware(SoftRasterizer *pRaster);
 
 private:
 	GLResult Init();
 
 	GLuint m_program;
+	GLuint m_layeredProgram;
 	GLuint m_vao, m_vbo, m_ibo;
 
 	float m_t;
 	glm::vec3 m_cubePosition;
+	std::vector<glm::vec4> m_colors;	// per vertex, as the vertex shader computes them
 };
 
 #endif // CUBE_TESTSCENE_H
@@ -36,6 +36,32 @@ GLResult CompileShader(const char* src, GLenum type, GLuint *shader) {
 }
 
 GLResult LinkProgram(GLuint vertex_shader, GLuint fragment_shader, GLuint *program) {
+	return LinkProgram(vertex_shader, 0, fragment_shader, program);
+}
+
+static GLResult FinishLink(GLuint new_program) {
+	GLResult result = GLResult::Success;
+
+	glLinkProgram(new_program);
+
+	GLint status = GL_FALSE;
+	glGetProgramiv(new_program, GL_LINK_STATUS, &status);
+
+	if (status != GL_TRUE) {
+		result = GLResult::Failed;
+		GLint len = 0;
+		glGetProgramiv(new_program, GL_INFO_LOG_LENGTH, &len);
+		char *log = new char[len];
+		glGetProgramInfoLog(new_program, len, nullptr, log);
+		fprintf(stderr, "[ERROR] Program linking failed: %s", log);
+		delete[] log;
+		glDeleteProgram(new_program);
+	}
+
+	return result;
+}
+
+GLResult LinkProgram(GLuint vertex_shader, GLuint geometry_shader, GLuint fragment_shader, GLuint *program) {
 	GLResult result = GLResult::Success;
 	GLuint new_program = glCreateProgram();
 
@@ -45,22 +71,32 @@ GLResult LinkProgram(GLuint vertex_shader, GLuint fragment_shader, GLuint *progr
 
 	if (result == GLResult::Success) {
 		glAttachShader(new_program, vertex_shader);
+		if (geometry_shader != 0)
+			glAttachShader(new_program, geometry_shader);
 		glAttachShader(new_program, fragment_shader);
-		glLinkProgram(new_program);
+		result = FinishLink(new_program);
+	}
 
-		GLint status = GL_FALSE;
-		glGetProgramiv(new_program, GL_LINK_STATUS, &status);
+	if (result == GLResult::Success) {
+		*program = new_program;
+	}
 
-		if (status != GL_TRUE) {
-			result = GLResult::Failed;
-			GLint len = 0;
-			glGetProgramiv(new_program, GL_INFO_LOG_LENGTH, &len);
-			char *log = new char[len];
-			glGetProgramInfoLog(new_program, len, nullptr, log);
-			fprintf(stderr, "[ERROR] Program linking failed: %s", log);
-			delete[] log;
-			glDeleteProgram(new_program);
-		}
+	return result;
+}
+
+// vertex stage only, the named outputs are captured interleaved
+GLResult LinkFeedbackProgram(GLuint vertex_shader, const char* const* varyings, GLsizei count, GLuint *program) {
+	GLResult result = GLResult::Success;
+	GLuint new_program = glCreateProgram();
+
+	if (new_program == 0) {
+		result = GLResult::Error;
+	}
+
+	if (result == GLResult::Success) {
+		glAttachShader(new_program, vertex_shader);
+		glTransformFeedbackVaryings(new_program, count, varyings, GL_INTERLEAVED_ATTRIBS);
+		result = FinishLink(new_program);
 	}
 
 	if (result == GLResult::Success) {
@@ -12,6 +12,8 @@ enum GLResult {
 
 GLResult CompileShader(const char* src, GLenum type, GLuint *shader);
 GLResult LinkProgram(GLuint vertex_shader, GLuint fragment_shader, GLuint *program);
+GLResult LinkProgram(GLuint vertex_shader, GLuint geometry_shader, GLuint fragment_shader, GLuint *program);
+GLResult LinkFeedbackProgram(GLuint vertex_shader, const char* const* varyings, GLsizei count, GLuint *program);
 void GLAPIENTRY MessageCallback(GLenum source,
 				GLenum type,
 				GLuint id,
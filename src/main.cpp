@@ -1,5 +1,7 @@
 #include <GL/glew.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <SDL2/SDL.h>
 
@@ -7,24 +9,58 @@
 #include "TestScene.h"
 #include "GltfScene.h"
 #include "CubeRenderer.h"
+#include "SoftCubeRenderer.h"
+#include "JobSystem.h"
+#include "HeadlessContext.h"
+#include "Benchmark.h"
+#include "Profiler.h"
 #include "log.h"
 
 const char programName[] = "Cube Render";
 
+// main thread jobs, e.g. loading uploads, get this long each frame
+#define MAIN_JOBS_BUDGET_MS 4.0f
+
+// baked copies of loaded models, named by the hash of the source file
+#define CACHE_DIR ".cube_cache"
+
+#define DEFAULT_WIDTH 1024
+#define DEFAULT_HEIGHT 768
+
+// frames a headless run renders without --frames or --seconds
+#define HEADLESS_FRAMES 60
+
 SDL_Window *mainWindow;
 SDL_GLContext mainContext;
 
 bool SetOpenGLAttributes();
 void PrintSDL_GL_Attributes();
 void CheckSDLError();
-void RunGame();
+bool HandleEvents();
+bool RunGame();
 void Cleanup();
 
+// Stop after this many frames or ms, 0 runs until quit
+uint32_t frameLimit;
+uint32_t timeLimitMs;
+
+// --trace file and its window, written once the last frame is done
+const char* pTraceFile;
+uint32_t traceFirst;
+uint32_t traceLast;
+bool bTraceWindow;
+// T asks for the frames before it
+bool bTraceRequested;
+
+HeadlessContext *headless;
+Benchmark *benchmark;
+JobSystem *jobs;
 TestScene *testscene;
 GltfScene *gltfscene;
 CubeRenderer *cube;
+SoftCubeRenderer *soft;
 
-bool Init()
+bool InitWindow(uint32_t width, uint32_t height)
 {
 	if (SDL_Init(SDL_INIT_VIDEO) < 0)
 	{
@@ -37,7 +73,7 @@ bool Init()
 	mainWindow = SDL_CreateWindow(programName,
 				      SDL_WINDOWPOS_CENTERED,
 				      SDL_WINDOWPOS_CENTERED,
-				      1024, 768,
+				      width, height,
 				      SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
 
 	if (!mainWindow)
@@ -68,9 +104,61 @@ bool Init()
 	glDebugMessageCallback(MessageCallback, 0);
 #endif // CUBE_DEBUG
 
+	return true;
+}
+
+bool InitHeadless(uint32_t width, uint32_t height)
+{
+	// timers only, there is no video
+	if (SDL_Init(SDL_INIT_TIMER) < 0)
+	{
+		fprintf(stderr, "Failed to init SDL\n");
+		return false;
+	}
+
+	headless = new HeadlessContext();
+	if (headless->Create(width, height) != GLResult::Success)
+		return false;
+
+#ifdef CUBE_DEBUG
+	glEnable(GL_DEBUG_OUTPUT);
+	glDebugMessageCallback(MessageCallback, 0);
+#endif // CUBE_DEBUG
+
+	return true;
+}
+
+bool Init(const char* pModelFile, uint32_t instances, uint32_t width, uint32_t height, bool bHeadless, bool bSoftware)
+{
+	if (bHeadless ? !InitHeadless(width, height) : !InitWindow(width, height))
+		return false;
+
+	jobs = new JobSystem();
 	testscene = new TestScene();
-	gltfscene = new GltfScene("fox.gltf");
-	cube = new CubeRenderer(1024, 768);
+	gltfscene = new GltfScene(pModelFile, jobs, instances, CACHE_DIR);
+	cube = new CubeRenderer(width, height);
+
+	// the model loads in the background, show the test scene until it's ready
+	cube->SetPlaceholder(testscene);
+
+	if (bSoftware)
+	{
+		soft = new SoftCubeRenderer(jobs, cube->TargetDesc().faceSize);
+		soft->SetPlaceholder(testscene);
+		gltfscene->KeepSoftTextures();
+	}
+
+	if (headless != nullptr)
+		cube->SetOutputFramebuffer(headless->Framebuffer());
+
+	// every frame rendered offscreen is one asked for, and benchmarks
+	// measure the model rather than its loading, so both start with it
+	if (headless != nullptr || benchmark != nullptr)
+		gltfscene->WaitUntilLoaded();
+
+	// frame times should not be capped by the display
+	if (benchmark != nullptr && mainWindow != nullptr)
+		SDL_GL_SetSwapInterval(0);
 
 	return true;
 }
@@ -89,73 +177,321 @@ bool SetOpenGLAttributes()
 	return true;
 }
 
+void Usage()
+{
+	fprintf(stderr, "usage: cube_render [--headless] [--software] [--size WxH] [--frames N] [--seconds S]\n"
+		"                   [--output frame.png] [--benchmark report.json]\n"
+		"                   [--trace trace.json] [--trace-frames FIRST-LAST] [model] [instances]\n");
+}
+
 int main(int argc, char *argv[])
 {
-	if (!Init())
+	// .gltf or .glb, detected from the file contents
+	const char* pModelFile = "fox.gltf";
+	const char* pOutputFile = nullptr;
+	const char* pReportFile = nullptr;
+	uint32_t instances = 1;
+	uint32_t width = DEFAULT_WIDTH;
+	uint32_t height = DEFAULT_HEIGHT;
+	bool bHeadless = false;
+	bool bSoftware = false;
+	int positional = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		bool value = (i + 1 < argc);
+
+		if (strcmp(arg, "--headless") == 0)
+			bHeadless = true;
+		else if (strcmp(arg, "--software") == 0)
+			bSoftware = true;
+		else if (strcmp(arg, "--size") == 0 && value)
+		{
+			if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0)
+			{
+				Usage();
+				return -1;
+			}
+		}
+		else if (strcmp(arg, "--frames") == 0 && value)
+			frameLimit = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--seconds") == 0 && value)
+			timeLimitMs = static_cast<uint32_t>(strtod(argv[++i], nullptr) * 1000.0);
+		else if (strcmp(arg, "--output") == 0 && value)
+			pOutputFile = argv[++i];
+		else if (strcmp(arg, "--benchmark") == 0 && value)
+			pReportFile = argv[++i];
+		else if (strcmp(arg, "--trace") == 0 && value)
+			pTraceFile = argv[++i];
+		else if (strcmp(arg, "--trace-frames") == 0 && value)
+		{
+			if (sscanf(argv[++i], "%u-%u", &traceFirst, &traceLast) != 2 || traceLast < traceFirst)
+			{
+				Usage();
+				return -1;
+			}
+			bTraceWindow = true;
+		}
+		else if (arg[0] == '-' || positional == 2)
+		{
+			Usage();
+			return -1;
+		}
+		else if (positional++ == 0)
+			pModelFile = arg;
+		else
+			instances = strtoul(arg, nullptr, 10);
+	}
+
+	// GL still loads the scenes, the faces are only drawn into memory
+	if (bSoftware)
+		bHeadless = true;
+
+	if (pOutputFile != nullptr && bHeadless == false)
+		fprintf(stderr, "[WARN] --output is only written in headless mode\n");
+
+	// a fixed number of frames along the scripted path, whatever the clock says
+	if (pReportFile != nullptr)
+	{
+		benchmark = new Benchmark(frameLimit);
+		frameLimit = benchmark->TotalFrames();
+		timeLimitMs = 0;
+	}
+
+	if (bHeadless && frameLimit == 0 && timeLimitMs == 0)
+		frameLimit = HEADLESS_FRAMES;
+
+	if (bTraceWindow && pTraceFile == nullptr)
+		fprintf(stderr, "[WARN] --trace-frames has no --trace file to write\n");
+
+	ProfileThreadName("Main");
+
+	if (!Init(pModelFile, instances, width, height, bHeadless, bSoftware))
+	{
+		Cleanup();
 		return -1;
+	}
 
-	RunGame();
+	bool traced = RunGame();
+
+	// software runs write their six faces, others the composited frame
+	int result = traced ? 0 : -1;
+	if (soft != nullptr && pOutputFile != nullptr)
+	{
+		if (soft->SaveFaces(pOutputFile) != GLResult::Success)
+			result = -1;
+	}
+	else if (headless != nullptr && pOutputFile != nullptr &&
+		 headless->SaveFrame(pOutputFile) != GLResult::Success)
+		result = -1;
+
+	if (benchmark != nullptr &&
+	    benchmark->WriteReport(pReportFile, pModelFile, instances, width, height, bSoftware) != GLResult::Success)
+		result = -1;
 
 	Cleanup();
 
-	return 0;
+	return result;
 }
 
-void RunGame()
+// Window and input events, false once asked to quit
+bool HandleEvents()
 {
 	bool loop = true;
 
-	while (loop)
+	SDL_Event event;
+	while (SDL_PollEvent(&event))
 	{
-		SDL_Event event;
-		while (SDL_PollEvent(&event))
+		// scripted runs take no input, but can still be stopped
+		if (benchmark != nullptr)
 		{
-			switch (event.type) {
-			case SDL_QUIT:
+			if (event.type == SDL_QUIT ||
+			    (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE))
 				loop = false;
+			continue;
+		}
+
+		switch (event.type) {
+		case SDL_QUIT:
+			loop = false;
+			break;
+		case SDL_WINDOWEVENT:
+			switch(event.window.event) {
+			case SDL_WINDOWEVENT_RESIZED:
+				uint32_t width = event.window.data1;
+				uint32_t height = event.window.data2;
+				cube->Resize(width, height);
+					   
 				break;
-			case SDL_WINDOWEVENT:
-				switch(event.window.event) {
-				case SDL_WINDOWEVENT_RESIZED:
-					uint32_t width = event.window.data1;
-					uint32_t height = event.window.data2;
-					cube->Resize(width, height);
-						   
+			}
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+			switch (event.key.keysym.sym)
+			{
+			case SDLK_ESCAPE:
+				loop = false;
+				break;
+			case SDLK_n:
+				if (event.type == SDL_KEYDOWN)
+					gltfscene->NextAnimation();
+				break;
+			case SDLK_t:
+				if (event.type == SDL_KEYDOWN)
+					bTraceRequested = true;
+				break;
+			default:
+				cube->HandleInputEvent(event);
+			}
+			break;
+		default:
+			cube->HandleInputEvent(event);
+		}
+	}
+
+	return loop;
+}
+
+// Returns false if a trace could not be written
+bool RunGame()
+{
+	uint32_t frames = 0;
+	uint32_t start = SDL_GetTicks();
+	uint64_t drawCalls = testscene->DrawCalls() + gltfscene->DrawCalls();
+	bool traced = false;
+	bool result = true;
+
+	for (;;)
+	{
+		ProfileFrame(frames);
+
+		// the frame zone ends before a trace of it is written
+		{
+			PROFILE_ZONE("Frame");
+
+			if (benchmark != nullptr)
+				benchmark->BeginFrame(frames, cube);
+
+			if (headless == nullptr)
+			{
+				PROFILE_ZONE("HandleEvents");
+				if (HandleEvents() == false)
 					break;
+			}
+
+			{
+				PROFILE_ZONE("Step");
+
+				// scenes step on the job system while this thread moves the
+				// cameras and prepares the faces, joined before rendering
+				JobHandle step = jobs->Run([]() {
+					testscene->Step(16);
+					gltfscene->Step(16);
+				});
+
+				cube->Step(16);
+				cube->Prepare();
+
+				jobs->Wait(step);
+			}
+
+			{
+				PROFILE_ZONE("RunMainThreadJobs");
+				jobs->RunMainThreadJobs(MAIN_JOBS_BUDGET_MS);
+			}
+
+			if (benchmark != nullptr)
+				benchmark->EndPass(BenchmarkPass::Step);
+
+			{
+				PROFILE_ZONE("Render");
+
+				if (soft != nullptr)
+				{
+					glm::mat4 faces[NUM_SIDES];
+					cube->FaceViewProjections(faces);
+					soft->Render(gltfscene, faces);
 				}
-			case SDL_KEYDOWN:
-			case SDL_KEYUP:
-				switch (event.key.keysym.sym)
+				else
 				{
-				case SDLK_ESCAPE:
-					loop = false;
-					break;
-				default:
-					cube->HandleInputEvent(event);
+					cube->Render(gltfscene);
 				}
-				break;
-			default:
-				cube->HandleInputEvent(event);
 			}
+
+			if (benchmark != nullptr)
+				benchmark->EndPass(BenchmarkPass::Render);
+
+			{
+				PROFILE_ZONE("Swap");
+
+				// benchmarks time finished frames, there is no swap to wait on
+				if (headless != nullptr && benchmark != nullptr)
+					glFinish();
+				else if (headless != nullptr)
+					glFlush();
+				else
+					SDL_GL_SwapWindow(mainWindow);
+			}
+
+			if (benchmark != nullptr)
+			{
+				uint64_t total = testscene->DrawCalls() + gltfscene->DrawCalls();
+
+				benchmark->EndPass(BenchmarkPass::Present);
+				benchmark->EndFrame(cube->Stats(), total - drawCalls);
+				drawCalls = total;
+			}
+		}
+
+		// the last PROFILE_TRACE_FRAMES frames, named after the newest
+		if (bTraceRequested)
+		{
+			char fileName[64];
+			snprintf(fileName, sizeof(fileName), "trace_%u.json", frames);
+			uint32_t first = (frames >= PROFILE_TRACE_FRAMES) ? frames + 1 - PROFILE_TRACE_FRAMES : 0;
+			WriteProfileTrace(fileName, first, frames);
+			bTraceRequested = false;
 		}
 
-		testscene->Step(16);
-		cube->Step(16);
+		if (pTraceFile != nullptr && bTraceWindow && frames == traceLast)
+		{
+			if (WriteProfileTrace(pTraceFile, traceFirst, traceLast) != GLResult::Success)
+				result = false;
+			traced = true;
+		}
 
-		cube->Render(gltfscene);
+		++frames;
+		if ((frameLimit != 0 && frames >= frameLimit) ||
+		    (timeLimitMs != 0 && SDL_GetTicks() - start >= timeLimitMs))
+			break;
+	}
 
-		SDL_GL_SwapWindow(mainWindow);
+	// without a window, or one the run never reached, trace the end
+	if (pTraceFile != nullptr && traced == false && frames > 0)
+	{
+		uint32_t first = bTraceWindow ? traceFirst :
+			(frames >= PROFILE_TRACE_FRAMES) ? frames - PROFILE_TRACE_FRAMES : 0;
+		if (WriteProfileTrace(pTraceFile, first, frames - 1) != GLResult::Success)
+			result = false;
 	}
+
+	return result;
 }
 
 void Cleanup()
 {
+	delete benchmark;
+	delete soft;
 	delete cube;
 	delete testscene;
 	delete gltfscene;
+	delete jobs;
+	delete headless;
 
-	SDL_GL_DeleteContext(mainContext);
-	SDL_DestroyWindow(mainWindow);
+	if (mainContext != nullptr)
+		SDL_GL_DeleteContext(mainContext);
+	if (mainWindow != nullptr)
+		SDL_DestroyWindow(mainWindow);
 	SDL_Quit();
 }
 